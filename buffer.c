@@ -52,9 +52,22 @@ static int create_shm_file(off_t size) {
   return fd;
 }
 
-struct wooz_buffer *create_buffer(struct wl_shm *shm, enum wl_shm_format format,
-                                  int32_t width, int32_t height,
-                                  int32_t stride) {
+static void buffer_handle_release(void *data, struct wl_buffer *wl_buffer) {
+  struct wooz_buffer *buffer = data;
+  buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_handle_release,
+};
+
+// Buffers are only created from the thread running the event loop.
+static uint64_t next_buffer_id = 1;
+
+static struct wooz_buffer *create_shm_buffer(struct wl_shm *shm,
+                                             enum wl_shm_format format,
+                                             int32_t width, int32_t height,
+                                             int32_t stride, bool keep_fd) {
   size_t size = stride * height;
 
   int fd = create_shm_file(size);
@@ -71,26 +84,150 @@ struct wooz_buffer *create_buffer(struct wl_shm *shm, enum wl_shm_format format,
   struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
   struct wl_buffer *wl_buffer =
       wl_shm_pool_create_buffer(pool, 0, width, height, stride, format);
-  wl_shm_pool_destroy(pool);
 
-  close(fd);
+  if (!keep_fd) {
+    close(fd);
+    fd = -1;
+  }
 
   struct wooz_buffer *buffer = calloc(1, sizeof(struct wooz_buffer));
   buffer->wl_buffer = wl_buffer;
+  buffer->id = next_buffer_id++;
+  buffer->pool = pool;
   buffer->data = data;
   buffer->width = width;
   buffer->height = height;
   buffer->stride = stride;
   buffer->size = size;
+  buffer->pool_size = size;
   buffer->format = format;
+  buffer->fd = fd;
+  wl_buffer_add_listener(wl_buffer, &buffer_listener, buffer);
   return buffer;
 }
 
+struct wooz_buffer *create_buffer(struct wl_shm *shm, enum wl_shm_format format,
+                                  int32_t width, int32_t height,
+                                  int32_t stride) {
+  return create_shm_buffer(shm, format, width, height, stride, false);
+}
+
+struct wooz_buffer *create_buffer_with_fd(struct wl_shm *shm,
+                                          enum wl_shm_format format,
+                                          int32_t width, int32_t height,
+                                          int32_t stride) {
+  return create_shm_buffer(shm, format, width, height, stride, true);
+}
+
 void destroy_buffer(struct wooz_buffer *buffer) {
   if (buffer == NULL) {
     return;
   }
-  munmap(buffer->data, buffer->size);
+  munmap(buffer->data, buffer->pool_size);
+  if (buffer->fd >= 0) {
+    close(buffer->fd);
+  }
   wl_buffer_destroy(buffer->wl_buffer);
+  wl_shm_pool_destroy(buffer->pool);
+  free(buffer->tile_hashes);
+  free(buffer->sat);
   free(buffer);
 }
+
+bool reshape_buffer(struct wooz_buffer *buffer, enum wl_shm_format format,
+                    int32_t width, int32_t height, int32_t stride) {
+  size_t size = (size_t)stride * height;
+  if (buffer->busy || size > buffer->pool_size) {
+    return false;
+  }
+
+  wl_buffer_destroy(buffer->wl_buffer);
+  buffer->wl_buffer =
+      wl_shm_pool_create_buffer(buffer->pool, 0, width, height, stride, format);
+  wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+  buffer->id = next_buffer_id++;
+  buffer->width = width;
+  buffer->height = height;
+  buffer->stride = stride;
+  buffer->size = size;
+  buffer->format = format;
+
+  free(buffer->tile_hashes);
+  buffer->tile_hashes = NULL;
+  buffer->tile_cols = buffer->tile_rows = 0;
+  free(buffer->sat);
+  buffer->sat = NULL;
+  buffer->sat_valid = false;
+  return true;
+}
+
+int32_t shm_format_bytes_per_pixel(enum wl_shm_format format) {
+  switch (format) {
+  case WL_SHM_FORMAT_ARGB8888:
+  case WL_SHM_FORMAT_XRGB8888:
+  case WL_SHM_FORMAT_ABGR8888:
+  case WL_SHM_FORMAT_XBGR8888:
+  case WL_SHM_FORMAT_RGBA8888:
+  case WL_SHM_FORMAT_RGBX8888:
+  case WL_SHM_FORMAT_BGRA8888:
+  case WL_SHM_FORMAT_BGRX8888:
+  case WL_SHM_FORMAT_ARGB2101010:
+  case WL_SHM_FORMAT_XRGB2101010:
+  case WL_SHM_FORMAT_ABGR2101010:
+  case WL_SHM_FORMAT_XBGR2101010:
+    return 4;
+  case WL_SHM_FORMAT_RGB888:
+  case WL_SHM_FORMAT_BGR888:
+    return 3;
+  case WL_SHM_FORMAT_RGB565:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+// Position of the 8 most significant bits of each channel in the 4 bytes
+// little endian formats.
+static const struct {
+  enum wl_shm_format format;
+  uint8_t shifts[3];
+} channel_layouts[] = {
+    {WL_SHM_FORMAT_ARGB8888, {16, 8, 0}},
+    {WL_SHM_FORMAT_XRGB8888, {16, 8, 0}},
+    {WL_SHM_FORMAT_ABGR8888, {0, 8, 16}},
+    {WL_SHM_FORMAT_XBGR8888, {0, 8, 16}},
+    {WL_SHM_FORMAT_RGBA8888, {24, 16, 8}},
+    {WL_SHM_FORMAT_RGBX8888, {24, 16, 8}},
+    {WL_SHM_FORMAT_BGRA8888, {8, 16, 24}},
+    {WL_SHM_FORMAT_BGRX8888, {8, 16, 24}},
+    {WL_SHM_FORMAT_ARGB2101010, {22, 12, 2}},
+    {WL_SHM_FORMAT_XRGB2101010, {22, 12, 2}},
+    {WL_SHM_FORMAT_ABGR2101010, {2, 12, 22}},
+    {WL_SHM_FORMAT_XBGR2101010, {2, 12, 22}},
+};
+
+const uint8_t *shm_format_channel_shifts(enum wl_shm_format format) {
+  size_t n = sizeof(channel_layouts) / sizeof(channel_layouts[0]);
+  for (size_t i = 0; i < n; i++) {
+    if (channel_layouts[i].format == format) {
+      return channel_layouts[i].shifts;
+    }
+  }
+  return NULL;
+}
+
+int shm_format_preference(enum wl_shm_format format) {
+  switch (format) {
+  case WL_SHM_FORMAT_ARGB8888:
+  case WL_SHM_FORMAT_XRGB8888:
+  case WL_SHM_FORMAT_ABGR8888:
+  case WL_SHM_FORMAT_XBGR8888:
+    return 3;
+  default:
+    break;
+  }
+  if (shm_format_channel_shifts(format) != NULL) {
+    return 2;
+  }
+  return shm_format_bytes_per_pixel(format) != 0 ? 1 : 0;
+}
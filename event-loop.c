@@ -0,0 +1,362 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event-loop.h"
+
+#define EVENT_LOOP_MAX_EVENTS 16
+#define NSEC_PER_MSEC 1000000ull
+#define NSEC_PER_SEC 1000000000ull
+
+struct wooz_event_source {
+  int fd;
+  wooz_fd_func_t func;
+  void *data;
+  struct wl_list link; // wooz_event_loop.sources or destroyed
+};
+
+struct wooz_event_loop {
+  struct wl_display *display;
+  int epoll_fd;
+
+  // Marker sources for the display and timer fds, they have no callback.
+  struct wooz_event_source display_source;
+  struct wooz_event_source timer_source;
+
+  struct wl_list sources;
+  // Sources removed during dispatch, freed once the dispatch is over.
+  struct wl_list destroyed;
+
+  // Min-heap of scheduled timers ordered by deadline, all backed by
+  // timer_source.fd.
+  struct wooz_timer **timers;
+  size_t n_timers, timers_cap;
+  uint64_t armed_deadline; // Deadline timer_source.fd is armed at, 0 if none
+
+  uint64_t wakeups; // Returns from epoll_wait, see --stats
+};
+
+static uint64_t monotonic_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int epoll_add(struct wooz_event_loop *loop,
+                     struct wooz_event_source *source, uint32_t events) {
+  struct epoll_event ev = {
+      .events = events,
+      .data.ptr = source,
+  };
+  return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &ev);
+}
+
+struct wooz_event_loop *event_loop_create(struct wl_display *display) {
+  struct wooz_event_loop *loop = calloc(1, sizeof(struct wooz_event_loop));
+  if (loop == NULL) {
+    return NULL;
+  }
+  loop->display = display;
+  wl_list_init(&loop->sources);
+  wl_list_init(&loop->destroyed);
+
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epoll_fd < 0) {
+    free(loop);
+    return NULL;
+  }
+
+  loop->timer_source.fd =
+      timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (loop->timer_source.fd < 0) {
+    close(loop->epoll_fd);
+    free(loop);
+    return NULL;
+  }
+
+  loop->display_source.fd = wl_display_get_fd(display);
+  if (epoll_add(loop, &loop->display_source, EPOLLIN) < 0 ||
+      epoll_add(loop, &loop->timer_source, EPOLLIN) < 0) {
+    event_loop_destroy(loop);
+    return NULL;
+  }
+
+  return loop;
+}
+
+void event_loop_destroy(struct wooz_event_loop *loop) {
+  if (loop == NULL) {
+    return;
+  }
+
+  struct wooz_event_source *source, *tmp;
+  wl_list_for_each_safe(source, tmp, &loop->sources, link) {
+    wl_list_remove(&source->link);
+    free(source);
+  }
+  wl_list_for_each_safe(source, tmp, &loop->destroyed, link) {
+    wl_list_remove(&source->link);
+    free(source);
+  }
+
+  for (size_t i = 0; i < loop->n_timers; i++) {
+    loop->timers[i]->index = SIZE_MAX;
+  }
+  free(loop->timers);
+
+  close(loop->timer_source.fd);
+  close(loop->epoll_fd);
+  free(loop);
+}
+
+struct wooz_event_source *event_loop_add_fd(struct wooz_event_loop *loop,
+                                            int fd, uint32_t events,
+                                            wooz_fd_func_t func, void *data) {
+  struct wooz_event_source *source = calloc(1, sizeof(*source));
+  if (source == NULL) {
+    return NULL;
+  }
+  source->fd = fd;
+  source->func = func;
+  source->data = data;
+
+  if (epoll_add(loop, source, events) < 0) {
+    free(source);
+    return NULL;
+  }
+
+  wl_list_insert(&loop->sources, &source->link);
+  return source;
+}
+
+void event_loop_remove_fd(struct wooz_event_loop *loop,
+                          struct wooz_event_source *source) {
+  if (source == NULL) {
+    return;
+  }
+
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+  // Events for this source may still be pending in the current dispatch.
+  source->func = NULL;
+  wl_list_remove(&source->link);
+  wl_list_insert(&loop->destroyed, &source->link);
+}
+
+void timer_init(struct wooz_timer *timer, wooz_timer_func_t func, void *data) {
+  memset(timer, 0, sizeof(*timer));
+  timer->func = func;
+  timer->data = data;
+  timer->index = SIZE_MAX;
+}
+
+bool timer_is_scheduled(const struct wooz_timer *timer) {
+  return timer->index != SIZE_MAX;
+}
+
+static void heap_set(struct wooz_event_loop *loop, size_t i,
+                     struct wooz_timer *timer) {
+  loop->timers[i] = timer;
+  timer->index = i;
+}
+
+static void heap_sift_up(struct wooz_event_loop *loop, size_t i) {
+  struct wooz_timer *timer = loop->timers[i];
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (loop->timers[parent]->deadline <= timer->deadline) {
+      break;
+    }
+    heap_set(loop, i, loop->timers[parent]);
+    i = parent;
+  }
+  heap_set(loop, i, timer);
+}
+
+static void heap_sift_down(struct wooz_event_loop *loop, size_t i) {
+  struct wooz_timer *timer = loop->timers[i];
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= loop->n_timers) {
+      break;
+    }
+    if (child + 1 < loop->n_timers &&
+        loop->timers[child + 1]->deadline < loop->timers[child]->deadline) {
+      child++;
+    }
+    if (timer->deadline <= loop->timers[child]->deadline) {
+      break;
+    }
+    heap_set(loop, i, loop->timers[child]);
+    i = child;
+  }
+  heap_set(loop, i, timer);
+}
+
+static void heap_remove(struct wooz_event_loop *loop,
+                        struct wooz_timer *timer) {
+  size_t i = timer->index;
+  timer->index = SIZE_MAX;
+
+  loop->n_timers--;
+  if (i == loop->n_timers) {
+    return;
+  }
+
+  struct wooz_timer *moved = loop->timers[loop->n_timers];
+  heap_set(loop, i, moved);
+  heap_sift_down(loop, i);
+  heap_sift_up(loop, moved->index);
+}
+
+// Callers rely on scheduled timers firing, they can't be dropped: running out
+// of memory for the heap is fatal.
+static void heap_insert(struct wooz_event_loop *loop,
+                        struct wooz_timer *timer) {
+  if (loop->n_timers == loop->timers_cap) {
+    size_t cap = loop->timers_cap ? loop->timers_cap * 2 : 8;
+    struct wooz_timer **timers =
+        realloc(loop->timers, cap * sizeof(struct wooz_timer *));
+    if (timers == NULL) {
+      fprintf(stderr, "failed to schedule timer\n");
+      exit(EXIT_FAILURE);
+    }
+    loop->timers = timers;
+    loop->timers_cap = cap;
+  }
+
+  heap_set(loop, loop->n_timers++, timer);
+  heap_sift_up(loop, timer->index);
+}
+
+// Arm the timerfd on the earliest deadline. Only touches the fd when the
+// earliest deadline changed.
+static void update_timerfd(struct wooz_event_loop *loop) {
+  uint64_t deadline = loop->n_timers > 0 ? loop->timers[0]->deadline : 0;
+  if (deadline == loop->armed_deadline) {
+    return;
+  }
+
+  struct itimerspec its = {0};
+  its.it_value.tv_sec = deadline / NSEC_PER_SEC;
+  its.it_value.tv_nsec = deadline % NSEC_PER_SEC;
+  timerfd_settime(loop->timer_source.fd, TFD_TIMER_ABSTIME, &its, NULL);
+  loop->armed_deadline = deadline;
+}
+
+void event_loop_schedule(struct wooz_event_loop *loop,
+                         struct wooz_timer *timer, uint32_t delay_ms,
+                         uint32_t interval_ms) {
+  if (timer_is_scheduled(timer)) {
+    heap_remove(loop, timer);
+  }
+
+  timer->deadline = monotonic_now() + delay_ms * NSEC_PER_MSEC;
+  // A zero deadline disarms the timerfd.
+  if (timer->deadline == 0) {
+    timer->deadline = 1;
+  }
+  timer->interval = interval_ms * NSEC_PER_MSEC;
+  heap_insert(loop, timer);
+  update_timerfd(loop);
+}
+
+void event_loop_cancel(struct wooz_event_loop *loop, struct wooz_timer *timer) {
+  if (!timer_is_scheduled(timer)) {
+    return;
+  }
+
+  heap_remove(loop, timer);
+  update_timerfd(loop);
+}
+
+static void run_timers(struct wooz_event_loop *loop) {
+  uint64_t expirations;
+  read(loop->timer_source.fd, &expirations, sizeof(expirations));
+  // The timerfd fired, it is no longer armed.
+  loop->armed_deadline = 0;
+
+  uint64_t now = monotonic_now();
+  while (loop->n_timers > 0 && loop->timers[0]->deadline <= now) {
+    struct wooz_timer *timer = loop->timers[0];
+    heap_remove(loop, timer);
+
+    // Reschedule before running so the callback may cancel the timer.
+    if (timer->interval != 0) {
+      timer->deadline += timer->interval;
+      if (timer->deadline <= now) {
+        // Skip missed expirations instead of firing them in a burst.
+        timer->deadline = now + timer->interval;
+      }
+      heap_insert(loop, timer);
+    }
+
+    timer->func(timer->data);
+  }
+
+  update_timerfd(loop);
+}
+
+int event_loop_dispatch(struct wooz_event_loop *loop) {
+  struct wl_display *display = loop->display;
+
+  while (wl_display_prepare_read(display) != 0) {
+    if (wl_display_dispatch_pending(display) < 0) {
+      return -1;
+    }
+  }
+
+  if (wl_display_flush(display) < 0 && errno != EAGAIN) {
+    wl_display_cancel_read(display);
+    return -1;
+  }
+
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+  int n = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+  if (n < 0) {
+    wl_display_cancel_read(display);
+    return errno == EINTR ? 0 : -1;
+  }
+  loop->wakeups++;
+
+  // Complete the read before running any callback, they may issue requests
+  // or roundtrips of their own.
+  bool display_ready = false;
+  for (int i = 0; i < n; i++) {
+    if (events[i].data.ptr == &loop->display_source) {
+      display_ready = true;
+    }
+  }
+  if (display_ready) {
+    if (wl_display_read_events(display) < 0) {
+      return -1;
+    }
+  } else {
+    wl_display_cancel_read(display);
+  }
+
+  for (int i = 0; i < n; i++) {
+    struct wooz_event_source *source = events[i].data.ptr;
+    if (source == &loop->timer_source) {
+      run_timers(loop);
+    } else if (source != &loop->display_source && source->func != NULL) {
+      source->func(source->fd, events[i].events, source->data);
+    }
+  }
+
+  struct wooz_event_source *source, *tmp;
+  wl_list_for_each_safe(source, tmp, &loop->destroyed, link) {
+    wl_list_remove(&source->link);
+    free(source);
+  }
+
+  return wl_display_dispatch_pending(display) < 0 ? -1 : 0;
+}
+
+uint64_t event_loop_get_wakeups(const struct wooz_event_loop *loop) {
+  return loop->wakeups;
+}
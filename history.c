@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+#include "stats.h"
+#include "tiles.h"
+
+#define HISTORY_MIN_BUCKETS 256
+
+static size_t bucket_of(const struct wooz_history *history, uint64_t hash) {
+  return (size_t)(hash ^ (hash >> 32)) & (history->n_buckets - 1);
+}
+
+// Size of the tile at col, row: the last column and row may be partial.
+static void tile_extent(const struct wooz_history *history, int32_t col,
+                        int32_t row, uint32_t *width, uint32_t *height) {
+  size_t x = (size_t)col * history->tile_bytes;
+  size_t rows = history->size / history->stride - (size_t)row * TILE_SIZE;
+  *width = (uint32_t)(history->stride - x < history->tile_bytes
+                          ? history->stride - x
+                          : history->tile_bytes);
+  *height = (uint32_t)(rows < TILE_SIZE ? rows : TILE_SIZE);
+}
+
+// First row of the tile at col, row in buffer.
+static const uint8_t *tile_source(const struct wooz_history *history,
+                                  const struct wooz_buffer *buffer,
+                                  int32_t col, int32_t row) {
+  return (const uint8_t *)buffer->data +
+         (size_t)row * TILE_SIZE * buffer->stride +
+         (size_t)col * history->tile_bytes;
+}
+
+// A stored tile with the content of the one at col, row in buffer. Hashes
+// only narrow the search down, tiles from elsewhere are compared.
+static struct wooz_history_tile *find_tile(const struct wooz_history *history,
+                                           const struct wooz_buffer *buffer,
+                                           int32_t col, int32_t row,
+                                           uint64_t hash) {
+  uint32_t width, height;
+  tile_extent(history, col, row, &width, &height);
+  const uint8_t *src = tile_source(history, buffer, col, row);
+  struct wooz_history_tile *tile = history->buckets[bucket_of(history, hash)];
+  for (; tile != NULL; tile = tile->next) {
+    if (tile->hash != hash || tile->width != width ||
+        tile->height != height) {
+      continue;
+    }
+    uint32_t y = 0;
+    while (y < height && memcmp(tile->data + (size_t)y * width,
+                                src + (size_t)y * buffer->stride,
+                                width) == 0) {
+      y++;
+    }
+    if (y == height) {
+      return tile;
+    }
+  }
+  return NULL;
+}
+
+// Double the buckets, they are kept as they are if that fails.
+static void grow_buckets(struct wooz_history *history) {
+  size_t n_buckets = history->n_buckets * 2;
+  struct wooz_history_tile **buckets =
+      calloc(n_buckets, sizeof(struct wooz_history_tile *));
+  if (buckets == NULL) {
+    return;
+  }
+
+  struct wooz_history_tile **old = history->buckets;
+  size_t old_n = history->n_buckets;
+  history->buckets = buckets;
+  history->n_buckets = n_buckets;
+  for (size_t i = 0; i < old_n; i++) {
+    struct wooz_history_tile *tile = old[i];
+    while (tile != NULL) {
+      struct wooz_history_tile *next = tile->next;
+      size_t bucket = bucket_of(history, tile->hash);
+      tile->next = buckets[bucket];
+      buckets[bucket] = tile;
+      tile = next;
+    }
+  }
+  free(old);
+}
+
+static struct wooz_history_tile *add_tile(struct wooz_history *history,
+                                          const struct wooz_buffer *buffer,
+                                          int32_t col, int32_t row,
+                                          uint64_t hash) {
+  uint32_t width, height;
+  tile_extent(history, col, row, &width, &height);
+  size_t bytes = (size_t)width * height;
+  struct wooz_history_tile *tile =
+      malloc(sizeof(struct wooz_history_tile) + bytes);
+  if (tile == NULL) {
+    return NULL;
+  }
+  tile->hash = hash;
+  tile->width = width;
+  tile->height = height;
+  tile->refs = 0;
+
+  const uint8_t *src = tile_source(history, buffer, col, row);
+  for (uint32_t y = 0; y < height; y++) {
+    memcpy(tile->data + (size_t)y * width, src + (size_t)y * buffer->stride,
+           width);
+  }
+
+  if (history->n_tiles >= history->n_buckets) {
+    grow_buckets(history);
+  }
+  size_t bucket = bucket_of(history, hash);
+  tile->next = history->buckets[bucket];
+  history->buckets[bucket] = tile;
+  history->n_tiles++;
+  history->tile_data += bytes;
+  return tile;
+}
+
+static void release_tile(struct wooz_history *history,
+                         struct wooz_history_tile *tile) {
+  if (--tile->refs > 0) {
+    return;
+  }
+  struct wooz_history_tile **link =
+      &history->buckets[bucket_of(history, tile->hash)];
+  while (*link != tile) {
+    link = &(*link)->next;
+  }
+  *link = tile->next;
+  history->n_tiles--;
+  history->tile_data -= (size_t)tile->width * tile->height;
+  free(tile);
+}
+
+// Release the first n tiles of tiles, and the array.
+static void release_tiles(struct wooz_history *history,
+                          struct wooz_history_tile **tiles, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    release_tile(history, tiles[i]);
+  }
+  free(tiles);
+}
+
+struct wooz_history *history_create(size_t capacity) {
+  struct wooz_history *history = calloc(1, sizeof(struct wooz_history));
+  if (history == NULL) {
+    return NULL;
+  }
+  history->capacity = capacity;
+  history->snapshots = calloc(capacity, sizeof(struct wooz_snapshot));
+  history->n_buckets = HISTORY_MIN_BUCKETS;
+  history->buckets =
+      calloc(history->n_buckets, sizeof(struct wooz_history_tile *));
+  if (history->snapshots == NULL || history->buckets == NULL) {
+    history_destroy(history);
+    return NULL;
+  }
+  return history;
+}
+
+void history_destroy(struct wooz_history *history) {
+  if (history == NULL) {
+    return;
+  }
+  history_clear(history);
+  free(history->snapshots);
+  free(history->buckets);
+  free(history);
+}
+
+void history_clear(struct wooz_history *history) {
+  size_t n = (size_t)history->tile_cols * history->tile_rows;
+  for (size_t age = 0; age < history->count; age++) {
+    size_t index =
+        (history->head + history->capacity - age) % history->capacity;
+    release_tiles(history, history->snapshots[index].tiles, n);
+    history->snapshots[index].tiles = NULL;
+  }
+  history->count = 0;
+  history->head = 0;
+}
+
+static bool same_layout(const struct wooz_history *history,
+                        const struct wooz_buffer *buffer) {
+  return history->format == buffer->format &&
+         history->width == buffer->width &&
+         history->height == buffer->height &&
+         history->stride == buffer->stride && history->size == buffer->size;
+}
+
+static bool same_tiles(const struct wooz_snapshot *snapshot,
+                       const uint64_t *hashes, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (snapshot->tiles[i]->hash != hashes[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool history_push(struct wooz_history *history,
+                  const struct wooz_buffer *buffer) {
+  if (buffer->tile_hashes == NULL) {
+    return false;
+  }
+  if (!same_layout(history, buffer)) {
+    history_clear(history);
+    history->format = buffer->format;
+    history->width = buffer->width;
+    history->height = buffer->height;
+    history->stride = buffer->stride;
+    history->size = buffer->size;
+    tile_layout(buffer, &history->tile_cols, &history->tile_rows,
+                &history->tile_bytes);
+  }
+  if (buffer->tile_cols != history->tile_cols ||
+      buffer->tile_rows != history->tile_rows) {
+    return false;
+  }
+
+  size_t n = (size_t)history->tile_cols * history->tile_rows;
+  const struct wooz_snapshot *newest = history_get(history, 0);
+  if (newest != NULL && same_tiles(newest, buffer->tile_hashes, n)) {
+    return true;
+  }
+
+  struct wooz_history_tile **tiles =
+      malloc(n * sizeof(struct wooz_history_tile *));
+  if (tiles == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    uint64_t hash = buffer->tile_hashes[i];
+    struct wooz_history_tile *tile;
+    if (newest != NULL && newest->tiles[i]->hash == hash) {
+      // Most tiles didn't change, they don't need a lookup.
+      tile = newest->tiles[i];
+    } else {
+      int32_t col = (int32_t)(i % history->tile_cols);
+      int32_t row = (int32_t)(i / history->tile_cols);
+      tile = find_tile(history, buffer, col, row, hash);
+      if (tile == NULL) {
+        tile = add_tile(history, buffer, col, row, hash);
+      }
+      if (tile == NULL) {
+        release_tiles(history, tiles, i);
+        return false;
+      }
+    }
+    tile->refs++;
+    tiles[i] = tile;
+  }
+
+  // The oldest snapshot is released last, its tiles may have been reused.
+  size_t next = history->count == 0
+                    ? 0
+                    : (history->head + 1) % history->capacity;
+  if (history->count == history->capacity) {
+    release_tiles(history, history->snapshots[next].tiles, n);
+  } else {
+    history->count++;
+  }
+  history->snapshots[next] = (struct wooz_snapshot){
+      .time = stats_now(),
+      .tiles = tiles,
+  };
+  history->head = next;
+  return true;
+}
+
+const struct wooz_snapshot *history_get(const struct wooz_history *history,
+                                        size_t age) {
+  if (age >= history->count) {
+    return NULL;
+  }
+  return &history->snapshots[(history->head + history->capacity - age) %
+                             history->capacity];
+}
+
+void history_restore(const struct wooz_history *history,
+                     const struct wooz_snapshot *snapshot,
+                     struct wooz_buffer *dst) {
+  for (int32_t row = 0; row < history->tile_rows; row++) {
+    for (int32_t col = 0; col < history->tile_cols; col++) {
+      const struct wooz_history_tile *tile =
+          snapshot->tiles[row * history->tile_cols + col];
+      uint8_t *out = (uint8_t *)dst->data +
+                     (size_t)row * TILE_SIZE * dst->stride +
+                     (size_t)col * history->tile_bytes;
+      for (uint32_t y = 0; y < tile->height; y++) {
+        memcpy(out + (size_t)y * dst->stride,
+               tile->data + (size_t)y * tile->width, tile->width);
+      }
+    }
+  }
+  dst->sat_valid = false;
+}
@@ -0,0 +1,941 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "image.h"
+
+#define IMAGE_TILE_PIXELS ((size_t)IMAGE_TILE_SIZE * IMAGE_TILE_SIZE)
+#define IMAGE_TILE_BYTES (IMAGE_TILE_PIXELS * sizeof(uint32_t))
+#define IMAGE_MAX_SIZE (1 << 20) // Largest width or height
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
+
+enum image_format {
+  IMAGE_RAW, // PNM and PAM, decoded straight from the mapping
+  IMAGE_QOI,
+  IMAGE_PNG,
+};
+
+struct image_tile {
+  uint32_t *pixels; // XRGB8888, IMAGE_TILE_SIZE pixels stride
+  size_t index;     // In wooz_image.tiles
+  struct wl_list link; // wooz_image.lru
+};
+
+// Layout of uncompressed PNM and PAM samples.
+struct raw_layout {
+  size_t offset;
+  int channels; // 1 grey, 2 grey and alpha, 3 RGB, 4 RGBA
+  int sample_size; // Bytes, big endian
+  uint32_t maxval;
+};
+
+struct qoi_state {
+  size_t pos;
+  uint8_t index[64][4];
+  uint8_t px[4];
+  uint32_t run;
+};
+
+// IDAT chunk data, the zlib stream is split across them.
+struct png_segment {
+  size_t offset, length;
+};
+
+struct png_state {
+  z_stream stream;
+  size_t segment; // Next segment to feed to stream
+  uint8_t *prev;  // Previous unfiltered scanline
+};
+
+struct png_info {
+  int color_type, depth, channels;
+  size_t row_size;   // Scanline bytes, without the filter type
+  size_t pixel_size; // Bytes per complete pixel, at least 1
+  uint8_t palette[256][4];
+  struct png_segment *segments;
+  size_t n_segments;
+  uint8_t *row; // Filter type and scanline being decoded
+};
+
+struct wooz_image {
+  uint8_t *data;
+  size_t size;
+  int32_t width, height;
+  enum image_format format;
+
+  // Decoded tiles, indexed by row * cols + col, NULL when not cached.
+  struct image_tile **tiles;
+  int32_t cols, rows;
+  struct wl_list lru; // Most recently used first
+  size_t n_tiles, max_tiles;
+
+  // QOI and PNG streams can't be seeked, they are decoded band by band. The
+  // decoder state is saved at the start of each band reached so far.
+  int32_t row; // Next row of the sequential decoder
+  bool *checkpoints; // Band has a saved decoder state
+  struct image_tile **band;
+  uint32_t *row_pixels;
+
+  struct raw_layout raw;
+  struct qoi_state qoi;
+  struct qoi_state *qoi_checkpoints;
+  struct png_info png;
+  struct png_state png_state;
+  struct png_state *png_checkpoints;
+};
+
+static uint32_t load_be32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         (uint32_t)p[3];
+}
+
+// Alpha is composited over black.
+static uint32_t pack_rgba(uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+  if (a != 255) {
+    r = r * a / 255;
+    g = g * a / 255;
+    b = b * a / 255;
+  }
+  return 0xff000000 | r << 16 | g << 8 | b;
+}
+
+static bool valid_size(int64_t width, int64_t height) {
+  return width > 0 && height > 0 && width <= IMAGE_MAX_SIZE &&
+         height <= IMAGE_MAX_SIZE;
+}
+
+static void skip_space(const uint8_t *data, size_t size, size_t *pos) {
+  while (*pos < size) {
+    if (data[*pos] == '#') {
+      while (*pos < size && data[*pos] != '\n') {
+        (*pos)++;
+      }
+    } else if (data[*pos] == ' ' || data[*pos] == '\t' ||
+               data[*pos] == '\n' || data[*pos] == '\r') {
+      (*pos)++;
+    } else {
+      break;
+    }
+  }
+}
+
+static bool parse_uint(const uint8_t *data, size_t size, size_t *pos,
+                       int64_t *value) {
+  if (*pos >= size || data[*pos] < '0' || data[*pos] > '9') {
+    return false;
+  }
+  *value = 0;
+  while (*pos < size && data[*pos] >= '0' && data[*pos] <= '9') {
+    *value = *value * 10 + (data[*pos] - '0');
+    if (*value > INT32_MAX) {
+      return false;
+    }
+    (*pos)++;
+  }
+  return true;
+}
+
+static bool set_raw_layout(struct wooz_image *image, size_t offset,
+                           int64_t width, int64_t height, int64_t channels,
+                           int64_t maxval) {
+  if (!valid_size(width, height) || channels < 1 || channels > 4 ||
+      maxval < 1 || maxval > 65535) {
+    return false;
+  }
+  struct raw_layout *raw = &image->raw;
+  raw->offset = offset;
+  raw->channels = channels;
+  raw->sample_size = maxval > 255 ? 2 : 1;
+  raw->maxval = maxval;
+
+  size_t pixel_size = raw->channels * raw->sample_size;
+  if (offset > image->size ||
+      (image->size - offset) / pixel_size / width < (size_t)height) {
+    return false;
+  }
+  image->width = width;
+  image->height = height;
+  image->format = IMAGE_RAW;
+  return true;
+}
+
+// P5 and P6: magic, width, height and maxval separated by whitespace and
+// comments, then a single whitespace character.
+static bool open_pnm(struct wooz_image *image) {
+  const uint8_t *data = image->data;
+  size_t pos = 2;
+  int64_t width, height, maxval;
+
+  skip_space(data, image->size, &pos);
+  if (!parse_uint(data, image->size, &pos, &width)) {
+    return false;
+  }
+  skip_space(data, image->size, &pos);
+  if (!parse_uint(data, image->size, &pos, &height)) {
+    return false;
+  }
+  skip_space(data, image->size, &pos);
+  if (!parse_uint(data, image->size, &pos, &maxval) || pos >= image->size) {
+    return false;
+  }
+
+  int channels = data[1] == '5' ? 1 : 3;
+  return set_raw_layout(image, pos + 1, width, height, channels, maxval);
+}
+
+// P7: "KEY value" lines up to ENDHDR.
+static bool open_pam(struct wooz_image *image) {
+  const uint8_t *data = image->data;
+  size_t size = image->size;
+  size_t pos = 2;
+  int64_t width = 0, height = 0, depth = 0, maxval = 0;
+
+  for (;;) {
+    skip_space(data, size, &pos);
+    size_t start = pos;
+    while (pos < size && data[pos] >= 'A' && data[pos] <= 'Z') {
+      pos++;
+    }
+    size_t len = pos - start;
+    const char *key = (const char *)data + start;
+    if (len == 0) {
+      return false;
+    }
+
+    if (len == 6 && memcmp(key, "ENDHDR", len) == 0) {
+      if (pos >= size || data[pos] != '\n') {
+        return false;
+      }
+      pos++;
+      break;
+    }
+
+    int64_t *value = NULL;
+    if (len == 5 && memcmp(key, "WIDTH", len) == 0) {
+      value = &width;
+    } else if (len == 6 && memcmp(key, "HEIGHT", len) == 0) {
+      value = &height;
+    } else if (len == 5 && memcmp(key, "DEPTH", len) == 0) {
+      value = &depth;
+    } else if (len == 6 && memcmp(key, "MAXVAL", len) == 0) {
+      value = &maxval;
+    }
+
+    if (value != NULL) {
+      skip_space(data, size, &pos);
+      if (!parse_uint(data, size, &pos, value)) {
+        return false;
+      }
+    } else {
+      // TUPLTYPE, the layout follows from DEPTH.
+      while (pos < size && data[pos] != '\n') {
+        pos++;
+      }
+    }
+  }
+
+  return set_raw_layout(image, pos, width, height, depth, maxval);
+}
+
+static void raw_decode(const struct wooz_image *image, int32_t x, int32_t y,
+                       int32_t n, uint32_t *out) {
+  const struct raw_layout *raw = &image->raw;
+  size_t pixel_size = raw->channels * raw->sample_size;
+  const uint8_t *p =
+      image->data + raw->offset +
+      ((size_t)y * image->width + x) * pixel_size;
+
+  for (int32_t i = 0; i < n; i++) {
+    uint32_t s[4];
+    for (int c = 0; c < raw->channels; c++, p += raw->sample_size) {
+      uint32_t v = raw->sample_size == 2 ? (uint32_t)p[0] << 8 | p[1] : p[0];
+      s[c] = raw->maxval == 255 ? v : (v * 255 + raw->maxval / 2) / raw->maxval;
+    }
+    switch (raw->channels) {
+    case 1:
+      out[i] = pack_rgba(s[0], s[0], s[0], 255);
+      break;
+    case 2:
+      out[i] = pack_rgba(s[0], s[0], s[0], s[1]);
+      break;
+    case 3:
+      out[i] = pack_rgba(s[0], s[1], s[2], 255);
+      break;
+    default:
+      out[i] = pack_rgba(s[0], s[1], s[2], s[3]);
+      break;
+    }
+  }
+}
+
+static bool open_qoi(struct wooz_image *image) {
+  const uint8_t *data = image->data;
+  if (image->size < QOI_HEADER_SIZE + QOI_PADDING_SIZE) {
+    return false;
+  }
+
+  int64_t width = load_be32(data + 4);
+  int64_t height = load_be32(data + 8);
+  if (!valid_size(width, height)) {
+    return false;
+  }
+  image->width = width;
+  image->height = height;
+  image->format = IMAGE_QOI;
+
+  memset(&image->qoi, 0, sizeof(image->qoi));
+  image->qoi.pos = QOI_HEADER_SIZE;
+  image->qoi.px[3] = 255;
+  return true;
+}
+
+static bool qoi_decode_row(struct wooz_image *image, uint32_t *out) {
+  struct qoi_state *s = &image->qoi;
+  const uint8_t *data = image->data;
+  size_t end = image->size - QOI_PADDING_SIZE;
+  uint8_t *px = s->px;
+
+  for (int32_t x = 0; x < image->width; x++) {
+    if (s->run > 0) {
+      s->run--;
+    } else {
+      if (s->pos >= end) {
+        return false;
+      }
+      uint8_t b1 = data[s->pos++];
+      if (b1 == 0xfe) {
+        if (end - s->pos < 3) {
+          return false;
+        }
+        memcpy(px, data + s->pos, 3);
+        s->pos += 3;
+      } else if (b1 == 0xff) {
+        if (end - s->pos < 4) {
+          return false;
+        }
+        memcpy(px, data + s->pos, 4);
+        s->pos += 4;
+      } else if ((b1 & 0xc0) == 0x00) {
+        memcpy(px, s->index[b1], 4);
+      } else if ((b1 & 0xc0) == 0x40) {
+        px[0] += ((b1 >> 4) & 0x03) - 2;
+        px[1] += ((b1 >> 2) & 0x03) - 2;
+        px[2] += (b1 & 0x03) - 2;
+      } else if ((b1 & 0xc0) == 0x80) {
+        if (s->pos >= end) {
+          return false;
+        }
+        uint8_t b2 = data[s->pos++];
+        int vg = (b1 & 0x3f) - 32;
+        px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+        px[1] += vg;
+        px[2] += vg - 8 + (b2 & 0x0f);
+      } else {
+        s->run = b1 & 0x3f;
+      }
+      int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+      memcpy(s->index[hash], px, 4);
+    }
+    out[x] = pack_rgba(px[0], px[1], px[2], px[3]);
+  }
+  return true;
+}
+
+static bool open_png(struct wooz_image *image) {
+  const uint8_t *data = image->data;
+  size_t size = image->size;
+  struct png_info *png = &image->png;
+  size_t pos = 8;
+  bool has_header = false;
+  size_t segments_cap = 0;
+
+  for (int i = 0; i < 256; i++) {
+    png->palette[i][3] = 255;
+  }
+
+  while (size - pos >= 12) {
+    size_t len = load_be32(data + pos);
+    const uint8_t *type = data + pos + 4;
+    const uint8_t *chunk = data + pos + 8;
+    if (len > size - pos - 12) {
+      return false;
+    }
+
+    if (memcmp(type, "IHDR", 4) == 0 && len >= 13) {
+      int64_t width = load_be32(chunk);
+      int64_t height = load_be32(chunk + 4);
+      png->depth = chunk[8];
+      png->color_type = chunk[9];
+      // Adam7 interlaced images can't be decoded by rows.
+      if (!valid_size(width, height) || chunk[12] != 0) {
+        return false;
+      }
+      image->width = width;
+      image->height = height;
+      has_header = true;
+    } else if (memcmp(type, "PLTE", 4) == 0) {
+      for (size_t i = 0; i < len / 3 && i < 256; i++) {
+        memcpy(png->palette[i], chunk + 3 * i, 3);
+      }
+    } else if (memcmp(type, "tRNS", 4) == 0 && png->color_type == 3) {
+      for (size_t i = 0; i < len && i < 256; i++) {
+        png->palette[i][3] = chunk[i];
+      }
+    } else if (memcmp(type, "IDAT", 4) == 0) {
+      if (png->n_segments == segments_cap) {
+        segments_cap = segments_cap ? segments_cap * 2 : 16;
+        struct png_segment *segments = realloc(
+            png->segments, segments_cap * sizeof(struct png_segment));
+        if (segments == NULL) {
+          return false;
+        }
+        png->segments = segments;
+      }
+      png->segments[png->n_segments++] =
+          (struct png_segment){.offset = pos + 8, .length = len};
+    } else if (memcmp(type, "IEND", 4) == 0) {
+      break;
+    }
+    pos += len + 12;
+  }
+  if (!has_header || png->n_segments == 0) {
+    return false;
+  }
+
+  static const int channels[] = {1, 0, 3, 1, 2, 0, 4};
+  if (png->color_type > 6 || channels[png->color_type] == 0) {
+    return false;
+  }
+  png->channels = channels[png->color_type];
+  int depth = png->depth;
+  bool valid_depth = depth == 8 || depth == 16;
+  if (png->color_type == 0 || png->color_type == 3) {
+    valid_depth = valid_depth || depth == 1 || depth == 2 || depth == 4;
+  }
+  if (!valid_depth || (png->color_type == 3 && depth == 16)) {
+    return false;
+  }
+
+  png->row_size = ((size_t)image->width * png->channels * depth + 7) / 8;
+  png->pixel_size = max(png->channels * depth / 8, 1);
+  png->row = malloc(png->row_size + 1);
+  image->png_state.prev = calloc(png->row_size, 1);
+  if (png->row == NULL || image->png_state.prev == NULL ||
+      inflateInit(&image->png_state.stream) != Z_OK) {
+    return false;
+  }
+  image->format = IMAGE_PNG;
+  return true;
+}
+
+// Inflate exactly len bytes, feeding IDAT segments as needed.
+static bool png_inflate(struct wooz_image *image, uint8_t *out, size_t len) {
+  struct png_state *s = &image->png_state;
+  z_stream *stream = &s->stream;
+  stream->next_out = out;
+  stream->avail_out = len;
+
+  while (stream->avail_out > 0) {
+    if (stream->avail_in == 0) {
+      if (s->segment == image->png.n_segments) {
+        return false;
+      }
+      const struct png_segment *segment = &image->png.segments[s->segment++];
+      stream->next_in = image->data + segment->offset;
+      stream->avail_in = segment->length;
+    }
+    int ret = inflate(stream, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      return stream->avail_out == 0;
+    }
+    if (ret != Z_OK && !(ret == Z_BUF_ERROR && stream->avail_in == 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+  return pb <= pc ? b : c;
+}
+
+static bool png_unfilter(uint8_t filter, uint8_t *cur, const uint8_t *prev,
+                         size_t len, size_t bpp) {
+  switch (filter) {
+  case 0:
+    break;
+  case 1:
+    for (size_t i = bpp; i < len; i++) {
+      cur[i] += cur[i - bpp];
+    }
+    break;
+  case 2:
+    for (size_t i = 0; i < len; i++) {
+      cur[i] += prev[i];
+    }
+    break;
+  case 3:
+    for (size_t i = 0; i < len; i++) {
+      uint8_t left = i >= bpp ? cur[i - bpp] : 0;
+      cur[i] += (left + prev[i]) / 2;
+    }
+    break;
+  case 4:
+    for (size_t i = 0; i < len; i++) {
+      uint8_t left = i >= bpp ? cur[i - bpp] : 0;
+      uint8_t up_left = i >= bpp ? prev[i - bpp] : 0;
+      cur[i] += paeth(left, prev[i], up_left);
+    }
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+// Sample i of a scanline, 16 bit samples are truncated to their high byte.
+static uint32_t png_sample(const uint8_t *row, int depth, size_t i) {
+  if (depth == 16) {
+    return row[2 * i];
+  }
+  if (depth == 8) {
+    return row[i];
+  }
+  size_t bit = i * depth;
+  int shift = 8 - depth - bit % 8;
+  return (row[bit / 8] >> shift) & ((1 << depth) - 1);
+}
+
+static bool png_decode_row(struct wooz_image *image, uint32_t *out) {
+  struct png_info *png = &image->png;
+  uint8_t *prev = image->png_state.prev;
+  uint8_t *row = png->row + 1;
+
+  if (!png_inflate(image, png->row, png->row_size + 1) ||
+      !png_unfilter(png->row[0], row, prev, png->row_size, png->pixel_size)) {
+    return false;
+  }
+
+  int depth = png->depth;
+  uint32_t grey_scale = depth < 8 ? 255 / ((1 << depth) - 1) : 1;
+  for (int32_t x = 0; x < image->width; x++) {
+    size_t i = (size_t)x * png->channels;
+    uint32_t s0 = png_sample(row, depth, i);
+    switch (png->color_type) {
+    case 0:
+      s0 *= grey_scale;
+      out[x] = pack_rgba(s0, s0, s0, 255);
+      break;
+    case 2:
+      out[x] = pack_rgba(s0, png_sample(row, depth, i + 1),
+                         png_sample(row, depth, i + 2), 255);
+      break;
+    case 3: {
+      const uint8_t *c = png->palette[s0];
+      out[x] = pack_rgba(c[0], c[1], c[2], c[3]);
+      break;
+    }
+    case 4:
+      out[x] = pack_rgba(s0, s0, s0, png_sample(row, depth, i + 1));
+      break;
+    default:
+      out[x] = pack_rgba(s0, png_sample(row, depth, i + 1),
+                         png_sample(row, depth, i + 2),
+                         png_sample(row, depth, i + 3));
+      break;
+    }
+  }
+
+  memcpy(prev, row, png->row_size);
+  return true;
+}
+
+static void save_checkpoint(struct wooz_image *image, int32_t band) {
+  if (image->checkpoints[band]) {
+    return;
+  }
+
+  if (image->format == IMAGE_QOI) {
+    image->qoi_checkpoints[band] = image->qoi;
+  } else {
+    struct png_state *cp = &image->png_checkpoints[band];
+    cp->prev = malloc(image->png.row_size);
+    if (cp->prev == NULL) {
+      return;
+    }
+    if (inflateCopy(&cp->stream, &image->png_state.stream) != Z_OK) {
+      free(cp->prev);
+      return;
+    }
+    memcpy(cp->prev, image->png_state.prev, image->png.row_size);
+    cp->segment = image->png_state.segment;
+  }
+  image->checkpoints[band] = true;
+}
+
+static bool restore_checkpoint(struct wooz_image *image, int32_t band) {
+  if (image->format == IMAGE_QOI) {
+    image->qoi = image->qoi_checkpoints[band];
+  } else {
+    struct png_state *cp = &image->png_checkpoints[band];
+    inflateEnd(&image->png_state.stream);
+    if (inflateCopy(&image->png_state.stream, &cp->stream) != Z_OK) {
+      // Leave a stream inflateEnd can be called on.
+      memset(&image->png_state.stream, 0, sizeof(z_stream));
+      inflateInit(&image->png_state.stream);
+      image->row = INT32_MAX;
+      return false;
+    }
+    memcpy(image->png_state.prev, cp->prev, image->png.row_size);
+    image->png_state.segment = cp->segment;
+  }
+  image->row = band * IMAGE_TILE_SIZE;
+  return true;
+}
+
+// Decode the next row of a sequential image, saving a checkpoint at band
+// boundaries.
+static bool decode_next_row(struct wooz_image *image, uint32_t *out) {
+  bool ok = image->format == IMAGE_QOI ? qoi_decode_row(image, out)
+                                       : png_decode_row(image, out);
+  if (!ok) {
+    // The decoder state is lost, the next seek restores a checkpoint.
+    image->row = INT32_MAX;
+    return false;
+  }
+  image->row++;
+  if (image->row % IMAGE_TILE_SIZE == 0 && image->row < image->height) {
+    save_checkpoint(image, image->row / IMAGE_TILE_SIZE);
+  }
+  return true;
+}
+
+// Position the sequential decoder at the first row of band, from the closest
+// checkpoint above it.
+static bool seek_band(struct wooz_image *image, int32_t band) {
+  int32_t target = band * IMAGE_TILE_SIZE;
+  if (image->row != target) {
+    int32_t from = band;
+    while (!image->checkpoints[from]) {
+      from--;
+    }
+    if (image->row < from * IMAGE_TILE_SIZE || image->row > target) {
+      if (!restore_checkpoint(image, from)) {
+        return false;
+      }
+    }
+  }
+
+  while (image->row < target) {
+    if (!decode_next_row(image, image->row_pixels)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static struct image_tile *alloc_tile(struct wooz_image *image, size_t index) {
+  struct image_tile *tile;
+  if (image->n_tiles >= image->max_tiles) {
+    // Reuse the least recently used tile.
+    tile = wl_container_of(image->lru.prev, tile, link);
+    wl_list_remove(&tile->link);
+    image->tiles[tile->index] = NULL;
+  } else {
+    tile = calloc(1, sizeof(*tile));
+    if (tile == NULL) {
+      return NULL;
+    }
+    tile->pixels = malloc(IMAGE_TILE_BYTES);
+    if (tile->pixels == NULL) {
+      free(tile);
+      return NULL;
+    }
+    image->n_tiles++;
+  }
+
+  tile->index = index;
+  image->tiles[index] = tile;
+  wl_list_insert(&image->lru, &tile->link);
+  return tile;
+}
+
+static void free_tile(struct wooz_image *image, struct image_tile *tile) {
+  image->tiles[tile->index] = NULL;
+  wl_list_remove(&tile->link);
+  free(tile->pixels);
+  free(tile);
+  image->n_tiles--;
+}
+
+// Decode every tile of a band of a sequential image, rows can't be decoded
+// for a single tile.
+static void load_band(struct wooz_image *image, int32_t ty) {
+  int32_t n_rows = min(IMAGE_TILE_SIZE, image->height - ty * IMAGE_TILE_SIZE);
+  bool ok = seek_band(image, ty);
+
+  // Tiles of the band already cached become the most recently used first,
+  // so allocating the missing ones can't evict them.
+  struct image_tile **tiles = image->tiles + (size_t)ty * image->cols;
+  for (int32_t tx = 0; tx < image->cols; tx++) {
+    if (tiles[tx] != NULL) {
+      wl_list_remove(&tiles[tx]->link);
+      wl_list_insert(&image->lru, &tiles[tx]->link);
+    }
+  }
+  for (int32_t tx = 0; tx < image->cols; tx++) {
+    struct image_tile *tile = tiles[tx];
+    if (tile == NULL) {
+      tile = alloc_tile(image, (size_t)ty * image->cols + tx);
+    }
+    image->band[tx] = tile;
+  }
+
+  for (int32_t y = 0; y < n_rows; y++) {
+    // Undecodable rows of truncated or corrupt images are black.
+    if (ok) {
+      ok = decode_next_row(image, image->row_pixels);
+    }
+    if (!ok) {
+      memset(image->row_pixels, 0, (size_t)image->width * sizeof(uint32_t));
+    }
+
+    for (int32_t tx = 0; tx < image->cols; tx++) {
+      struct image_tile *tile = image->band[tx];
+      if (tile == NULL) {
+        continue;
+      }
+      int32_t x = tx * IMAGE_TILE_SIZE;
+      int32_t width = min(IMAGE_TILE_SIZE, image->width - x);
+      memcpy(tile->pixels + (size_t)y * IMAGE_TILE_SIZE,
+             image->row_pixels + x, (size_t)width * sizeof(uint32_t));
+    }
+  }
+}
+
+static struct image_tile *get_tile(struct wooz_image *image, int32_t tx,
+                                   int32_t ty) {
+  size_t index = (size_t)ty * image->cols + tx;
+  struct image_tile *tile = image->tiles[index];
+  if (tile != NULL) {
+    wl_list_remove(&tile->link);
+    wl_list_insert(&image->lru, &tile->link);
+    return tile;
+  }
+
+  if (image->format != IMAGE_RAW) {
+    load_band(image, ty);
+    return image->tiles[index];
+  }
+
+  tile = alloc_tile(image, index);
+  if (tile == NULL) {
+    return NULL;
+  }
+  int32_t x = tx * IMAGE_TILE_SIZE;
+  int32_t y = ty * IMAGE_TILE_SIZE;
+  int32_t width = min(IMAGE_TILE_SIZE, image->width - x);
+  int32_t height = min(IMAGE_TILE_SIZE, image->height - y);
+  for (int32_t i = 0; i < height; i++) {
+    raw_decode(image, x, y + i, width,
+               tile->pixels + (size_t)i * IMAGE_TILE_SIZE);
+  }
+  return tile;
+}
+
+static bool init_tiles(struct wooz_image *image, size_t cache_size) {
+  image->cols = (image->width + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+  image->rows = (image->height + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+  image->tiles =
+      calloc((size_t)image->cols * image->rows, sizeof(struct image_tile *));
+  // Two bands fit so that decoding one doesn't evict its own tiles.
+  image->max_tiles =
+      max(cache_size / IMAGE_TILE_BYTES, 2 * (size_t)image->cols);
+  if (image->tiles == NULL) {
+    return false;
+  }
+
+  if (image->format == IMAGE_RAW) {
+    return true;
+  }
+
+  image->checkpoints = calloc(image->rows, sizeof(bool));
+  image->band = calloc(image->cols, sizeof(struct image_tile *));
+  image->row_pixels = malloc((size_t)image->width * sizeof(uint32_t));
+  if (image->format == IMAGE_QOI) {
+    image->qoi_checkpoints = calloc(image->rows, sizeof(struct qoi_state));
+  } else {
+    image->png_checkpoints = calloc(image->rows, sizeof(struct png_state));
+  }
+  if (image->checkpoints == NULL || image->band == NULL ||
+      image->row_pixels == NULL ||
+      (image->qoi_checkpoints == NULL && image->png_checkpoints == NULL)) {
+    return false;
+  }
+  image->row = 0;
+  save_checkpoint(image, 0);
+  return image->checkpoints[0];
+}
+
+struct wooz_image *image_open(const char *path, size_t cache_size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror(path);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror(path);
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size < 8) {
+    fprintf(stderr, "%s: not an image\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror(path);
+    return NULL;
+  }
+
+  struct wooz_image *image = calloc(1, sizeof(struct wooz_image));
+  if (image == NULL) {
+    munmap(data, st.st_size);
+    return NULL;
+  }
+  image->data = data;
+  image->size = st.st_size;
+  wl_list_init(&image->lru);
+
+  const uint8_t *magic = image->data;
+  bool ok;
+  if (magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6')) {
+    ok = open_pnm(image);
+  } else if (magic[0] == 'P' && magic[1] == '7') {
+    ok = open_pam(image);
+  } else if (memcmp(magic, "qoif", 4) == 0) {
+    ok = open_qoi(image);
+  } else if (memcmp(magic, "\x89PNG\r\n\x1a\n", 8) == 0) {
+    ok = open_png(image);
+  } else {
+    fprintf(stderr, "%s: unknown image format\n", path);
+    image_destroy(image);
+    return NULL;
+  }
+
+  if (!ok || !init_tiles(image, cache_size)) {
+    fprintf(stderr, "%s: invalid or unsupported image\n", path);
+    image_destroy(image);
+    return NULL;
+  }
+  return image;
+}
+
+void image_destroy(struct wooz_image *image) {
+  if (image == NULL) {
+    return;
+  }
+
+  struct image_tile *tile, *tmp;
+  wl_list_for_each_safe(tile, tmp, &image->lru, link) {
+    free_tile(image, tile);
+  }
+  free(image->tiles);
+
+  if (image->png_checkpoints != NULL && image->checkpoints != NULL) {
+    for (int32_t i = 0; i < image->rows; i++) {
+      if (image->checkpoints[i]) {
+        inflateEnd(&image->png_checkpoints[i].stream);
+        free(image->png_checkpoints[i].prev);
+      }
+    }
+  }
+  if (image->format == IMAGE_PNG) {
+    inflateEnd(&image->png_state.stream);
+  }
+  free(image->png_checkpoints);
+  free(image->png_state.prev);
+  free(image->png.row);
+  free(image->png.segments);
+  free(image->qoi_checkpoints);
+  free(image->checkpoints);
+  free(image->band);
+  free(image->row_pixels);
+
+  munmap(image->data, image->size);
+  free(image);
+}
+
+void image_get_size(const struct wooz_image *image, int32_t *width,
+                    int32_t *height) {
+  *width = image->width;
+  *height = image->height;
+}
+
+void image_render(struct wooz_image *image, struct wooz_buffer *dst,
+                  const struct wooz_boxf *src_box) {
+  double step_x = src_box->width / dst->width;
+  double step_y = src_box->height / dst->height;
+
+  // Source column of each destination column, -1 outside of the image.
+  int32_t *columns = malloc((size_t)dst->width * sizeof(int32_t));
+  if (columns == NULL) {
+    return;
+  }
+  for (int32_t x = 0; x < dst->width; x++) {
+    double sx = floor(src_box->x + (x + 0.5) * step_x);
+    columns[x] = sx >= 0 && sx < image->width ? (int32_t)sx : -1;
+  }
+
+  for (int32_t y = 0; y < dst->height; y++) {
+    uint32_t *row =
+        (uint32_t *)((uint8_t *)dst->data + (size_t)y * dst->stride);
+    double sy = floor(src_box->y + (y + 0.5) * step_y);
+    if (sy < 0 || sy >= image->height) {
+      memset(row, 0, (size_t)dst->width * sizeof(uint32_t));
+      continue;
+    }
+
+    int32_t ty = (int32_t)sy / IMAGE_TILE_SIZE;
+    size_t tile_y = (size_t)((int32_t)sy % IMAGE_TILE_SIZE) * IMAGE_TILE_SIZE;
+    // Tile pointers are only valid until the next get_tile() call, it may
+    // evict them.
+    int32_t tx = -1;
+    const uint32_t *tile_row = NULL;
+    for (int32_t x = 0; x < dst->width; x++) {
+      int32_t sx = columns[x];
+      if (sx < 0) {
+        row[x] = 0;
+        continue;
+      }
+      if (sx / IMAGE_TILE_SIZE != tx) {
+        tx = sx / IMAGE_TILE_SIZE;
+        struct image_tile *tile = get_tile(image, tx, ty);
+        tile_row = tile != NULL ? tile->pixels + tile_y : NULL;
+      }
+      row[x] = tile_row != NULL ? tile_row[sx % IMAGE_TILE_SIZE] : 0;
+    }
+  }
+
+  free(columns);
+}
@@ -1,19 +1,64 @@
 #ifndef _BUFFER_H
 #define _BUFFER_H
 
+#include <stdbool.h>
 #include <wayland-client.h>
 
 struct wooz_buffer {
   struct wl_buffer *wl_buffer;
+  uint64_t id; // Unique for the run, renewed when reshaped
+  struct wl_shm_pool *pool; // Kept to reshape the buffer in place
   void *data;
   int32_t width, height, stride;
   size_t size;
+  size_t pool_size; // Mapped bytes, at least size
   enum wl_shm_format format;
+  int fd;    // Backing shm file kept open to splice or publish, -1 if closed
+  bool busy; // Attached to a surface and not yet released by the compositor
+
+  // Content hash of each TILE_SIZE square, see tiles.h.
+  uint64_t *tile_hashes;
+  int32_t tile_cols, tile_rows;
+
+  // Summed-area table of the RGB channels, see sat.h.
+  uint32_t *sat;
+  bool sat_valid;
 };
 
 struct wooz_buffer *create_buffer(struct wl_shm *shm, enum wl_shm_format format,
                                   int32_t width, int32_t height,
                                   int32_t stride);
+// Same as create_buffer() but keeps the backing shm file open in buffer->fd.
+struct wooz_buffer *create_buffer_with_fd(struct wl_shm *shm,
+                                          enum wl_shm_format format,
+                                          int32_t width, int32_t height,
+                                          int32_t stride);
 void destroy_buffer(struct wooz_buffer *buffer);
 
+/**
+ * Give buffer a new format and size, reusing its memory. Returns false if it
+ * doesn't fit or the compositor still holds the buffer, it is then left
+ * alone. The content, tile hashes and summed-area table are dropped.
+ */
+bool reshape_buffer(struct wooz_buffer *buffer, enum wl_shm_format format,
+                    int32_t width, int32_t height, int32_t stride);
+
+// Returns the number of bytes per pixel of format, or 0 if it is unknown.
+int32_t shm_format_bytes_per_pixel(enum wl_shm_format format);
+
+/**
+ * How well wooz handles captures in format, higher is better: 3 for the 4
+ * bytes formats with 8 bit channels and their alpha or padding byte last in
+ * memory, which can be diffed and recorded, 2 for the other formats with
+ * known channel shifts, 1 for other known formats and 0 for unknown ones.
+ */
+int shm_format_preference(enum wl_shm_format format);
+
+/**
+ * Shifts of the red, green and blue channels of format, c being
+ * (v >> shifts[c]) & 0xff for a 4 bytes little endian pixel v, see
+ * unpack_channels32(). Returns NULL if format isn't such a format.
+ */
+const uint8_t *shm_format_channel_shifts(enum wl_shm_format format);
+
 #endif
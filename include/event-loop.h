@@ -0,0 +1,55 @@
+#ifndef _EVENT_LOOP_H
+#define _EVENT_LOOP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+typedef void (*wooz_timer_func_t)(void *data);
+typedef void (*wooz_fd_func_t)(int fd, uint32_t events, void *data);
+
+/**
+ * Timer scheduled on an event loop. Timers are owned by the caller, they must
+ * be initialized with timer_init() and cancelled before being freed.
+ */
+struct wooz_timer {
+  uint64_t deadline; // CLOCK_MONOTONIC nanoseconds
+  uint64_t interval; // Nanoseconds, 0 for one shot timers
+  wooz_timer_func_t func;
+  void *data;
+  size_t index; // Position in the loop heap, SIZE_MAX if not scheduled
+};
+
+struct wooz_event_source;
+struct wooz_event_loop;
+
+struct wooz_event_loop *event_loop_create(struct wl_display *display);
+void event_loop_destroy(struct wooz_event_loop *loop);
+
+// Watch fd for events (EPOLLIN, ...). The fd is not closed on removal.
+struct wooz_event_source *event_loop_add_fd(struct wooz_event_loop *loop,
+                                            int fd, uint32_t events,
+                                            wooz_fd_func_t func, void *data);
+void event_loop_remove_fd(struct wooz_event_loop *loop,
+                          struct wooz_event_source *source);
+
+void timer_init(struct wooz_timer *timer, wooz_timer_func_t func, void *data);
+bool timer_is_scheduled(const struct wooz_timer *timer);
+// (Re)schedule timer to fire after delay_ms then every interval_ms if non
+// zero.
+void event_loop_schedule(struct wooz_event_loop *loop,
+                         struct wooz_timer *timer, uint32_t delay_ms,
+                         uint32_t interval_ms);
+void event_loop_cancel(struct wooz_event_loop *loop, struct wooz_timer *timer);
+
+/**
+ * Flush pending requests, wait for Wayland events, fd events or timers and
+ * dispatch them. Returns -1 on error.
+ */
+int event_loop_dispatch(struct wooz_event_loop *loop);
+
+// Number of times event_loop_dispatch() woke up from waiting.
+uint64_t event_loop_get_wakeups(const struct wooz_event_loop *loop);
+
+#endif
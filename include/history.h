@@ -0,0 +1,76 @@
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#include "buffer.h"
+
+/**
+ * Tile content shared by all the snapshots it appears in. Its rows are
+ * packed, width bytes each.
+ */
+struct wooz_history_tile {
+  uint64_t hash;                  // See update_tile_hashes()
+  uint32_t width, height;         // Bytes per row, rows
+  size_t refs;                    // Snapshot tiles pointing to it
+  struct wooz_history_tile *next; // In its hash table bucket
+  uint8_t data[];
+};
+
+struct wooz_snapshot {
+  uint64_t time; // CLOCK_MONOTONIC nanoseconds
+  struct wooz_history_tile **tiles; // tile_cols x tile_rows, row by row
+};
+
+/**
+ * Ring of the last captures of an output. Snapshots are stored as tiles
+ * addressed by their content hash, so regions that didn't change cost a
+ * pointer each: memory grows with the content that changed, not with the
+ * number of snapshots. As for recaptures, a tile whose hash didn't change
+ * since the newest snapshot is taken as unchanged. Tiles found elsewhere by
+ * hash are only shared once their content compared equal.
+ */
+struct wooz_history {
+  // Layout shared by all snapshots, that of the last buffer pushed.
+  enum wl_shm_format format;
+  int32_t width, height, stride;
+  size_t size;
+  int32_t tile_cols, tile_rows;
+  size_t tile_bytes; // Width of full tiles
+
+  struct wooz_snapshot *snapshots;
+  size_t capacity, count;
+  size_t head; // Newest snapshot
+
+  struct wooz_history_tile **buckets;
+  size_t n_buckets; // Power of two
+  size_t n_tiles, tile_data; // Distinct tiles stored and their bytes
+};
+
+// Keep up to capacity snapshots. Returns NULL on allocation failure.
+struct wooz_history *history_create(size_t capacity);
+void history_destroy(struct wooz_history *history);
+void history_clear(struct wooz_history *history);
+
+/**
+ * Store buffer, whose tile hashes are up to date, as the newest snapshot,
+ * dropping the oldest one once full. All snapshots are dropped if the layout
+ * of buffer changed, nothing is stored if it is the same as the newest one.
+ * Returns false if it couldn't be stored.
+ */
+bool history_push(struct wooz_history *history,
+                  const struct wooz_buffer *buffer);
+
+// Snapshot age pushes before the newest one, NULL if there isn't one.
+const struct wooz_snapshot *history_get(const struct wooz_history *history,
+                                        size_t age);
+
+// Write snapshot into dst, a buffer with the layout of the history.
+void history_restore(const struct wooz_history *history,
+                     const struct wooz_snapshot *snapshot,
+                     struct wooz_buffer *dst);
+
+#endif
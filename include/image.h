@@ -0,0 +1,35 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "box.h"
+#include "buffer.h"
+
+// Images are decoded in IMAGE_TILE_SIZE x IMAGE_TILE_SIZE pixels squares.
+#define IMAGE_TILE_SIZE 256
+// Decoded tiles kept by default, in bytes.
+#define IMAGE_DEFAULT_CACHE_SIZE (256u << 20)
+
+struct wooz_image;
+
+/**
+ * Open a PNM (P5/P6), PAM, QOI or PNG image. The file is mapped and only its
+ * header is parsed, tiles are decoded on demand and at most cache_size bytes
+ * of them are kept. Prints an error and returns NULL on failure.
+ */
+struct wooz_image *image_open(const char *path, size_t cache_size);
+void image_destroy(struct wooz_image *image);
+
+void image_get_size(const struct wooz_image *image, int32_t *width,
+                    int32_t *height);
+
+/**
+ * Scale the src_box region of image to the whole of dst, a XRGB8888 buffer,
+ * with nearest neighbour sampling. Pixels outside of the image are black.
+ */
+void image_render(struct wooz_image *image, struct wooz_buffer *dst,
+                  const struct wooz_boxf *src_box);
+
+#endif
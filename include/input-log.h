@@ -0,0 +1,66 @@
+#ifndef _INPUT_LOG_H
+#define _INPUT_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define INPUT_LOG_VERSION 1
+#define INPUT_LOG_MAX_NAME 32
+
+enum wooz_input_type {
+  WOOZ_INPUT_ENTER,
+  WOOZ_INPUT_LEAVE,
+  WOOZ_INPUT_MOTION,
+  WOOZ_INPUT_BUTTON,
+  WOOZ_INPUT_AXIS,
+  WOOZ_INPUT_KEY,
+  WOOZ_INPUT_KEYBOARD_LEAVE,
+  WOOZ_INPUT_TYPE_COUNT,
+};
+
+/**
+ * Pointer or keyboard event as handled by the seat listeners, with the
+ * values they got from the compositor.
+ */
+struct wooz_input_event {
+  uint64_t when; // Nanoseconds since the log was created
+  enum wooz_input_type type;
+  // Output of the window entered or left, "-" if it has no name.
+  char output[INPUT_LOG_MAX_NAME];
+  uint32_t time;  // Event time in milliseconds, motion to key
+  uint32_t code;  // Button, axis or key
+  uint32_t state; // Button or key state
+  int32_t x, y;   // wl_fixed_t position of enter and motion, axis value in x
+};
+
+/**
+ * Text file of input events, one per line after a "wooz-input VERSION"
+ * header: the fields of struct wooz_input_event, starting with when and the
+ * type name.
+ */
+struct wooz_input_log {
+  FILE *file;
+  uint64_t start; // CLOCK_MONOTONIC nanoseconds
+  size_t line;    // Last line read
+  bool invalid;   // Reading stopped at a line that isn't an event
+};
+
+// Create path to log events into. Returns NULL if it couldn't be.
+struct wooz_input_log *input_log_create(const char *path);
+// Open a log written by input_log_create(). Returns NULL if it isn't one.
+struct wooz_input_log *input_log_open(const char *path);
+void input_log_destroy(struct wooz_input_log *log);
+
+// Append event, its when is set to now.
+void input_log_write(struct wooz_input_log *log,
+                     struct wooz_input_event *event);
+/**
+ * Read the next event. Returns false at the end of the log, or at a line
+ * that isn't an event: log->invalid is then set.
+ */
+bool input_log_read(struct wooz_input_log *log,
+                    struct wooz_input_event *event);
+
+#endif
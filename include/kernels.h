@@ -0,0 +1,100 @@
+#ifndef _KERNELS_H
+#define _KERNELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 32 bit lanes of the tile hash state, see tiles.c.
+#define KERNEL_HASH_LANES 8
+
+/**
+ * Instruction sets pixel kernels are compiled for, from the most portable
+ * to the fastest. Each kernel runs with one of them, picked at startup from
+ * what the CPU supports.
+ */
+enum wooz_isa {
+  WOOZ_ISA_SCALAR,
+  WOOZ_ISA_SSE2,
+  WOOZ_ISA_AVX2,
+  WOOZ_ISA_AVX512,
+  WOOZ_ISA_COUNT,
+};
+
+enum wooz_kernel {
+  WOOZ_KERNEL_GATHER32,
+  WOOZ_KERNEL_TILE_HASH,
+  WOOZ_KERNEL_UNPACK32,
+  WOOZ_KERNEL_DIFF32,
+  WOOZ_KERNEL_YUV420,
+  WOOZ_KERNEL_COUNT,
+};
+
+const char *isa_name(enum wooz_isa isa);
+const char *kernel_name(enum wooz_kernel kernel);
+// Parse an instruction set name such as "avx2". Returns false if unknown.
+bool parse_isa(const char *name, enum wooz_isa *isa);
+
+// Fastest instruction set supported by the CPU and this build.
+enum wooz_isa kernels_supported_isa(void);
+
+/**
+ * Run every kernel with isa, or the best supported instruction set below it.
+ * Kernels run scalar until a selection is made.
+ */
+void kernels_select(enum wooz_isa isa);
+
+/**
+ * Time every supported variant of each kernel up to max_isa once on scratch
+ * data and keep the fastest. Takes a few milliseconds.
+ */
+void kernels_calibrate(enum wooz_isa max_isa);
+
+enum wooz_isa kernel_isa(enum wooz_kernel kernel);
+
+/**
+ * Copy src[columns[x]] into dst[x] for the n first entries of columns, used
+ * to scale rows of 4 bytes pixels.
+ */
+void gather_pixels32(uint32_t *dst, const uint32_t *src,
+                     const int32_t *columns, int32_t n);
+
+/**
+ * Feed a buffer line of len bytes into the hashes of the tiles it crosses.
+ * Tiles are tile_bytes wide, lanes holds KERNEL_HASH_LANES entries per tile.
+ * With padding, the line holds 4 bytes pixels whose last byte in memory is
+ * padding, it isn't hashed.
+ */
+void hash_tile_line(uint32_t *lanes, const uint8_t *line, size_t len,
+                    size_t tile_bytes, bool padding);
+
+/**
+ * Split width 4 bytes little endian pixels into 8 bit channels, channel c
+ * of a pixel v being (v >> shifts[c]) & 0xff.
+ */
+void unpack_channels32(const uint8_t *src, int32_t width,
+                       const uint8_t shifts[3], uint32_t *channels[3]);
+
+/**
+ * Compare width x height 4 bytes pixels of a and b, rows stride bytes apart
+ * in both and in dst. dst gets the pixels of b dimmed where they are equal
+ * and opaque magenta where they differ, the alpha or padding byte, last in
+ * memory, is kept. Without alpha that byte is padding and isn't compared.
+ * Rows are compared until the first difference before any is written.
+ * Returns the number of different pixels.
+ */
+size_t diff_pixels32(uint32_t *dst, const uint32_t *a, const uint32_t *b,
+                     int32_t width, int32_t height, size_t stride,
+                     bool alpha);
+
+/**
+ * Convert two rows of width 4 bytes little endian pixels, channels laid out
+ * as for unpack_channels32(), to BT.601 limited range YUV 4:2:0: a row of
+ * luma for each and one row of chroma for both, width / 2 samples of each
+ * 2x2 block. width must be even.
+ */
+void rgb_to_yuv420(const uint8_t *src0, const uint8_t *src1, int32_t width,
+                   const uint8_t shifts[3], uint8_t *y0, uint8_t *y1,
+                   uint8_t *u, uint8_t *v);
+
+#endif
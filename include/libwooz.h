@@ -0,0 +1,119 @@
+#ifndef _LIBWOOZ_H
+#define _LIBWOOZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * libwooz captures outputs and does the view math of wooz on a Wayland
+ * connection owned by the caller, which keeps it warm across
+ * magnifications.
+ *
+ * Functions taking a struct libwooz or one of its outputs dispatch the event
+ * queue given to libwooz_create() and must be called from the thread that
+ * dispatches it. View functions are pure.
+ *
+ * The API and ABI are stable: functions are only ever added, and
+ * LIBWOOZ_API_VERSION is bumped when they are.
+ */
+#define LIBWOOZ_API_VERSION 1
+
+struct libwooz;
+struct libwooz_output;
+struct libwooz_capture;
+
+// LIBWOOZ_API_VERSION of the library loaded at run time.
+int libwooz_api_version(void);
+
+/**
+ * Bind the globals libwooz needs on display and wait for the outputs to be
+ * described. Its events go to queue, or the default queue if NULL. Returns
+ * NULL if the compositor lacks wl_shm or wlr-screencopy-unstable-v1.
+ */
+struct libwooz *libwooz_create(struct wl_display *display,
+                               struct wl_event_queue *queue);
+void libwooz_destroy(struct libwooz *wooz);
+
+/**
+ * Outputs in the order the compositor advertised them. Outputs it removes
+ * leave the list but stay valid until libwooz_destroy(): capturing them fails
+ * and their wl_output is NULL.
+ */
+size_t libwooz_get_output_count(const struct libwooz *wooz);
+// NULL if index is out of range.
+struct libwooz_output *libwooz_get_output(struct libwooz *wooz,
+                                          size_t index);
+// NULL if no output is named name.
+struct libwooz_output *libwooz_find_output(struct libwooz *wooz,
+                                           const char *name);
+
+// The name, e.g. "DP-1", NULL without xdg-output.
+const char *libwooz_output_get_name(const struct libwooz_output *output);
+struct wl_output *
+libwooz_output_get_wl_output(const struct libwooz_output *output);
+enum wl_output_transform
+libwooz_output_get_transform(const struct libwooz_output *output);
+// Upright size in physical pixels.
+void libwooz_output_get_size(const struct libwooz_output *output,
+                             int32_t *width, int32_t *height);
+// Position and size in the compositor logical space.
+void libwooz_output_get_logical_geometry(const struct libwooz_output *output,
+                                         int32_t *x, int32_t *y,
+                                         int32_t *width, int32_t *height);
+
+/**
+ * Capture output into a wl_shm buffer, blocking until the compositor copied
+ * it. Returns NULL if it failed.
+ */
+struct libwooz_capture *libwooz_capture_output(struct libwooz_output *output,
+                                               bool overlay_cursor);
+void libwooz_capture_destroy(struct libwooz_capture *capture);
+
+/**
+ * Pixels of the capture: height rows of stride bytes in format. They are
+ * still transformed by the output transform.
+ */
+const void *libwooz_capture_get_data(const struct libwooz_capture *capture,
+                                     int32_t *width, int32_t *height,
+                                     int32_t *stride,
+                                     enum wl_shm_format *format);
+/**
+ * The buffer holding the capture, owned by it, to attach to a surface with
+ * wl_surface_set_buffer_transform() set to the output transform.
+ */
+struct wl_buffer *
+libwooz_capture_get_wl_buffer(const struct libwooz_capture *capture);
+
+/**
+ * A view: the source rectangle of what is shown, e.g. by wp_viewport, in
+ * pixels of the upright capture.
+ */
+struct libwooz_view {
+  double x, y;
+  double width, height;
+};
+
+/**
+ * Zoom view shown in a window_width x window_height window by change rows
+ * around (center_x, center_y) in window coordinates, keeping its ratio
+ * (width / height). Positive changes zoom in. Returns false if the view
+ * would get too small, it is then left alone.
+ */
+bool libwooz_view_zoom(struct libwooz_view *view, double ratio,
+                       double window_width, double window_height,
+                       double change, double center_x, double center_y);
+// Keep view within a width x height capture.
+void libwooz_view_clamp(struct libwooz_view *view, double ratio,
+                        double width, double height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,8 +3,16 @@
 
 #include <wayland-client.h>
 
+#include "box.h"
 #include "wooz.h"
 
+/**
+ * Guess the logical geometry of an output from its upright physical geometry
+ * and integer scale, when xdg-output isn't available.
+ */
+void guess_logical_geometry(const struct wooz_box *geometry, int32_t scale,
+                            struct wooz_box *logical, double *logical_scale);
+
 void guess_output_logical_geometry(struct wooz_output *output);
 
 #endif
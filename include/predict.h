@@ -0,0 +1,41 @@
+#ifndef _PREDICT_H
+#define _PREDICT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Predictions never look further ahead than this.
+#define PREDICT_MAX_HORIZON_MS 50
+
+/**
+ * Pointer motion extrapolation. The velocity is estimated from motion event
+ * timestamps, the horizon from how long commits take to be presented.
+ */
+struct wooz_predictor {
+  double x, y;     // Last reported position
+  double vx, vy;   // Smoothed velocity, units per millisecond
+  uint32_t time;   // Timestamp of the last motion event, milliseconds
+  bool has_motion; // x, y and time are set
+
+  uint64_t latency;         // Smoothed commit to presentation delay, ns
+  uint64_t latency_samples; // Presentations latency was estimated from
+};
+
+// Feed a motion event, time is the wl_pointer event timestamp.
+void predictor_motion(struct wooz_predictor *predictor, uint32_t time,
+                      double x, double y);
+
+// Forget the velocity, the pointer stopped.
+void predictor_stop(struct wooz_predictor *predictor);
+
+// Feed the delay between a commit and its presentation.
+void predictor_presented(struct wooz_predictor *predictor, uint64_t latency);
+
+/**
+ * Extrapolate the position horizon nanoseconds after the last motion event,
+ * capped to PREDICT_MAX_HORIZON_MS.
+ */
+void predictor_predict(const struct wooz_predictor *predictor,
+                       uint64_t horizon, double *x, double *y);
+
+#endif
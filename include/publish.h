@@ -0,0 +1,83 @@
+#ifndef _PUBLISH_H
+#define _PUBLISH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#include "box.h"
+#include "buffer.h"
+#include "event-loop.h"
+
+#define PUBLISH_VERSION 1
+#define PUBLISH_MAX_NAME 32
+// Buffers whose fd a reader is remembered to have, more than wooz cycles
+// through per output.
+#define PUBLISH_KNOWN_BUFFERS 8
+
+/**
+ * Message sent to readers of a --publish socket, one per SOCK_SEQPACKET
+ * packet, in native byte order. A read-only descriptor of the memfd of the
+ * buffer is attached with SCM_RIGHTS the first time a reader is sent a frame
+ * of it, readers keep their mapping for later frames of the same buffer id.
+ *
+ * The buffer content is stable until a later frame names another buffer of
+ * the same output, it may then be overwritten by the next capture.
+ */
+struct wooz_publish_frame {
+  uint32_t version;  // PUBLISH_VERSION
+  uint32_t format;   // wl_shm format
+  uint64_t sequence; // Frames published so far, gaps are frames skipped
+  uint64_t buffer;   // Id of the buffer, unique for the whole run
+  uint64_t size;     // Bytes to map
+  int32_t width, height, stride;
+  uint32_t transform; // wl_output_transform the content is stored with
+  // Rectangle shown, in pixels of the upright content.
+  double x, y, view_width, view_height;
+  char output[PUBLISH_MAX_NAME]; // Name of the output shown on
+};
+
+struct wooz_publish_reader {
+  struct wooz_publisher *publisher;
+  int fd;
+  struct wooz_event_source *source;
+  uint64_t known[PUBLISH_KNOWN_BUFFERS]; // Ring of buffers sent with their fd
+  size_t next_known;
+  struct wl_list link;
+};
+
+/**
+ * Unix socket the shown view is published on. Sends never block: a reader
+ * that doesn't keep up misses frames.
+ */
+struct wooz_publisher {
+  struct wooz_event_loop *loop;
+  int fd;
+  char *path;
+  struct wooz_event_source *source;
+  struct wl_list readers;
+
+  uint64_t sequence;
+  uint64_t skipped; // Frames not sent to a reader that was behind
+};
+
+/**
+ * Listen on path, replacing a stale socket left there. Returns NULL if it
+ * couldn't be bound.
+ */
+struct wooz_publisher *publisher_create(struct wooz_event_loop *loop,
+                                        const char *path);
+// Disconnect readers and remove the socket.
+void publisher_destroy(struct wooz_publisher *publisher);
+
+/**
+ * Send view of buffer, shown on output, to every reader. Buffers without a
+ * kept fd aren't published.
+ */
+void publisher_publish(struct wooz_publisher *publisher,
+                       const struct wooz_buffer *buffer,
+                       enum wl_output_transform transform,
+                       const struct wooz_boxf *view, const char *output);
+
+#endif
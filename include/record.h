@@ -0,0 +1,78 @@
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-client.h>
+
+#include "box.h"
+#include "buffer.h"
+#include "event-loop.h"
+
+#define RECORD_FPS 60
+// Frames waiting to be written, more are dropped.
+#define RECORD_QUEUE_SIZE 4
+
+struct wooz_record_frame {
+  // View scaled to the recording size. Only its pixel fields are set, it
+  // isn't shared with the compositor.
+  struct wooz_buffer pixels;
+  const uint8_t *shifts; // Channel layout, see shm_format_channel_shifts()
+  uint32_t repeat; // Copies of the previous frame written before this one
+};
+
+/**
+ * Y4M video of views at RECORD_FPS. Frames are converted to YUV 4:2:0 and
+ * written by a worker thread. Queueing never blocks: frames are dropped when
+ * the worker is behind, and the previous one repeated to keep the timing.
+ */
+struct wooz_recorder {
+  FILE *file;
+  int32_t width, height; // Even
+  struct wooz_worker *worker;
+
+  struct wooz_record_frame frames[RECORD_QUEUE_SIZE];
+  size_t head, count; // Queued frames, the head one is being written
+  uint32_t repeat;    // Copies of the newest frame not queued yet
+  bool has_frame;     // A frame was queued, later ones may repeat it
+  uint64_t start;     // CLOCK_MONOTONIC nanoseconds
+  uint64_t due;       // Frames due since start
+
+  // Used by the worker while it runs.
+  uint8_t *planes;    // Last frame written, I420
+  bool failed;        // A write failed, the rest is skipped
+  uint64_t converted; // Queued frames written
+
+  uint64_t queued, dropped;
+};
+
+/**
+ * Start a width x height recording, rounded down to even sizes, into path.
+ * Returns NULL if it couldn't be opened.
+ */
+struct wooz_recorder *recorder_create(struct wooz_event_loop *loop,
+                                      const char *path, int32_t width,
+                                      int32_t height);
+/**
+ * Write the queued frames and close the file. Returns false if a write
+ * failed.
+ */
+bool recorder_destroy(struct wooz_recorder *recorder);
+
+// Frames due at RECORD_FPS since the last call.
+uint32_t recorder_frames_due(struct wooz_recorder *recorder);
+
+/**
+ * Queue view of src, stored with transform, as the next frame. Returns false
+ * if it was dropped because the queue is full or src isn't a 4 bytes RGB
+ * format.
+ */
+bool recorder_add(struct wooz_recorder *recorder,
+                  const struct wooz_buffer *src,
+                  enum wl_output_transform transform,
+                  const struct wooz_boxf *view);
+// Show the newest frame n more frames, nothing before the first one.
+void recorder_repeat(struct wooz_recorder *recorder, uint32_t n);
+
+#endif
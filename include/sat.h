@@ -0,0 +1,33 @@
+#ifndef _SAT_H
+#define _SAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "box.h"
+#include "buffer.h"
+
+// Sums are kept modulo 2^32, region sums stay exact up to this many pixels.
+#define SAT_MAX_AREA (1 << 24)
+
+struct wooz_rgb {
+  uint8_t r, g, b;
+};
+
+/**
+ * Build the summed-area table of buffer from its content if it is not up to
+ * date. Returns false if the format is unknown or the table couldn't be
+ * allocated.
+ */
+bool update_summed_area_table(struct wooz_buffer *buffer);
+
+/**
+ * Compute the mean colour of box, in raw buffer coordinates and clipped to
+ * the buffer, in constant time. The summed-area table is built on first use.
+ * Returns false if box is empty, larger than SAT_MAX_AREA pixels or the table
+ * is unavailable.
+ */
+bool region_mean(struct wooz_buffer *buffer, const struct wooz_box *box,
+                 struct wooz_rgb *mean);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _SCALE_H
+#define _SCALE_H
+
+#include <wayland-client.h>
+
+#include "box.h"
+#include "buffer.h"
+
+/**
+ * Map pixel (x, y) of an upright image of size width x height to the pixel
+ * holding it in a buffer whose content is transformed by transform.
+ */
+void untransform_pixel(enum wl_output_transform transform, int32_t width,
+                       int32_t height, int32_t x, int32_t y, int32_t *bx,
+                       int32_t *by);
+
+/**
+ * Copy the src_box region of src into the whole dst buffer using nearest
+ * neighbour sampling. src_box is expressed in upright (transformed)
+ * coordinates while src content is stored with the given output transform.
+ * Both buffers must share the same format.
+ */
+void scale_nearest(struct wooz_buffer *dst, const struct wooz_buffer *src,
+                   enum wl_output_transform transform,
+                   const struct wooz_boxf *src_box);
+
+/**
+ * Copy src, whose content is stored with the given output transform, into
+ * dst upright. dst must have the upright size and the same format as src.
+ */
+void rotate_buffer(struct wooz_buffer *dst, const struct wooz_buffer *src,
+                   enum wl_output_transform transform);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _SCREENCOPY_H
+#define _SCREENCOPY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#include "buffer.h"
+
+struct zwlr_screencopy_frame_v1;
+
+// Selected wl_shm buffer parameters of a capture.
+struct wooz_shm_offer {
+  uint32_t format, width, height, stride;
+  bool valid;
+};
+
+// Keep the offer of the format preferred by shm_format_preference(), the
+// cheapest one among equally preferred formats.
+void shm_offer_add(struct wooz_shm_offer *offer, uint32_t format,
+                   uint32_t width, uint32_t height, uint32_t stride);
+
+/**
+ * What a wlr-screencopy frame driven by screencopy_start() reports. The frame
+ * is destroyed before ready or failed are called.
+ */
+struct wooz_screencopy_handler {
+  void (*event)(void *data); // Any frame event, may be NULL
+  // Buffer to copy the frame to once the offers are in, NULL to fail. The
+  // offer is invalid if none was made.
+  struct wooz_buffer *(*buffer)(void *data,
+                                const struct wooz_shm_offer *offer);
+  // Damaged region of a copy with damage, may be NULL.
+  void (*damage)(void *data, int32_t x, int32_t y, int32_t width,
+                 int32_t height);
+  void (*flags)(void *data, uint32_t flags); // May be NULL
+  void (*ready)(void *data);
+  void (*failed)(void *data);
+};
+
+struct wooz_screencopy {
+  struct zwlr_screencopy_frame_v1 *frame; // NULL when no copy is in flight
+  struct wooz_shm_offer offer;
+  bool with_damage; // Wait for damage if the compositor supports it
+  const struct wooz_screencopy_handler *handler;
+  void *data;
+};
+
+/**
+ * Copy frame, just requested from the screencopy manager, to the buffer the
+ * handler picks. With with_damage, copies only complete once the output
+ * changed and damage is reported.
+ */
+void screencopy_start(struct wooz_screencopy *copy,
+                      struct zwlr_screencopy_frame_v1 *frame,
+                      bool with_damage,
+                      const struct wooz_screencopy_handler *handler,
+                      void *data);
+// Destroy the frame in flight, if any, without reporting anything.
+void screencopy_cancel(struct wooz_screencopy *copy);
+
+#endif
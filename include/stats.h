@@ -0,0 +1,64 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Listeners whose events are counted.
+enum wooz_stats_listener {
+  WOOZ_STATS_REGISTRY,
+  WOOZ_STATS_OUTPUT,
+  WOOZ_STATS_XDG_OUTPUT,
+  WOOZ_STATS_SCREENCOPY_FRAME,
+  WOOZ_STATS_IMAGE_COPY_SESSION,
+  WOOZ_STATS_IMAGE_COPY_FRAME,
+  WOOZ_STATS_XDG_WM_BASE,
+  WOOZ_STATS_XDG_SURFACE,
+  WOOZ_STATS_XDG_TOPLEVEL,
+  WOOZ_STATS_LAYER_SURFACE,
+  WOOZ_STATS_FRAME_CALLBACK,
+  WOOZ_STATS_SEAT,
+  WOOZ_STATS_POINTER,
+  WOOZ_STATS_KEYBOARD,
+  WOOZ_STATS_PRESENTATION,
+  WOOZ_STATS_PRESENTATION_FEEDBACK,
+  WOOZ_STATS_LISTENER_COUNT,
+};
+
+enum wooz_stats_format {
+  WOOZ_STATS_NONE,
+  WOOZ_STATS_TEXT,
+  WOOZ_STATS_JSON,
+};
+
+struct wooz_stats {
+  uint64_t start_time; // CLOCK_MONOTONIC nanoseconds
+  uint64_t commits;    // Surface commits, subsurfaces included
+  uint64_t roundtrips;
+  uint64_t events[WOOZ_STATS_LISTENER_COUNT];
+};
+
+// Request to ready latency of the captures of an output.
+struct wooz_capture_stats {
+  uint64_t requested; // Time the capture in flight was requested, 0 if none
+  uint64_t count, failed;
+  uint64_t last, total, min, max; // Nanoseconds
+};
+
+struct wooz_state;
+
+// CLOCK_MONOTONIC time in nanoseconds.
+uint64_t stats_now(void);
+
+void capture_stats_begin(struct wooz_capture_stats *stats);
+void capture_stats_end(struct wooz_capture_stats *stats, bool success);
+
+/**
+ * Print a report of state statistics: per output buffers and capture
+ * latencies, window commits, events, roundtrips and event loop wakeups.
+ */
+void print_stats(FILE *f, struct wooz_state *state,
+                 enum wooz_stats_format format);
+
+#endif
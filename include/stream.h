@@ -0,0 +1,69 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#include "buffer.h"
+
+// Frames in flight: shown, waiting to be shown, being read and one still
+// held by the compositor.
+#define STREAM_MAX_BUFFERS 4
+// Pace of frames read from a regular file, which can't be polled.
+#define STREAM_FILE_FPS 60
+
+/**
+ * Raw frames read from a file descriptor into a ring of shm buffers. Frames
+ * are width * height pixels of format, tightly packed, back to back.
+ */
+struct wooz_stream {
+  int fd;
+  int fd_flags;    // File status flags of fd to restore, -1 if unchanged
+  bool use_splice; // fd is a pipe, frames are spliced into the shm files
+  bool is_file;    // fd is a regular file, read one frame at a time
+  enum wl_shm_format format;
+  int32_t width, height, stride;
+  size_t frame_size;
+
+  struct wooz_buffer *buffers[STREAM_MAX_BUFFERS];
+  struct wooz_buffer *filling; // Frame being read, NULL to discard it
+  size_t filled;               // Bytes of the frame being read so far
+  struct wooz_buffer *ready;   // Newest complete frame, not shown yet
+  struct wooz_buffer *shown;   // Last frame returned by stream_take_frame()
+
+  uint64_t frames;  // Complete frames read
+  uint64_t dropped; // Frames replaced or discarded before being shown
+};
+
+/**
+ * Parse a wl_shm format name such as "xrgb8888" (case insensitive). Returns
+ * false if it is unknown.
+ */
+bool parse_shm_format(const char *name, enum wl_shm_format *format);
+
+/**
+ * Read frames from fd, which is made non-blocking until stream_destroy(): its
+ * open file description may be shared with other processes. Returns NULL if
+ * the ring couldn't be allocated.
+ */
+struct wooz_stream *stream_create(struct wl_shm *shm, int fd,
+                                  enum wl_shm_format format, int32_t width,
+                                  int32_t height);
+void stream_destroy(struct wooz_stream *stream);
+
+/**
+ * Read what fd has available without blocking, frames older than the newest
+ * complete one are dropped. new_frame is set if a frame was completed to be
+ * shown. Returns false at the end of the input or on error.
+ */
+bool stream_read(struct wooz_stream *stream, bool *new_frame);
+
+/**
+ * Return the newest complete frame and keep it from being overwritten until
+ * the next call, or NULL if there is no new frame.
+ */
+struct wooz_buffer *stream_take_frame(struct wooz_stream *stream);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _TIERS_H
+#define _TIERS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+// Largest downscale factor of captures kept under a memory budget.
+#define TIER_MAX_SCALE 64
+
+/**
+ * How a capture fits a memory budget: a downscaled copy of the whole output,
+ * captured in strips of full resolution rows, and two full resolution detail
+ * regions.
+ */
+struct wooz_tier_plan {
+  int32_t scale;      // Downscale factor of the whole capture, a power of 2
+  int32_t strip_rows; // Full resolution rows captured at once
+  int32_t detail_width, detail_height; // Full resolution detail region size
+};
+
+/**
+ * Plan the capture of a width x height output of 4 bytes pixels in budget
+ * bytes. Returns false if it doesn't fit even at TIER_MAX_SCALE.
+ */
+bool plan_tiers(int32_t width, int32_t height, size_t budget,
+                struct wooz_tier_plan *plan);
+
+/**
+ * Box filter full resolution rows into a buffer downscaled by scale. Rows are
+ * fed in order and may come from several captures. Formats without 8 bit
+ * channels are point sampled.
+ */
+struct wooz_downscaler {
+  struct wooz_buffer *dst;
+  int32_t scale;
+  int32_t bpp;
+  bool average;      // Channels are averaged, point sampled otherwise
+  uint32_t *sums;    // Per byte of the dst row being accumulated
+  int32_t dst_row;   // Row being accumulated
+  int32_t rows;      // Full resolution rows accumulated into it
+  int32_t next_row;  // Next full resolution row expected
+  int32_t width;     // Full resolution columns
+};
+
+// Returns false if the dst format is unknown or allocation failed.
+bool downscaler_init(struct wooz_downscaler *downscaler,
+                     struct wooz_buffer *dst, int32_t scale);
+void downscaler_finish(struct wooz_downscaler *downscaler);
+
+// Feed the rows of src, its first row being full resolution row y.
+void downscaler_add(struct wooz_downscaler *downscaler,
+                    const struct wooz_buffer *src, int32_t y);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _TILES_H
+#define _TILES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <wayland-client.h>
+
+#include "buffer.h"
+
+// Tiles are TILE_SIZE x TILE_SIZE pixels squares in buffer coordinates.
+#define TILE_SIZE 64
+
+/**
+ * Tiles covering buffer: cols x rows of them, full ones tile_bytes wide. They
+ * cover the raw rows of the buffer, independently of any transform.
+ */
+void tile_layout(const struct wooz_buffer *buffer, int32_t *cols,
+                 int32_t *rows, size_t *tile_bytes);
+
+/**
+ * Recompute the per tile hashes of buffer from its content. Returns false if
+ * they couldn't be allocated.
+ */
+bool update_tile_hashes(struct wooz_buffer *buffer);
+
+/**
+ * Compare tile hashes of two buffers with the same layout. changed must hold
+ * one entry per tile, it is set to true for tiles that differ. Returns the
+ * number of changed tiles.
+ */
+size_t diff_tile_hashes(const struct wooz_buffer *a,
+                        const struct wooz_buffer *b, bool *changed);
+
+// Whether buffers of format can be diffed: 4 bytes pixels, alpha or padding
+// last in memory.
+bool can_diff_format(enum wl_shm_format format);
+
+/**
+ * Diff b against a pixel by pixel into dst, all three of the same size and
+ * layout, see diff_pixels32(). Tiles are compared one at a time so identical
+ * ones are dimmed while still in cache. Returns false if the format isn't
+ * supported, the number of different pixels is stored in n_different.
+ */
+bool diff_buffers(struct wooz_buffer *dst, const struct wooz_buffer *a,
+                  const struct wooz_buffer *b, size_t *n_different);
+
+// Damage surface with the changed tiles of buffer, merging adjacent ones.
+void damage_tiles(struct wl_surface *surface, const struct wooz_buffer *buffer,
+                  const bool *changed);
+
+#endif
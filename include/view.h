@@ -0,0 +1,28 @@
+#ifndef _VIEW_H
+#define _VIEW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "box.h"
+
+// Smallest view height in buffer pixels, its width follows the ratio.
+#define VIEW_MIN_SIZE 16
+
+/**
+ * Zoom view, a source rectangle in buffer pixels shown in a window_width x
+ * window_height window of ratio width / height, by change buffer rows around
+ * (center_x, center_y) in window coordinates. Positive changes zoom in.
+ * Returns false if view would get smaller than VIEW_MIN_SIZE, it is then
+ * left alone.
+ */
+bool view_zoom(struct wooz_boxf *view, double ratio, double window_width,
+               double window_height, double change, double center_x,
+               double center_y);
+
+// Keep view within a width x height buffer and no smaller than
+// VIEW_MIN_SIZE.
+void view_clamp(struct wooz_boxf *view, double ratio, double width,
+                double height);
+
+#endif
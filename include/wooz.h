@@ -7,6 +7,16 @@
 #include <wayland-client.h>
 
 #include "box.h"
+#include "event-loop.h"
+#include "input-log.h"
+#include "kernels.h"
+#include "predict.h"
+#include "sat.h"
+#include "screencopy.h"
+#include "stats.h"
+#include "tiers.h"
+
+#define WOOZ_MAX_CURSOR_THEMES 4
 
 struct wooz_config {
   uint32_t close_key; // Linux input event code for close action (0 = default Esc)
@@ -14,17 +24,46 @@ struct wooz_config {
   double initial_zoom; // Initial zoom percentage (0.0 = no zoom, 0.1 = 10%)
   char *output_filter; // Filter to specific output name (NULL = all outputs)
   bool invert_scroll; // Invert scroll direction (scroll up zooms in)
+  int32_t lens_width;  // Lens width in logical pixels (0 = fullscreen mode)
+  int32_t lens_height; // Lens height in logical pixels
+  uint32_t refresh_ms; // Recapture interval in milliseconds (0 = frozen)
+  uint32_t refresh_max_ms; // Adaptive recapture interval bound (0 = fixed)
+  int32_t pick_size;   // Colour picker square size in pixels (0 = disabled)
+  bool pixel_grid;     // Show pixel boundaries at high zoom
+  bool pre_rotate;     // Rotate captures of transformed outputs upright
+  bool magnify_cursor; // Draw the cursor magnified with the view
+  enum wooz_stats_format stats; // Report format (WOOZ_STATS_NONE = disabled)
+  char *image_path;    // Image shown instead of a capture (NULL = capture)
+  int32_t input_width; // Raw stdin frames size (0 = capture)
+  int32_t input_height;
+  enum wl_shm_format input_format;
+  enum wooz_isa max_isa;  // Fastest instruction set pixel kernels may use
+  bool calibrate_kernels; // Time kernel variants at startup, keep the fastest
+  bool predict; // Extrapolate the pointer to the presentation time
+  size_t memory_budget; // Capture buffers bound in bytes (0 = unbounded)
+  char *publish_path;   // Socket the view is published on (NULL = none)
+  char *record_path;    // Y4M file the view is recorded to (NULL = none)
+  char *input_log_path; // File input events are logged to (NULL = none)
+  char *replay_path;    // Input log replayed instead of the seat (NULL = none)
+  bool replay_fast;     // Replay without waiting between events
+  size_t history_size;  // Snapshots kept per output (0 = none)
 };
 
 struct wooz_state {
   struct wl_compositor *compositor;
+  struct wl_subcompositor *subcompositor;
   struct xdg_wm_base *shell;
   struct wl_display *display;
   struct wl_registry *registry;
   struct wl_shm *shm;
   struct zxdg_output_manager_v1 *xdg_output_manager;
   struct zwlr_screencopy_manager_v1 *screencopy_manager;
+  struct ext_image_copy_capture_manager_v1 *image_copy_manager;
+  struct ext_output_image_capture_source_manager_v1 *output_source_manager;
   struct wp_viewporter *viewporter;
+  struct wp_presentation *presentation; // NULL if unsupported
+  clockid_t presentation_clock;          // Clock of presentation timestamps
+  struct zwlr_layer_shell_v1 *layer_shell;
   struct wl_seat *seat;
   struct wl_pointer *pointer;
   struct wl_keyboard *keyboard;
@@ -34,20 +73,100 @@ struct wooz_state {
   struct wooz_window *focused;
   struct wooz_config config;
 
+  struct wooz_event_loop *event_loop;
+
+  struct wooz_image *image; // Opened from config.image_path, see image.h
+  struct wooz_stream *stream; // Frames read from stdin, see stream.h
+  struct wooz_event_source *stream_source;
+  struct wooz_timer stream_timer; // Reads frames of a regular file instead
+  struct wooz_publisher *publisher; // See publish.h, NULL without --publish
+  struct wooz_recorder *recorder; // See record.h, NULL until a window shows
+
+  // --record follows one window, the first one created.
+  struct {
+    struct wooz_window *window; // NULL until the next window is created
+    struct wooz_timer timer;
+    // What window last showed, buffer is NULL for its output capture.
+    const struct wooz_buffer *buffer;
+    enum wl_output_transform transform;
+    struct wooz_boxf view;
+    bool dirty; // Not taken as a frame yet
+  } record;
+
+  struct wooz_input_log *input_log; // See input-log.h, NULL if not logging
+  // --replay-input, seat events are ignored while it runs.
+  struct {
+    struct wooz_input_log *log; // NULL once done
+    struct wooz_timer timer;
+    struct wooz_input_event next; // Next event to dispatch
+    bool has_next;
+    uint64_t start;  // CLOCK_MONOTONIC nanoseconds
+    uint64_t offset; // when of the first event
+    uint64_t commits; // stats.commits at the start
+    size_t n_events;
+  } replay;
+
   // Key repeat state
   uint32_t pressed_key;
-  int repeat_timer_fd;
+  struct wooz_timer repeat_timer;
+
+  // Cursor themes loaded for --magnify-cursor, one per output scale
+  struct {
+    int32_t scale;
+    struct wl_cursor_theme *theme;
+  } cursor_themes[WOOZ_MAX_CURSOR_THEMES];
+  size_t n_cursor_themes;
+
+  // Last colour reported by the picker
+  struct wooz_rgb picked;
+  bool has_picked;
+
+  struct wooz_stats stats;
+  int stats_signal_fd; // signalfd for SIGUSR1, -1 if none
+  struct wooz_event_source *stats_signal_source;
 
   size_t n_done;
+  bool running; // Windows are shown, outputs may now come and go
 };
 
 struct wooz_buffer;
+struct wooz_history;
+struct wooz_image;
+struct wooz_stream;
+struct wooz_worker;
+
+// Pixel work on a completed capture, done on the output worker thread.
+struct wooz_capture_work {
+  struct wooz_buffer *target; // Buffer holding the upright capture
+  enum wl_output_transform transform; // Applied from raw_buffer if set
+  bool hash; // Hash target tiles for later recaptures
+  bool diff; // Diff target tiles against the front buffer
+  // Diff target against the front buffer pixel by pixel into it, if set.
+  struct wooz_buffer *visual_diff;
+
+  // Results
+  bool *changed; // Changed tiles, NULL if they weren't diffed
+  size_t n_changed;
+  size_t n_different; // Different pixels, visual_diff is NULL on failure
+};
 
 struct wooz_output {
   struct wooz_state *state;
   struct wl_output *wl_output;
   struct zxdg_output_v1 *xdg_output;
   struct wl_list link;
+  uint32_t global_name; // wl_registry name, to handle its removal
+
+  bool active; // Matches --output, captured and shown
+  // Mode, scale and transform changes are applied once all their events
+  // arrived, to what they were last applied to.
+  struct wooz_timer change_timer;
+  struct {
+    struct wooz_box geometry, logical_geometry;
+    enum wl_output_transform transform;
+  } applied;
+  bool mode_changed; // A mode event arrived since, geometry is unrotated
+  bool change_failed; // Its capture failed, the change is applied again
 
   struct wooz_box geometry;
   enum wl_output_transform transform;
@@ -58,9 +177,61 @@ struct wooz_output {
   double logical_scale; // guessed from the logical size
   char *name;
 
-  struct wooz_buffer *buffer;
-  struct zwlr_screencopy_frame_v1 *screencopy_frame;
+  struct wooz_buffer *buffer;      // Front buffer, attached to the window
+  struct wooz_buffer *back_buffer; // Recapture target
+  // Shown until the capture following an output change is attached.
+  struct wooz_buffer *changed_buffer;
+  struct wooz_buffer *raw_buffer;  // Capture target with --pre-rotate
+  struct wooz_screencopy screencopy; // wlr-screencopy capture or strip
+  bool recapture;       // The capture in flight targets back_buffer
+  bool capture_pending; // Waiting for image copy session constraints
+
+  // ext-image-copy-capture session, kept across captures.
+  struct ext_image_capture_source_v1 *image_capture_source;
+  struct ext_image_copy_capture_session_v1 *image_copy_session;
+  struct ext_image_copy_capture_frame_v1 *image_copy_frame;
+  bool image_copy_session_ready; // Buffer constraints received
+
+  struct wooz_shm_offer capture_offer; // Of the capture in flight
+  struct wl_array capture_damage; // struct wooz_box, in buffer coordinates
   uint32_t screencopy_frame_flags; // enum zwlr_screencopy_frame_v1_flags
+  struct wooz_capture_stats capture_stats;
+  struct wooz_worker *worker; // NULL to process captures inline
+  struct wooz_capture_work capture_work;
+
+  // Capture kept under --memory-budget, see tiers.h. buffer then holds the
+  // whole output downscaled by tiers.scale, captured strip by strip.
+  struct wooz_tier_plan tiers; // scale is 0 at full resolution
+  size_t tiers_budget;         // Share of --memory-budget planned with
+  struct wooz_buffer *strip;   // Capture target of the strip in flight
+  struct wooz_downscaler downscaler;
+  int32_t strip_y, strip_height; // Strip in flight, logical rows
+
+  // Full resolution region around the view, captured on demand.
+  struct wooz_buffer *details[2];
+  struct wooz_buffer *detail;  // Last captured one, NULL if none yet
+  struct wooz_boxf detail_box; // Its region, in buffer coordinates
+  struct wooz_box detail_region; // Region in flight, logical coordinates
+  struct wooz_screencopy detail_copy;
+
+  // Visual diff of a recapture against the previous capture, toggled with
+  // the d key. Refreshing stops while it is shown.
+  struct wooz_buffer *diff_buffer;
+  bool diff_pending; // The next recapture is diffed
+  bool show_diff;
+
+  // Snapshots of the last captures, see --history. history_age steps back
+  // from the newest one, the capture itself. Refreshing stops while an older
+  // one is shown.
+  struct wooz_history *history; // NULL until the first capture
+  struct wooz_buffer *history_buffers[2];
+  struct wooz_buffer *history_buffer; // Last restored snapshot
+  size_t history_age;
+  int history_pending; // Steps taken while a capture was in flight
+
+  int32_t refresh_mhz; // Current mode refresh rate, 0 if unknown
+  struct wooz_timer refresh_timer;
+  double refresh_interval; // Delay before the next recapture, milliseconds
 };
 
 struct wooz_window {
@@ -73,6 +244,43 @@ struct wooz_window {
   struct wp_viewport *viewport;
   struct wl_surface *surface;
 
+  // Buffers rendered by wooz for the lens or an image, captures are
+  // attached directly otherwise.
+  struct wooz_buffer *buffers[3];
+
+  // Lens mode: a pointer following overlay instead of a fullscreen toplevel.
+  struct zwlr_layer_surface_v1 *layer_surface;
+  double lens_zoom;
+  int32_t lens_x, lens_y; // Top-left corner in output logical coordinates
+  int32_t lens_committed_x, lens_committed_y; // Last committed corner
+
+  // Pending frame callback, renders are deferred until it is done or the
+  // window is resumed.
+  struct wl_callback *frame_callback;
+  bool needs_render;
+
+  // Pixel grid overlay, see --pixel-grid.
+  struct wl_surface *grid_surface;
+  struct wl_subsurface *grid_subsurface;
+  struct wp_viewport *grid_viewport;
+  struct wooz_buffer *grid_buffers[2];
+  struct wooz_buffer *grid_buffer; // Attached one, NULL if hidden
+  double grid_cell_x, grid_cell_y; // On-screen pixel size it was drawn for
+
+  // Magnified cursor overlay, see --magnify-cursor.
+  struct wl_surface *cursor_surface;
+  struct wl_subsurface *cursor_subsurface;
+  struct wp_viewport *cursor_viewport;
+  struct wl_cursor_image *cursor_image; // Attached image, NULL if hidden
+  int32_t cursor_width, cursor_height;  // Viewport destination
+
+  // Full resolution detail region shown over a downscaled capture, see
+  // --memory-budget.
+  struct wl_surface *detail_surface;
+  struct wl_subsurface *detail_subsurface;
+  struct wp_viewport *detail_viewport;
+  struct wooz_buffer *detail_buffer; // Attached one, NULL if hidden
+
   // Viewport source rectangle.
   struct wooz_boxf view_source;
   struct wooz_boxf initial_view_source; // For restore/unzoom
@@ -82,6 +290,14 @@ struct wooz_window {
   double pointer_y;
   bool pointer_pressed;
 
+  // Pointer prediction, see --predict. The view is offset by where the
+  // pointer is expected to be when the commit is presented.
+  struct wooz_predictor predictor;
+  double predict_dx, predict_dy; // Offset applied to view_source
+  struct wooz_timer predict_timer; // Drops the offset once the pointer rests
+  struct wp_presentation_feedback *presentation_feedback;
+  uint64_t feedback_commit_time; // presentation_clock nanoseconds
+
   // Double-click detection
   uint32_t last_click_time;
   uint32_t last_click_button;
@@ -103,6 +319,7 @@ struct wooz_window {
   bool is_tiled_left;
   bool is_tiled_right;
   bool is_tiled; /* At least one of is_tiled_{top,bottom,left,right} is true */
+  bool is_suspended; // Not shown by the compositor, all work is stopped
   bool initial_zoom_applied;
   struct {
     int width;
@@ -115,6 +332,7 @@ struct wooz_window {
     bool is_tiled_bottom : 1;
     bool is_tiled_left : 1;
     bool is_tiled_right : 1;
+    bool is_suspended : 1;
   } configure;
 };
 
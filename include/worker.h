@@ -0,0 +1,31 @@
+#ifndef _WORKER_H
+#define _WORKER_H
+
+#include <stdbool.h>
+
+#include "event-loop.h"
+
+typedef void (*wooz_work_func_t)(void *data);
+
+/**
+ * Thread running one job at a time off the event loop. Jobs must not make
+ * Wayland requests, their completion callback runs on the event loop thread
+ * and may.
+ */
+struct wooz_worker;
+
+// Returns NULL if the thread couldn't be started.
+struct wooz_worker *worker_create(struct wooz_event_loop *loop);
+// Waits for the current job, its completion callback isn't called.
+void worker_destroy(struct wooz_worker *worker);
+
+/**
+ * Run work(data) on the worker thread, then done(data) from the event loop.
+ * Returns false if a job is already in flight.
+ */
+bool worker_submit(struct wooz_worker *worker, wooz_work_func_t work,
+                   wooz_work_func_t done, void *data);
+// Whether a job was submitted and its completion callback didn't run yet.
+bool worker_is_busy(const struct wooz_worker *worker);
+
+#endif
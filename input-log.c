@@ -0,0 +1,150 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "input-log.h"
+#include "stats.h"
+
+#define INPUT_LOG_MAX_LINE 128
+
+static const char *type_names[WOOZ_INPUT_TYPE_COUNT] = {
+    [WOOZ_INPUT_ENTER] = "enter",
+    [WOOZ_INPUT_LEAVE] = "leave",
+    [WOOZ_INPUT_MOTION] = "motion",
+    [WOOZ_INPUT_BUTTON] = "button",
+    [WOOZ_INPUT_AXIS] = "axis",
+    [WOOZ_INPUT_KEY] = "key",
+    [WOOZ_INPUT_KEYBOARD_LEAVE] = "keyboard-leave",
+};
+
+static struct wooz_input_log *open_log(const char *path, const char *mode) {
+  struct wooz_input_log *log = calloc(1, sizeof(struct wooz_input_log));
+  if (log == NULL) {
+    return NULL;
+  }
+  log->file = fopen(path, mode);
+  if (log->file == NULL) {
+    free(log);
+    return NULL;
+  }
+  log->start = stats_now();
+  return log;
+}
+
+struct wooz_input_log *input_log_create(const char *path) {
+  struct wooz_input_log *log = open_log(path, "w");
+  if (log != NULL &&
+      fprintf(log->file, "wooz-input %d\n", INPUT_LOG_VERSION) < 0) {
+    input_log_destroy(log);
+    return NULL;
+  }
+  return log;
+}
+
+struct wooz_input_log *input_log_open(const char *path) {
+  struct wooz_input_log *log = open_log(path, "r");
+  if (log == NULL) {
+    return NULL;
+  }
+  int version;
+  if (fscanf(log->file, "wooz-input %d\n", &version) != 1 ||
+      version != INPUT_LOG_VERSION) {
+    input_log_destroy(log);
+    return NULL;
+  }
+  log->line = 1;
+  return log;
+}
+
+void input_log_destroy(struct wooz_input_log *log) {
+  if (log == NULL) {
+    return;
+  }
+  fclose(log->file);
+  free(log);
+}
+
+void input_log_write(struct wooz_input_log *log,
+                     struct wooz_input_event *event) {
+  event->when = stats_now() - log->start;
+  fprintf(log->file, "%" PRIu64 " %s", event->when, type_names[event->type]);
+  switch (event->type) {
+  case WOOZ_INPUT_ENTER:
+    fprintf(log->file, " %s %" PRId32 " %" PRId32, event->output, event->x,
+            event->y);
+    break;
+  case WOOZ_INPUT_LEAVE:
+    fprintf(log->file, " %s", event->output);
+    break;
+  case WOOZ_INPUT_MOTION:
+    fprintf(log->file, " %" PRIu32 " %" PRId32 " %" PRId32, event->time,
+            event->x, event->y);
+    break;
+  case WOOZ_INPUT_AXIS:
+    fprintf(log->file, " %" PRIu32 " %" PRIu32 " %" PRId32, event->time,
+            event->code, event->x);
+    break;
+  case WOOZ_INPUT_BUTTON:
+  case WOOZ_INPUT_KEY:
+    fprintf(log->file, " %" PRIu32 " %" PRIu32 " %" PRIu32, event->time,
+            event->code, event->state);
+    break;
+  default:
+    break;
+  }
+  fputc('\n', log->file);
+}
+
+static bool parse_type(const char *name, enum wooz_input_type *type) {
+  for (int i = 0; i < WOOZ_INPUT_TYPE_COUNT; i++) {
+    if (strcmp(name, type_names[i]) == 0) {
+      *type = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool parse_event(const char *line, struct wooz_input_event *event) {
+  char type[INPUT_LOG_MAX_NAME];
+  int offset;
+  if (sscanf(line, "%" SCNu64 " %31s%n", &event->when, type, &offset) != 2 ||
+      !parse_type(type, &event->type)) {
+    return false;
+  }
+  const char *args = line + offset;
+  switch (event->type) {
+  case WOOZ_INPUT_ENTER:
+    return sscanf(args, " %31s %" SCNd32 " %" SCNd32, event->output,
+                  &event->x, &event->y) == 3;
+  case WOOZ_INPUT_LEAVE:
+    return sscanf(args, " %31s", event->output) == 1;
+  case WOOZ_INPUT_MOTION:
+    return sscanf(args, " %" SCNu32 " %" SCNd32 " %" SCNd32, &event->time,
+                  &event->x, &event->y) == 3;
+  case WOOZ_INPUT_AXIS:
+    return sscanf(args, " %" SCNu32 " %" SCNu32 " %" SCNd32, &event->time,
+                  &event->code, &event->x) == 3;
+  case WOOZ_INPUT_BUTTON:
+  case WOOZ_INPUT_KEY:
+    return sscanf(args, " %" SCNu32 " %" SCNu32 " %" SCNu32, &event->time,
+                  &event->code, &event->state) == 3;
+  default:
+    return true;
+  }
+}
+
+bool input_log_read(struct wooz_input_log *log,
+                    struct wooz_input_event *event) {
+  char line[INPUT_LOG_MAX_LINE];
+  if (fgets(line, sizeof(line), log->file) == NULL) {
+    return false;
+  }
+  log->line++;
+  *event = (struct wooz_input_event){0};
+  if (!parse_event(line, event)) {
+    log->invalid = true;
+    return false;
+  }
+  return true;
+}
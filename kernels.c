@@ -0,0 +1,1151 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kernels.h"
+#include "tiles.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WOOZ_X86 1
+#include <immintrin.h>
+#else
+#define WOOZ_X86 0
+#endif
+
+#define HASH_PRIME 0x9E3779B1u
+#define HASH_CHUNK (sizeof(uint32_t) * KERNEL_HASH_LANES)
+
+// Pixels are dimmed to a quarter, without touching the alpha byte. Without
+// alpha, that byte is padding and is neither diffed nor hashed.
+#if WOOZ_LITTLE_ENDIAN
+#define DIFF_ALPHA_MASK 0xff000000u
+#define DIFF_DIM_MASK 0x003f3f3fu
+#define DIFF_HIGHLIGHT 0xffff00ffu
+#else
+#define DIFF_ALPHA_MASK 0x000000ffu
+#define DIFF_DIM_MASK 0x3f3f3f00u
+#define DIFF_HIGHLIGHT 0xff00ffffu
+#endif
+
+// Scratch line kernels are timed on, and calls per measurement.
+#define CALIBRATE_WIDTH 4096
+#define CALIBRATE_CALLS 32
+#define CALIBRATE_ROUNDS 3
+
+typedef void (*gather32_func_t)(uint32_t *dst, const uint32_t *src,
+                                const int32_t *columns, int32_t n);
+typedef void (*hash_line_func_t)(uint32_t *lanes, const uint8_t *line,
+                                 size_t len, size_t tile_bytes,
+                                 uint32_t mask);
+typedef void (*hash_tile_func_t)(uint32_t *lanes, const uint8_t *data,
+                                 size_t len, uint32_t mask);
+typedef void (*unpack32_func_t)(const uint8_t *src, int32_t width,
+                                const uint8_t shifts[3],
+                                uint32_t *channels[3]);
+typedef size_t (*diff32_func_t)(uint32_t *dst, const uint32_t *a,
+                                const uint32_t *b, int32_t width,
+                                int32_t height, size_t stride, uint32_t mask);
+typedef void (*yuv420_func_t)(const uint8_t *src0, const uint8_t *src1,
+                              int32_t width, const uint8_t shifts[3],
+                              uint8_t *y0, uint8_t *y1, uint8_t *u,
+                              uint8_t *v);
+typedef bool (*equal_row_func_t)(const uint32_t *a, const uint32_t *b,
+                                 int32_t n, uint32_t mask);
+typedef void (*dim_row_func_t)(uint32_t *dst, const uint32_t *src,
+                               int32_t n);
+typedef size_t (*diff_row_func_t)(uint32_t *dst, const uint32_t *a,
+                                  const uint32_t *b, int32_t n, uint32_t mask);
+
+static const char *isa_names[WOOZ_ISA_COUNT] = {
+    [WOOZ_ISA_SCALAR] = "scalar",
+    [WOOZ_ISA_SSE2] = "sse2",
+    [WOOZ_ISA_AVX2] = "avx2",
+    [WOOZ_ISA_AVX512] = "avx512",
+};
+
+static const char *kernel_names[WOOZ_KERNEL_COUNT] = {
+    [WOOZ_KERNEL_GATHER32] = "gather32",
+    [WOOZ_KERNEL_TILE_HASH] = "tile_hash",
+    [WOOZ_KERNEL_UNPACK32] = "unpack32",
+    [WOOZ_KERNEL_DIFF32] = "diff32",
+    [WOOZ_KERNEL_YUV420] = "yuv420",
+};
+
+static uint32_t load_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static void gather32_scalar(uint32_t *dst, const uint32_t *src,
+                            const int32_t *columns, int32_t n) {
+  for (int32_t x = 0; x < n; x++) {
+    dst[x] = src[columns[x]];
+  }
+}
+
+// Bytes past the last whole chunk of a tile all go to the first lane. Chunks
+// are whole words, so are tails: they start on a word of mask.
+static void hash_tail(uint32_t *lanes, const uint8_t *data, size_t len,
+                      uint32_t mask) {
+  uint8_t bytes[sizeof(mask)];
+  memcpy(bytes, &mask, sizeof(mask));
+  for (size_t i = 0; i < len; i++) {
+    lanes[0] = (lanes[0] ^ (data[i] & bytes[i % sizeof(mask)])) * HASH_PRIME;
+  }
+}
+
+// Words are hashed on the bits of mask.
+static void hash_tile_scalar(uint32_t *lanes, const uint8_t *data, size_t len,
+                             uint32_t mask) {
+  size_t i = 0;
+  for (; i + HASH_CHUNK <= len; i += HASH_CHUNK) {
+    uint32_t words[KERNEL_HASH_LANES];
+    memcpy(words, data + i, HASH_CHUNK);
+    // (h ^ w) * odd is a bijection: a single changed word is always detected.
+    for (int j = 0; j < KERNEL_HASH_LANES; j++) {
+      lanes[j] = (lanes[j] ^ (words[j] & mask)) * HASH_PRIME;
+    }
+  }
+  hash_tail(lanes, data + i, len - i, mask);
+}
+
+static void hash_line(hash_tile_func_t hash_tile, uint32_t *lanes,
+                      const uint8_t *line, size_t len, size_t tile_bytes,
+                      uint32_t mask) {
+  for (size_t offset = 0; offset < len; offset += tile_bytes) {
+    size_t n = len - offset < tile_bytes ? len - offset : tile_bytes;
+    hash_tile(lanes, line + offset, n, mask);
+    lanes += KERNEL_HASH_LANES;
+  }
+}
+
+static void hash_line_scalar(uint32_t *lanes, const uint8_t *line, size_t len,
+                             size_t tile_bytes, uint32_t mask) {
+  hash_line(hash_tile_scalar, lanes, line, len, tile_bytes, mask);
+}
+
+static void unpack32_scalar(const uint8_t *src, int32_t width,
+                            const uint8_t shifts[3], uint32_t *channels[3]) {
+  for (int32_t x = 0; x < width; x++) {
+    uint32_t v = load_le32(src + 4 * x);
+    for (int c = 0; c < 3; c++) {
+      channels[c][x] = v >> shifts[c] & 0xff;
+    }
+  }
+}
+
+static uint32_t dim_pixel(uint32_t v) {
+  return (v & DIFF_ALPHA_MASK) | (v >> 2 & DIFF_DIM_MASK);
+}
+
+// Pixels are compared on the bits of mask.
+static bool equal_row_scalar(const uint32_t *a, const uint32_t *b, int32_t n,
+                             uint32_t mask) {
+  for (int32_t x = 0; x < n; x++) {
+    if (((a[x] ^ b[x]) & mask) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void dim_row_scalar(uint32_t *dst, const uint32_t *src, int32_t n) {
+  for (int32_t x = 0; x < n; x++) {
+    dst[x] = dim_pixel(src[x]);
+  }
+}
+
+static size_t diff_row_scalar(uint32_t *dst, const uint32_t *a,
+                              const uint32_t *b, int32_t n, uint32_t mask) {
+  size_t n_different = 0;
+  for (int32_t x = 0; x < n; x++) {
+    bool different = ((a[x] ^ b[x]) & mask) != 0;
+    dst[x] = different ? DIFF_HIGHLIGHT : dim_pixel(b[x]);
+    n_different += different;
+  }
+  return n_different;
+}
+
+// Rows before the first difference, all of them for identical tiles, are
+// only read twice and dimmed.
+static size_t diff_tile(equal_row_func_t equal_row, dim_row_func_t dim_row,
+                        diff_row_func_t diff_row, uint32_t *dst,
+                        const uint32_t *a, const uint32_t *b, int32_t width,
+                        int32_t height, size_t stride, uint32_t mask) {
+  size_t words = stride / sizeof(uint32_t);
+  int32_t equal = 0;
+  while (equal < height &&
+         equal_row(a + equal * words, b + equal * words, width, mask)) {
+    equal++;
+  }
+  for (int32_t y = 0; y < equal; y++) {
+    dim_row(dst + y * words, b + y * words, width);
+  }
+
+  size_t n_different = 0;
+  for (int32_t y = equal; y < height; y++) {
+    n_different +=
+        diff_row(dst + y * words, a + y * words, b + y * words, width, mask);
+  }
+  return n_different;
+}
+
+static size_t diff32_scalar(uint32_t *dst, const uint32_t *a,
+                            const uint32_t *b, int32_t width, int32_t height,
+                            size_t stride, uint32_t mask) {
+  return diff_tile(equal_row_scalar, dim_row_scalar, diff_row_scalar, dst, a,
+                   b, width, height, stride, mask);
+}
+
+// BT.601 limited range weights, 8 bits of fraction. Chroma adds 128.5 before
+// the shift: sums stay positive and round.
+#define YUV_BIAS 128
+#define YUV_CHROMA_BIAS 32896
+
+static uint8_t luma(uint32_t r, uint32_t g, uint32_t b) {
+  return (uint8_t)(((66 * r + 129 * g + 25 * b + YUV_BIAS) >> 8) + 16);
+}
+
+static uint8_t chroma_u(uint32_t r, uint32_t g, uint32_t b) {
+  return (uint8_t)((112 * b + YUV_CHROMA_BIAS - 38 * r - 74 * g) >> 8);
+}
+
+static uint8_t chroma_v(uint32_t r, uint32_t g, uint32_t b) {
+  return (uint8_t)((112 * r + YUV_CHROMA_BIAS - 94 * g - 18 * b) >> 8);
+}
+
+static void yuv420_scalar(const uint8_t *src0, const uint8_t *src1,
+                          int32_t width, const uint8_t shifts[3], uint8_t *y0,
+                          uint8_t *y1, uint8_t *u, uint8_t *v) {
+  for (int32_t x = 0; x + 1 < width; x += 2) {
+    const uint8_t *src[4] = {src0 + 4 * x, src0 + 4 * x + 4, src1 + 4 * x,
+                             src1 + 4 * x + 4};
+    uint8_t *dst[4] = {y0 + x, y0 + x + 1, y1 + x, y1 + x + 1};
+    uint32_t sums[3] = {0};
+    for (int i = 0; i < 4; i++) {
+      uint32_t p = load_le32(src[i]);
+      uint32_t rgb[3];
+      for (int c = 0; c < 3; c++) {
+        rgb[c] = p >> shifts[c] & 0xff;
+        sums[c] += rgb[c];
+      }
+      *dst[i] = luma(rgb[0], rgb[1], rgb[2]);
+    }
+    // Chroma of the mean colour of the 2x2 block.
+    for (int c = 0; c < 3; c++) {
+      sums[c] = (sums[c] + 2) >> 2;
+    }
+    u[x / 2] = chroma_u(sums[0], sums[1], sums[2]);
+    v[x / 2] = chroma_v(sums[0], sums[1], sums[2]);
+  }
+}
+
+#if WOOZ_X86
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+
+static TARGET_SSE2 void gather32_sse2(uint32_t *dst, const uint32_t *src,
+                                      const int32_t *columns, int32_t n) {
+  // There is no gather before AVX2, loads are only batched into one store.
+  int32_t x = 0;
+  for (; x + 4 <= n; x += 4) {
+    __m128i v = _mm_set_epi32((int)src[columns[x + 3]],
+                              (int)src[columns[x + 2]],
+                              (int)src[columns[x + 1]], (int)src[columns[x]]);
+    _mm_storeu_si128((__m128i *)(dst + x), v);
+  }
+  gather32_scalar(dst + x, src, columns + x, n - x);
+}
+
+static TARGET_AVX2 void gather32_avx2(uint32_t *dst, const uint32_t *src,
+                                      const int32_t *columns, int32_t n) {
+  int32_t x = 0;
+  for (; x + 8 <= n; x += 8) {
+    __m256i index = _mm256_loadu_si256((const __m256i *)(columns + x));
+    _mm256_storeu_si256((__m256i *)(dst + x),
+                        _mm256_i32gather_epi32((const int *)src, index, 4));
+  }
+  gather32_scalar(dst + x, src, columns + x, n - x);
+}
+
+static TARGET_AVX512 void gather32_avx512(uint32_t *dst, const uint32_t *src,
+                                          const int32_t *columns, int32_t n) {
+  int32_t x = 0;
+  for (; x + 16 <= n; x += 16) {
+    __m512i index = _mm512_loadu_si512(columns + x);
+    _mm512_storeu_si512(dst + x, _mm512_i32gather_epi32(index, src, 4));
+  }
+  gather32_avx2(dst + x, src, columns + x, n - x);
+}
+
+// SSE2 only multiplies even lanes to 64 bits, odd lanes are shifted down.
+static inline TARGET_SSE2 __m128i mullo32_sse2(__m128i a, __m128i b) {
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static TARGET_SSE2 void hash_tile_sse2(uint32_t *lanes, const uint8_t *data,
+                                       size_t len, uint32_t mask) {
+  __m128i prime = _mm_set1_epi32((int)HASH_PRIME);
+  __m128i vmask = _mm_set1_epi32((int)mask);
+  __m128i lo = _mm_loadu_si128((const __m128i *)lanes);
+  __m128i hi = _mm_loadu_si128((const __m128i *)(lanes + 4));
+  size_t i = 0;
+  for (; i + HASH_CHUNK <= len; i += HASH_CHUNK) {
+    __m128i w_lo =
+        _mm_and_si128(_mm_loadu_si128((const __m128i *)(data + i)), vmask);
+    __m128i w_hi = _mm_and_si128(
+        _mm_loadu_si128((const __m128i *)(data + i + 16)), vmask);
+    lo = mullo32_sse2(_mm_xor_si128(lo, w_lo), prime);
+    hi = mullo32_sse2(_mm_xor_si128(hi, w_hi), prime);
+  }
+  _mm_storeu_si128((__m128i *)lanes, lo);
+  _mm_storeu_si128((__m128i *)(lanes + 4), hi);
+  hash_tail(lanes, data + i, len - i, mask);
+}
+
+static TARGET_SSE2 void hash_line_sse2(uint32_t *lanes, const uint8_t *line,
+                                       size_t len, size_t tile_bytes,
+                                       uint32_t mask) {
+  hash_line(hash_tile_sse2, lanes, line, len, tile_bytes, mask);
+}
+
+static TARGET_AVX2 void hash_tile_avx2(uint32_t *lanes, const uint8_t *data,
+                                       size_t len, uint32_t mask) {
+  __m256i prime = _mm256_set1_epi32((int)HASH_PRIME);
+  __m256i vmask = _mm256_set1_epi32((int)mask);
+  __m256i h = _mm256_loadu_si256((const __m256i *)lanes);
+  size_t i = 0;
+  for (; i + HASH_CHUNK <= len; i += HASH_CHUNK) {
+    __m256i w = _mm256_and_si256(
+        _mm256_loadu_si256((const __m256i *)(data + i)), vmask);
+    h = _mm256_mullo_epi32(_mm256_xor_si256(h, w), prime);
+  }
+  _mm256_storeu_si256((__m256i *)lanes, h);
+  hash_tail(lanes, data + i, len - i, mask);
+}
+
+static TARGET_AVX2 void hash_line_avx2(uint32_t *lanes, const uint8_t *line,
+                                       size_t len, size_t tile_bytes,
+                                       uint32_t mask) {
+  hash_line(hash_tile_avx2, lanes, line, len, tile_bytes, mask);
+}
+
+static TARGET_AVX512 void hash_line_avx512(uint32_t *lanes,
+                                           const uint8_t *line, size_t len,
+                                           size_t tile_bytes, uint32_t mask) {
+  // The lanes of two neighbouring tiles fill one register, both are hashed
+  // at once.
+  __m512i prime = _mm512_set1_epi32((int)HASH_PRIME);
+  __m512i vmask = _mm512_set1_epi32((int)mask);
+  size_t whole = tile_bytes - tile_bytes % HASH_CHUNK;
+  size_t offset = 0;
+  for (; offset + 2 * tile_bytes <= len; offset += 2 * tile_bytes) {
+    const uint8_t *a = line + offset;
+    const uint8_t *b = a + tile_bytes;
+    __m512i h = _mm512_loadu_si512(lanes);
+    for (size_t i = 0; i < whole; i += HASH_CHUNK) {
+      __m256i w_a = _mm256_loadu_si256((const __m256i *)(a + i));
+      __m256i w_b = _mm256_loadu_si256((const __m256i *)(b + i));
+      __m512i w = _mm512_inserti64x4(_mm512_castsi256_si512(w_a), w_b, 1);
+      w = _mm512_and_si512(w, vmask);
+      h = _mm512_mullo_epi32(_mm512_xor_si512(h, w), prime);
+    }
+    _mm512_storeu_si512(lanes, h);
+    hash_tail(lanes, a + whole, tile_bytes - whole, mask);
+    hash_tail(lanes + KERNEL_HASH_LANES, b + whole, tile_bytes - whole, mask);
+    lanes += 2 * KERNEL_HASH_LANES;
+  }
+  hash_line(hash_tile_avx2, lanes, line + offset, len - offset, tile_bytes,
+            mask);
+}
+
+static TARGET_SSE2 void unpack32_sse2(const uint8_t *src, int32_t width,
+                                      const uint8_t shifts[3],
+                                      uint32_t *channels[3]) {
+  __m128i mask = _mm_set1_epi32(0xff);
+  __m128i counts[3];
+  for (int c = 0; c < 3; c++) {
+    counts[c] = _mm_cvtsi32_si128(shifts[c]);
+  }
+  int32_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * x));
+    for (int c = 0; c < 3; c++) {
+      _mm_storeu_si128((__m128i *)(channels[c] + x),
+                       _mm_and_si128(_mm_srl_epi32(v, counts[c]), mask));
+    }
+  }
+  uint32_t *rest[3] = {channels[0] + x, channels[1] + x, channels[2] + x};
+  unpack32_scalar(src + 4 * x, width - x, shifts, rest);
+}
+
+static TARGET_AVX2 void unpack32_avx2(const uint8_t *src, int32_t width,
+                                      const uint8_t shifts[3],
+                                      uint32_t *channels[3]) {
+  __m256i mask = _mm256_set1_epi32(0xff);
+  __m128i counts[3];
+  for (int c = 0; c < 3; c++) {
+    counts[c] = _mm_cvtsi32_si128(shifts[c]);
+  }
+  int32_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(src + 4 * x));
+    for (int c = 0; c < 3; c++) {
+      _mm256_storeu_si256(
+          (__m256i *)(channels[c] + x),
+          _mm256_and_si256(_mm256_srl_epi32(v, counts[c]), mask));
+    }
+  }
+  uint32_t *rest[3] = {channels[0] + x, channels[1] + x, channels[2] + x};
+  unpack32_scalar(src + 4 * x, width - x, shifts, rest);
+}
+
+static TARGET_AVX512 void unpack32_avx512(const uint8_t *src, int32_t width,
+                                          const uint8_t shifts[3],
+                                          uint32_t *channels[3]) {
+  __m512i mask = _mm512_set1_epi32(0xff);
+  __m128i counts[3];
+  for (int c = 0; c < 3; c++) {
+    counts[c] = _mm_cvtsi32_si128(shifts[c]);
+  }
+  int32_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m512i v = _mm512_loadu_si512(src + 4 * x);
+    for (int c = 0; c < 3; c++) {
+      _mm512_storeu_si512(
+          channels[c] + x,
+          _mm512_and_si512(_mm512_srl_epi32(v, counts[c]), mask));
+    }
+  }
+  uint32_t *rest[3] = {channels[0] + x, channels[1] + x, channels[2] + x};
+  unpack32_scalar(src + 4 * x, width - x, shifts, rest);
+}
+
+static inline TARGET_SSE2 __m128i dim_sse2(__m128i v) {
+  __m128i alpha = _mm_set1_epi32((int)DIFF_ALPHA_MASK);
+  __m128i dim = _mm_set1_epi32((int)DIFF_DIM_MASK);
+  return _mm_or_si128(_mm_and_si128(v, alpha),
+                      _mm_and_si128(_mm_srli_epi32(v, 2), dim));
+}
+
+// Pixels equal on the bits of mask, as all ones lanes.
+static inline TARGET_SSE2 __m128i equal_sse2(__m128i a, __m128i b,
+                                             __m128i mask) {
+  return _mm_cmpeq_epi32(_mm_and_si128(_mm_xor_si128(a, b), mask),
+                         _mm_setzero_si128());
+}
+
+static TARGET_SSE2 bool equal_row_sse2(const uint32_t *a, const uint32_t *b,
+                                       int32_t n, uint32_t mask) {
+  __m128i vmask = _mm_set1_epi32((int)mask);
+  int32_t x = 0;
+  for (; x + 4 <= n; x += 4) {
+    __m128i eq = equal_sse2(_mm_loadu_si128((const __m128i *)(a + x)),
+                            _mm_loadu_si128((const __m128i *)(b + x)), vmask);
+    if (_mm_movemask_epi8(eq) != 0xffff) {
+      return false;
+    }
+  }
+  return equal_row_scalar(a + x, b + x, n - x, mask);
+}
+
+static TARGET_SSE2 void dim_row_sse2(uint32_t *dst, const uint32_t *src,
+                                     int32_t n) {
+  int32_t x = 0;
+  for (; x + 4 <= n; x += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+    _mm_storeu_si128((__m128i *)(dst + x), dim_sse2(v));
+  }
+  dim_row_scalar(dst + x, src + x, n - x);
+}
+
+static TARGET_SSE2 size_t diff_row_sse2(uint32_t *dst, const uint32_t *a,
+                                        const uint32_t *b, int32_t n,
+                                        uint32_t mask) {
+  __m128i highlight = _mm_set1_epi32((int)DIFF_HIGHLIGHT);
+  __m128i vmask = _mm_set1_epi32((int)mask);
+  size_t n_different = 0;
+  int32_t x = 0;
+  for (; x + 4 <= n; x += 4) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+    __m128i eq = equal_sse2(va, vb, vmask);
+    __m128i v = _mm_or_si128(_mm_and_si128(eq, dim_sse2(vb)),
+                             _mm_andnot_si128(eq, highlight));
+    _mm_storeu_si128((__m128i *)(dst + x), v);
+    n_different +=
+        4 - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(eq)));
+  }
+  return n_different + diff_row_scalar(dst + x, a + x, b + x, n - x, mask);
+}
+
+static TARGET_SSE2 size_t diff32_sse2(uint32_t *dst, const uint32_t *a,
+                                      const uint32_t *b, int32_t width,
+                                      int32_t height, size_t stride,
+                                      uint32_t mask) {
+  return diff_tile(equal_row_sse2, dim_row_sse2, diff_row_sse2, dst, a, b,
+                   width, height, stride, mask);
+}
+
+static inline TARGET_AVX2 __m256i dim_avx2(__m256i v) {
+  __m256i alpha = _mm256_set1_epi32((int)DIFF_ALPHA_MASK);
+  __m256i dim = _mm256_set1_epi32((int)DIFF_DIM_MASK);
+  return _mm256_or_si256(_mm256_and_si256(v, alpha),
+                         _mm256_and_si256(_mm256_srli_epi32(v, 2), dim));
+}
+
+static inline TARGET_AVX2 __m256i equal_avx2(__m256i a, __m256i b,
+                                             __m256i mask) {
+  return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_xor_si256(a, b), mask),
+                            _mm256_setzero_si256());
+}
+
+static TARGET_AVX2 bool equal_row_avx2(const uint32_t *a, const uint32_t *b,
+                                       int32_t n, uint32_t mask) {
+  __m256i vmask = _mm256_set1_epi32((int)mask);
+  int32_t x = 0;
+  for (; x + 8 <= n; x += 8) {
+    __m256i eq = equal_avx2(_mm256_loadu_si256((const __m256i *)(a + x)),
+                            _mm256_loadu_si256((const __m256i *)(b + x)),
+                            vmask);
+    if (_mm256_movemask_epi8(eq) != -1) {
+      return false;
+    }
+  }
+  return equal_row_scalar(a + x, b + x, n - x, mask);
+}
+
+static TARGET_AVX2 void dim_row_avx2(uint32_t *dst, const uint32_t *src,
+                                     int32_t n) {
+  int32_t x = 0;
+  for (; x + 8 <= n; x += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(src + x));
+    _mm256_storeu_si256((__m256i *)(dst + x), dim_avx2(v));
+  }
+  dim_row_scalar(dst + x, src + x, n - x);
+}
+
+static TARGET_AVX2 size_t diff_row_avx2(uint32_t *dst, const uint32_t *a,
+                                        const uint32_t *b, int32_t n,
+                                        uint32_t mask) {
+  __m256i highlight = _mm256_set1_epi32((int)DIFF_HIGHLIGHT);
+  __m256i vmask = _mm256_set1_epi32((int)mask);
+  size_t n_different = 0;
+  int32_t x = 0;
+  for (; x + 8 <= n; x += 8) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + x));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + x));
+    __m256i eq = equal_avx2(va, vb, vmask);
+    _mm256_storeu_si256((__m256i *)(dst + x),
+                        _mm256_blendv_epi8(highlight, dim_avx2(vb), eq));
+    n_different +=
+        8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(eq)));
+  }
+  return n_different + diff_row_scalar(dst + x, a + x, b + x, n - x, mask);
+}
+
+static TARGET_AVX2 size_t diff32_avx2(uint32_t *dst, const uint32_t *a,
+                                      const uint32_t *b, int32_t width,
+                                      int32_t height, size_t stride,
+                                      uint32_t mask) {
+  return diff_tile(equal_row_avx2, dim_row_avx2, diff_row_avx2, dst, a, b,
+                   width, height, stride, mask);
+}
+
+static inline TARGET_AVX512 __m512i dim_avx512(__m512i v) {
+  __m512i alpha = _mm512_set1_epi32((int)DIFF_ALPHA_MASK);
+  __m512i dim = _mm512_set1_epi32((int)DIFF_DIM_MASK);
+  return _mm512_or_si512(_mm512_and_si512(v, alpha),
+                         _mm512_and_si512(_mm512_srli_epi32(v, 2), dim));
+}
+
+static TARGET_AVX512 bool equal_row_avx512(const uint32_t *a,
+                                           const uint32_t *b, int32_t n,
+                                           uint32_t mask) {
+  __m512i vmask = _mm512_set1_epi32((int)mask);
+  int32_t x = 0;
+  for (; x + 16 <= n; x += 16) {
+    __m512i va = _mm512_loadu_si512(a + x);
+    __m512i vb = _mm512_loadu_si512(b + x);
+    if (_mm512_test_epi32_mask(_mm512_xor_si512(va, vb), vmask) != 0) {
+      return false;
+    }
+  }
+  return equal_row_avx2(a + x, b + x, n - x, mask);
+}
+
+static TARGET_AVX512 void dim_row_avx512(uint32_t *dst, const uint32_t *src,
+                                         int32_t n) {
+  int32_t x = 0;
+  for (; x + 16 <= n; x += 16) {
+    _mm512_storeu_si512(dst + x, dim_avx512(_mm512_loadu_si512(src + x)));
+  }
+  dim_row_avx2(dst + x, src + x, n - x);
+}
+
+static TARGET_AVX512 size_t diff_row_avx512(uint32_t *dst, const uint32_t *a,
+                                            const uint32_t *b, int32_t n,
+                                            uint32_t mask) {
+  __m512i highlight = _mm512_set1_epi32((int)DIFF_HIGHLIGHT);
+  __m512i vmask = _mm512_set1_epi32((int)mask);
+  size_t n_different = 0;
+  int32_t x = 0;
+  for (; x + 16 <= n; x += 16) {
+    __m512i vb = _mm512_loadu_si512(b + x);
+    __mmask16 eq =
+        _mm512_testn_epi32_mask(_mm512_xor_si512(_mm512_loadu_si512(a + x), vb),
+                                vmask);
+    _mm512_storeu_si512(dst + x,
+                        _mm512_mask_blend_epi32(eq, highlight, dim_avx512(vb)));
+    n_different += 16 - __builtin_popcount(eq);
+  }
+  return n_different + diff_row_avx2(dst + x, a + x, b + x, n - x, mask);
+}
+
+static TARGET_AVX512 size_t diff32_avx512(uint32_t *dst, const uint32_t *a,
+                                          const uint32_t *b, int32_t width,
+                                          int32_t height, size_t stride,
+                                          uint32_t mask) {
+  return diff_tile(equal_row_avx512, dim_row_avx512, diff_row_avx512, dst, a,
+                   b, width, height, stride, mask);
+}
+
+static inline TARGET_SSE2 void split_rgb_sse2(__m128i v,
+                                              const __m128i counts[3],
+                                              __m128i rgb[3]) {
+  __m128i mask = _mm_set1_epi32(0xff);
+  for (int c = 0; c < 3; c++) {
+    rgb[c] = _mm_and_si128(_mm_srl_epi32(v, counts[c]), mask);
+  }
+}
+
+// wr * r + wg * g + wb * b. Channels, weights and their products fit in 16
+// bits: the high halves of the 32 bit lanes stay zero.
+static inline TARGET_SSE2 __m128i weigh_sse2(const __m128i rgb[3], int wr,
+                                             int wg, int wb) {
+  __m128i r = _mm_mullo_epi16(rgb[0], _mm_set1_epi32(wr));
+  __m128i g = _mm_mullo_epi16(rgb[1], _mm_set1_epi32(wg));
+  __m128i b = _mm_mullo_epi16(rgb[2], _mm_set1_epi32(wb));
+  return _mm_add_epi32(_mm_add_epi32(r, g), b);
+}
+
+static inline TARGET_SSE2 __m128i luma_sse2(const __m128i rgb[3]) {
+  __m128i y = _mm_add_epi32(weigh_sse2(rgb, 66, 129, 25),
+                            _mm_set1_epi32(YUV_BIAS));
+  return _mm_add_epi32(_mm_srli_epi32(y, 8), _mm_set1_epi32(16));
+}
+
+static inline TARGET_SSE2 void chroma_sse2(const __m128i rgb[3], __m128i *u,
+                                           __m128i *v) {
+  __m128i bias = _mm_set1_epi32(YUV_CHROMA_BIAS);
+  *u = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(weigh_sse2(rgb, 0, 0, 112),
+                                                  bias),
+                                    weigh_sse2(rgb, 38, 74, 0)),
+                      8);
+  *v = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(weigh_sse2(rgb, 112, 0, 0),
+                                                  bias),
+                                    weigh_sse2(rgb, 0, 94, 18)),
+                      8);
+}
+
+static inline TARGET_SSE2 void store32_sse2(uint8_t *dst, __m128i v) {
+  int32_t word = _mm_cvtsi128_si32(v);
+  memcpy(dst, &word, sizeof(word));
+}
+
+static TARGET_SSE2 void yuv420_sse2(const uint8_t *src0, const uint8_t *src1,
+                                    int32_t width, const uint8_t shifts[3],
+                                    uint8_t *y0, uint8_t *y1, uint8_t *u,
+                                    uint8_t *v) {
+  __m128i counts[3];
+  for (int c = 0; c < 3; c++) {
+    counts[c] = _mm_cvtsi32_si128(shifts[c]);
+  }
+  __m128i two = _mm_set1_epi32(2);
+  const uint8_t *src[2] = {src0, src1};
+  uint8_t *dst[2] = {y0, y1};
+  int32_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    // Column sums of the two rows, per 4 pixels half.
+    __m128i sums[2][3];
+    for (int row = 0; row < 2; row++) {
+      __m128i y[2];
+      for (int half = 0; half < 2; half++) {
+        __m128i rgb[3];
+        split_rgb_sse2(
+            _mm_loadu_si128((const __m128i *)(src[row] + 4 * (x + 4 * half))),
+            counts, rgb);
+        y[half] = luma_sse2(rgb);
+        for (int c = 0; c < 3; c++) {
+          sums[half][c] =
+              row == 0 ? rgb[c] : _mm_add_epi32(sums[half][c], rgb[c]);
+        }
+      }
+      __m128i packed = _mm_packs_epi32(y[0], y[1]);
+      _mm_storel_epi64((__m128i *)(dst[row] + x),
+                       _mm_packus_epi16(packed, packed));
+    }
+
+    // Add horizontal neighbours into even lanes, then gather those.
+    __m128i mean[3];
+    for (int c = 0; c < 3; c++) {
+      __m128 pairs[2];
+      for (int half = 0; half < 2; half++) {
+        __m128i s = sums[half][c];
+        pairs[half] =
+            _mm_castsi128_ps(_mm_add_epi32(s, _mm_srli_epi64(s, 32)));
+      }
+      __m128i block = _mm_castps_si128(
+          _mm_shuffle_ps(pairs[0], pairs[1], _MM_SHUFFLE(2, 0, 2, 0)));
+      mean[c] = _mm_srli_epi32(_mm_add_epi32(block, two), 2);
+    }
+    __m128i cu, cv;
+    chroma_sse2(mean, &cu, &cv);
+    cu = _mm_packs_epi32(cu, cu);
+    cv = _mm_packs_epi32(cv, cv);
+    store32_sse2(u + x / 2, _mm_packus_epi16(cu, cu));
+    store32_sse2(v + x / 2, _mm_packus_epi16(cv, cv));
+  }
+  yuv420_scalar(src0 + 4 * x, src1 + 4 * x, width - x, shifts, y0 + x,
+                y1 + x, u + x / 2, v + x / 2);
+}
+
+static inline TARGET_AVX2 void split_rgb_avx2(__m256i v,
+                                              const __m128i counts[3],
+                                              __m256i rgb[3]) {
+  __m256i mask = _mm256_set1_epi32(0xff);
+  for (int c = 0; c < 3; c++) {
+    rgb[c] = _mm256_and_si256(_mm256_srl_epi32(v, counts[c]), mask);
+  }
+}
+
+static inline TARGET_AVX2 __m256i weigh_avx2(const __m256i rgb[3], int wr,
+                                             int wg, int wb) {
+  __m256i r = _mm256_mullo_epi16(rgb[0], _mm256_set1_epi32(wr));
+  __m256i g = _mm256_mullo_epi16(rgb[1], _mm256_set1_epi32(wg));
+  __m256i b = _mm256_mullo_epi16(rgb[2], _mm256_set1_epi32(wb));
+  return _mm256_add_epi32(_mm256_add_epi32(r, g), b);
+}
+
+static inline TARGET_AVX2 __m256i luma_avx2(const __m256i rgb[3]) {
+  __m256i y = _mm256_add_epi32(weigh_avx2(rgb, 66, 129, 25),
+                               _mm256_set1_epi32(YUV_BIAS));
+  return _mm256_add_epi32(_mm256_srli_epi32(y, 8), _mm256_set1_epi32(16));
+}
+
+static inline TARGET_AVX2 void chroma_avx2(const __m256i rgb[3], __m256i *u,
+                                           __m256i *v) {
+  __m256i bias = _mm256_set1_epi32(YUV_CHROMA_BIAS);
+  *u = _mm256_srli_epi32(
+      _mm256_sub_epi32(_mm256_add_epi32(weigh_avx2(rgb, 0, 0, 112), bias),
+                       weigh_avx2(rgb, 38, 74, 0)),
+      8);
+  *v = _mm256_srli_epi32(
+      _mm256_sub_epi32(_mm256_add_epi32(weigh_avx2(rgb, 112, 0, 0), bias),
+                       weigh_avx2(rgb, 0, 94, 18)),
+      8);
+}
+
+// The 8 lanes, below 256, as bytes in the low half.
+static inline TARGET_AVX2 __m128i narrow8_avx2(__m256i v) {
+  __m256i words = _mm256_packs_epi32(v, v);
+  __m256i bytes = _mm256_packus_epi16(words, words);
+  __m256i order = _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4);
+  return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(bytes, order));
+}
+
+static TARGET_AVX2 void yuv420_avx2(const uint8_t *src0, const uint8_t *src1,
+                                    int32_t width, const uint8_t shifts[3],
+                                    uint8_t *y0, uint8_t *y1, uint8_t *u,
+                                    uint8_t *v) {
+  __m128i counts[3];
+  for (int c = 0; c < 3; c++) {
+    counts[c] = _mm_cvtsi32_si128(shifts[c]);
+  }
+  __m256i two = _mm256_set1_epi32(2);
+  const uint8_t *src[2] = {src0, src1};
+  uint8_t *dst[2] = {y0, y1};
+  int32_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m256i sums[2][3];
+    for (int row = 0; row < 2; row++) {
+      __m256i y[2];
+      for (int half = 0; half < 2; half++) {
+        __m256i rgb[3];
+        split_rgb_avx2(_mm256_loadu_si256(
+                           (const __m256i *)(src[row] + 4 * (x + 8 * half))),
+                       counts, rgb);
+        y[half] = luma_avx2(rgb);
+        for (int c = 0; c < 3; c++) {
+          sums[half][c] =
+              row == 0 ? rgb[c] : _mm256_add_epi32(sums[half][c], rgb[c]);
+        }
+      }
+      // Packs work within 128 bit lanes, 64 bit blocks are put back in order.
+      __m256i packed = _mm256_permute4x64_epi64(
+          _mm256_packs_epi32(y[0], y[1]), _MM_SHUFFLE(3, 1, 2, 0));
+      packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(packed, packed),
+                                        _MM_SHUFFLE(3, 1, 2, 0));
+      _mm_storeu_si128((__m128i *)(dst[row] + x),
+                       _mm256_castsi256_si128(packed));
+    }
+
+    __m256i mean[3];
+    for (int c = 0; c < 3; c++) {
+      __m256 pairs[2];
+      for (int half = 0; half < 2; half++) {
+        __m256i s = sums[half][c];
+        pairs[half] = _mm256_castsi256_ps(
+            _mm256_add_epi32(s, _mm256_srli_epi64(s, 32)));
+      }
+      __m256i block = _mm256_permute4x64_epi64(
+          _mm256_castps_si256(_mm256_shuffle_ps(pairs[0], pairs[1],
+                                                _MM_SHUFFLE(2, 0, 2, 0))),
+          _MM_SHUFFLE(3, 1, 2, 0));
+      mean[c] = _mm256_srli_epi32(_mm256_add_epi32(block, two), 2);
+    }
+    __m256i cu, cv;
+    chroma_avx2(mean, &cu, &cv);
+    _mm_storel_epi64((__m128i *)(u + x / 2), narrow8_avx2(cu));
+    _mm_storel_epi64((__m128i *)(v + x / 2), narrow8_avx2(cv));
+  }
+  yuv420_sse2(src0 + 4 * x, src1 + 4 * x, width - x, shifts, y0 + x, y1 + x,
+              u + x / 2, v + x / 2);
+}
+
+static inline TARGET_AVX512 __m512i weigh_avx512(const __m512i rgb[3], int wr,
+                                                 int wg, int wb) {
+  __m512i r = _mm512_mullo_epi32(rgb[0], _mm512_set1_epi32(wr));
+  __m512i g = _mm512_mullo_epi32(rgb[1], _mm512_set1_epi32(wg));
+  __m512i b = _mm512_mullo_epi32(rgb[2], _mm512_set1_epi32(wb));
+  return _mm512_add_epi32(_mm512_add_epi32(r, g), b);
+}
+
+static TARGET_AVX512 void yuv420_avx512(const uint8_t *src0,
+                                        const uint8_t *src1, int32_t width,
+                                        const uint8_t shifts[3], uint8_t *y0,
+                                        uint8_t *y1, uint8_t *u, uint8_t *v) {
+  __m512i mask = _mm512_set1_epi32(0xff);
+  __m128i counts[3];
+  for (int c = 0; c < 3; c++) {
+    counts[c] = _mm_cvtsi32_si128(shifts[c]);
+  }
+  __m512i bias = _mm512_set1_epi32(YUV_BIAS);
+  __m512i offset = _mm512_set1_epi32(16);
+  __m512i chroma_bias = _mm512_set1_epi32(YUV_CHROMA_BIAS);
+  __m512i two = _mm512_set1_epi32(2);
+  const uint8_t *src[2] = {src0, src1};
+  uint8_t *dst[2] = {y0, y1};
+  int32_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m512i sums[3];
+    for (int row = 0; row < 2; row++) {
+      __m512i p = _mm512_loadu_si512(src[row] + 4 * x);
+      __m512i rgb[3];
+      for (int c = 0; c < 3; c++) {
+        rgb[c] = _mm512_and_si512(_mm512_srl_epi32(p, counts[c]), mask);
+        sums[c] = row == 0 ? rgb[c] : _mm512_add_epi32(sums[c], rgb[c]);
+      }
+      __m512i y = _mm512_add_epi32(
+          _mm512_srli_epi32(
+              _mm512_add_epi32(weigh_avx512(rgb, 66, 129, 25), bias), 8),
+          offset);
+      _mm_storeu_si128((__m128i *)(dst[row] + x), _mm512_cvtepi32_epi8(y));
+    }
+
+    // Blocks end up in the even lanes, narrowing 64 bit lanes keeps them.
+    __m512i mean[3];
+    for (int c = 0; c < 3; c++) {
+      __m512i block = _mm512_add_epi32(sums[c], _mm512_srli_epi64(sums[c], 32));
+      mean[c] = _mm512_srli_epi32(_mm512_add_epi32(block, two), 2);
+    }
+    __m512i cu = _mm512_srli_epi32(
+        _mm512_sub_epi32(
+            _mm512_add_epi32(weigh_avx512(mean, 0, 0, 112), chroma_bias),
+            weigh_avx512(mean, 38, 74, 0)),
+        8);
+    __m512i cv = _mm512_srli_epi32(
+        _mm512_sub_epi32(
+            _mm512_add_epi32(weigh_avx512(mean, 112, 0, 0), chroma_bias),
+            weigh_avx512(mean, 0, 94, 18)),
+        8);
+    _mm_storel_epi64((__m128i *)(u + x / 2), _mm512_cvtepi64_epi8(cu));
+    _mm_storel_epi64((__m128i *)(v + x / 2), _mm512_cvtepi64_epi8(cv));
+  }
+  yuv420_avx2(src0 + 4 * x, src1 + 4 * x, width - x, shifts, y0 + x, y1 + x,
+              u + x / 2, v + x / 2);
+}
+
+#define X86_ONLY(func) func
+#else
+#define X86_ONLY(func) NULL
+#endif
+
+static const gather32_func_t gather32_variants[WOOZ_ISA_COUNT] = {
+    gather32_scalar,
+    X86_ONLY(gather32_sse2),
+    X86_ONLY(gather32_avx2),
+    X86_ONLY(gather32_avx512),
+};
+
+static const hash_line_func_t hash_line_variants[WOOZ_ISA_COUNT] = {
+    hash_line_scalar,
+    X86_ONLY(hash_line_sse2),
+    X86_ONLY(hash_line_avx2),
+    X86_ONLY(hash_line_avx512),
+};
+
+static const unpack32_func_t unpack32_variants[WOOZ_ISA_COUNT] = {
+    unpack32_scalar,
+    X86_ONLY(unpack32_sse2),
+    X86_ONLY(unpack32_avx2),
+    X86_ONLY(unpack32_avx512),
+};
+
+static const diff32_func_t diff32_variants[WOOZ_ISA_COUNT] = {
+    diff32_scalar,
+    X86_ONLY(diff32_sse2),
+    X86_ONLY(diff32_avx2),
+    X86_ONLY(diff32_avx512),
+};
+
+static const yuv420_func_t yuv420_variants[WOOZ_ISA_COUNT] = {
+    yuv420_scalar,
+    X86_ONLY(yuv420_sse2),
+    X86_ONLY(yuv420_avx2),
+    X86_ONLY(yuv420_avx512),
+};
+
+// Selected variants, only changed at startup before any worker runs.
+static struct {
+  gather32_func_t gather32;
+  hash_line_func_t hash_line;
+  unpack32_func_t unpack32;
+  diff32_func_t diff32;
+  yuv420_func_t yuv420;
+  enum wooz_isa isa[WOOZ_KERNEL_COUNT];
+} kernels = {gather32_scalar, hash_line_scalar, unpack32_scalar, diff32_scalar,
+             yuv420_scalar, {0}};
+
+const char *isa_name(enum wooz_isa isa) { return isa_names[isa]; }
+
+const char *kernel_name(enum wooz_kernel kernel) {
+  return kernel_names[kernel];
+}
+
+bool parse_isa(const char *name, enum wooz_isa *isa) {
+  for (int i = 0; i < WOOZ_ISA_COUNT; i++) {
+    if (strcmp(name, isa_names[i]) == 0) {
+      *isa = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool cpu_supports(enum wooz_isa isa) {
+#if WOOZ_X86
+  __builtin_cpu_init();
+  switch (isa) {
+  case WOOZ_ISA_SCALAR:
+    return true;
+  case WOOZ_ISA_SSE2:
+    return __builtin_cpu_supports("sse2");
+  case WOOZ_ISA_AVX2:
+    return __builtin_cpu_supports("avx2");
+  case WOOZ_ISA_AVX512:
+    return __builtin_cpu_supports("avx512f");
+  default:
+    return false;
+  }
+#else
+  return isa == WOOZ_ISA_SCALAR;
+#endif
+}
+
+enum wooz_isa kernels_supported_isa(void) {
+  // Each level builds on the ones below it.
+  enum wooz_isa isa = WOOZ_ISA_SCALAR;
+  while (isa + 1 < WOOZ_ISA_COUNT && cpu_supports(isa + 1)) {
+    isa++;
+  }
+  return isa;
+}
+
+static void set_kernel(enum wooz_kernel kernel, enum wooz_isa isa) {
+  switch (kernel) {
+  case WOOZ_KERNEL_GATHER32:
+    kernels.gather32 = gather32_variants[isa];
+    break;
+  case WOOZ_KERNEL_TILE_HASH:
+    kernels.hash_line = hash_line_variants[isa];
+    break;
+  case WOOZ_KERNEL_UNPACK32:
+    kernels.unpack32 = unpack32_variants[isa];
+    break;
+  case WOOZ_KERNEL_DIFF32:
+    kernels.diff32 = diff32_variants[isa];
+    break;
+  case WOOZ_KERNEL_YUV420:
+    kernels.yuv420 = yuv420_variants[isa];
+    break;
+  default:
+    return;
+  }
+  kernels.isa[kernel] = isa;
+}
+
+void kernels_select(enum wooz_isa isa) {
+  enum wooz_isa supported = kernels_supported_isa();
+  if (isa > supported) {
+    isa = supported;
+  }
+  for (int i = 0; i < WOOZ_KERNEL_COUNT; i++) {
+    set_kernel(i, isa);
+  }
+}
+
+enum wooz_isa kernel_isa(enum wooz_kernel kernel) {
+  return kernels.isa[kernel];
+}
+
+struct calibrate_data {
+  uint32_t *pixels;
+  uint32_t *dst;
+  int32_t *columns;
+  uint32_t *lanes;
+  uint32_t *channels[3];
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Best of a few rounds, the first one also warms the caches up.
+static uint64_t time_kernel(enum wooz_kernel kernel,
+                            struct calibrate_data *data) {
+  static const uint8_t shifts[3] = {16, 8, 0};
+  size_t tile_bytes = TILE_SIZE * sizeof(uint32_t);
+
+  uint64_t best = UINT64_MAX;
+  for (int round = 0; round < CALIBRATE_ROUNDS; round++) {
+    uint64_t start = now_ns();
+    for (int i = 0; i < CALIBRATE_CALLS; i++) {
+      switch (kernel) {
+      case WOOZ_KERNEL_GATHER32:
+        gather_pixels32(data->dst, data->pixels, data->columns,
+                        CALIBRATE_WIDTH);
+        break;
+      case WOOZ_KERNEL_TILE_HASH:
+        hash_tile_line(data->lanes, (const uint8_t *)data->pixels,
+                       CALIBRATE_WIDTH * sizeof(uint32_t), tile_bytes, true);
+        break;
+      case WOOZ_KERNEL_UNPACK32:
+        unpack_channels32((const uint8_t *)data->pixels, CALIBRATE_WIDTH,
+                          shifts, data->channels);
+        break;
+      case WOOZ_KERNEL_DIFF32:
+        // Identical captures, like most of their tiles.
+        diff_pixels32(data->dst, data->pixels, data->pixels, CALIBRATE_WIDTH,
+                      1, CALIBRATE_WIDTH * sizeof(uint32_t), false);
+        break;
+      case WOOZ_KERNEL_YUV420: {
+        uint8_t *planes = (uint8_t *)data->dst;
+        rgb_to_yuv420((const uint8_t *)data->pixels,
+                      (const uint8_t *)data->pixels, CALIBRATE_WIDTH, shifts,
+                      planes, planes + CALIBRATE_WIDTH,
+                      planes + 2 * CALIBRATE_WIDTH,
+                      planes + 5 * CALIBRATE_WIDTH / 2);
+        break;
+      }
+      default:
+        break;
+      }
+    }
+    uint64_t elapsed = now_ns() - start;
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+void kernels_calibrate(enum wooz_isa max_isa) {
+  kernels_select(max_isa);
+  enum wooz_isa supported = kernel_isa(WOOZ_KERNEL_GATHER32);
+
+  struct calibrate_data data = {0};
+  data.pixels = malloc(CALIBRATE_WIDTH * sizeof(uint32_t));
+  data.dst = malloc(CALIBRATE_WIDTH * sizeof(uint32_t));
+  data.columns = malloc(CALIBRATE_WIDTH * sizeof(int32_t));
+  data.lanes = calloc(CALIBRATE_WIDTH / TILE_SIZE * KERNEL_HASH_LANES,
+                      sizeof(uint32_t));
+  data.channels[0] = malloc(3 * CALIBRATE_WIDTH * sizeof(uint32_t));
+  if (data.pixels != NULL && data.dst != NULL && data.columns != NULL &&
+      data.lanes != NULL && data.channels[0] != NULL) {
+    data.channels[1] = data.channels[0] + CALIBRATE_WIDTH;
+    data.channels[2] = data.channels[1] + CALIBRATE_WIDTH;
+    uint32_t seed = 1;
+    for (int32_t x = 0; x < CALIBRATE_WIDTH; x++) {
+      seed = seed * 1664525u + 1013904223u;
+      data.pixels[x] = seed;
+      // Columns of a view zoomed in 2.5 times.
+      data.columns[x] = x * 2 / 5;
+    }
+
+    for (int kernel = 0; kernel < WOOZ_KERNEL_COUNT; kernel++) {
+      enum wooz_isa best = supported;
+      uint64_t best_time = UINT64_MAX;
+      for (int isa = 0; isa <= (int)supported; isa++) {
+        set_kernel(kernel, isa);
+        uint64_t elapsed = time_kernel(kernel, &data);
+        if (elapsed < best_time) {
+          best = isa;
+          best_time = elapsed;
+        }
+      }
+      set_kernel(kernel, best);
+    }
+  }
+
+  free(data.pixels);
+  free(data.dst);
+  free(data.columns);
+  free(data.lanes);
+  free(data.channels[0]);
+}
+
+void gather_pixels32(uint32_t *dst, const uint32_t *src,
+                     const int32_t *columns, int32_t n) {
+  kernels.gather32(dst, src, columns, n);
+}
+
+void hash_tile_line(uint32_t *lanes, const uint8_t *line, size_t len,
+                    size_t tile_bytes, bool padding) {
+  kernels.hash_line(lanes, line, len, tile_bytes,
+                    padding ? ~DIFF_ALPHA_MASK : UINT32_MAX);
+}
+
+void unpack_channels32(const uint8_t *src, int32_t width,
+                       const uint8_t shifts[3], uint32_t *channels[3]) {
+  kernels.unpack32(src, width, shifts, channels);
+}
+
+size_t diff_pixels32(uint32_t *dst, const uint32_t *a, const uint32_t *b,
+                     int32_t width, int32_t height, size_t stride,
+                     bool alpha) {
+  return kernels.diff32(dst, a, b, width, height, stride,
+                        alpha ? UINT32_MAX : ~DIFF_ALPHA_MASK);
+}
+
+void rgb_to_yuv420(const uint8_t *src0, const uint8_t *src1, int32_t width,
+                   const uint8_t shifts[3], uint8_t *y0, uint8_t *y1,
+                   uint8_t *u, uint8_t *v) {
+  kernels.yuv420(src0, src1, width, shifts, y0, y1, u, v);
+}
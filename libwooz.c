@@ -0,0 +1,466 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "libwooz.h"
+#include "output-layout.h"
+#include "screencopy.h"
+#include "view.h"
+
+#include "wlr-screencopy-unstable-v1-protocol.h"
+#include "xdg-output-unstable-v1-protocol.h"
+
+// Everything else in the library is hidden, see meson.build.
+#define LIBWOOZ_EXPORT __attribute__((visibility("default")))
+
+struct libwooz {
+  struct wl_display *display;
+  struct wl_event_queue *queue;       // NULL for the default queue
+  struct wl_display *display_wrapper; // Creates proxies on queue
+  struct wl_registry *registry;
+  struct wl_shm *shm;
+  struct zxdg_output_manager_v1 *xdg_output_manager;
+  struct zwlr_screencopy_manager_v1 *screencopy_manager;
+  struct wl_list outputs; // struct libwooz_output, in advertisement order
+  size_t n_outputs;
+  // Outputs the compositor removed, kept until libwooz_destroy() since the
+  // caller may still hold them.
+  struct wl_list removed_outputs;
+};
+
+struct libwooz_output {
+  struct libwooz *wooz;
+  struct wl_output *wl_output;
+  struct zxdg_output_v1 *xdg_output;
+  uint32_t global_name;
+  bool removed; // Its wl_output was destroyed, captures fail
+  struct wl_list link;
+
+  char *name;
+  enum wl_output_transform transform;
+  int32_t scale;
+  int32_t x, y;                    // Position reported by wl_output
+  int32_t mode_width, mode_height; // Current mode, untransformed
+  struct wooz_box logical_geometry;
+};
+
+struct libwooz_capture {
+  struct libwooz_output *output;
+  struct wooz_screencopy copy;
+  struct wooz_buffer *buffer;
+  bool done, failed;
+};
+
+static int roundtrip(struct libwooz *wooz) {
+  if (wooz->queue != NULL) {
+    return wl_display_roundtrip_queue(wooz->display, wooz->queue);
+  }
+  return wl_display_roundtrip(wooz->display);
+}
+
+static int dispatch(struct libwooz *wooz) {
+  if (wooz->queue != NULL) {
+    return wl_display_dispatch_queue(wooz->display, wooz->queue);
+  }
+  return wl_display_dispatch(wooz->display);
+}
+
+static void output_handle_geometry(void *data, struct wl_output *wl_output,
+                                   int32_t x, int32_t y, int32_t physical_width,
+                                   int32_t physical_height, int32_t subpixel,
+                                   const char *make, const char *model,
+                                   int32_t transform) {
+  struct libwooz_output *output = data;
+  output->x = x;
+  output->y = y;
+  output->transform = transform;
+}
+
+static void output_handle_mode(void *data, struct wl_output *wl_output,
+                               uint32_t flags, int32_t width, int32_t height,
+                               int32_t refresh) {
+  struct libwooz_output *output = data;
+  if ((flags & WL_OUTPUT_MODE_CURRENT) != 0) {
+    output->mode_width = width;
+    output->mode_height = height;
+  }
+}
+
+static void output_handle_done(void *data, struct wl_output *wl_output) {
+  // Nothing to do, sizes are computed when queried
+}
+
+static void output_handle_scale(void *data, struct wl_output *wl_output,
+                                int32_t factor) {
+  struct libwooz_output *output = data;
+  output->scale = factor;
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_handle_geometry,
+    .mode = output_handle_mode,
+    .done = output_handle_done,
+    .scale = output_handle_scale,
+};
+
+static void xdg_output_handle_logical_position(
+    void *data, struct zxdg_output_v1 *xdg_output, int32_t x, int32_t y) {
+  struct libwooz_output *output = data;
+  output->logical_geometry.x = x;
+  output->logical_geometry.y = y;
+}
+
+static void xdg_output_handle_logical_size(void *data,
+                                           struct zxdg_output_v1 *xdg_output,
+                                           int32_t width, int32_t height) {
+  struct libwooz_output *output = data;
+  output->logical_geometry.width = width;
+  output->logical_geometry.height = height;
+}
+
+static void xdg_output_handle_done(void *data,
+                                   struct zxdg_output_v1 *xdg_output) {
+  // Nothing to do, the logical geometry is complete
+}
+
+static void xdg_output_handle_name(void *data,
+                                   struct zxdg_output_v1 *xdg_output,
+                                   const char *name) {
+  struct libwooz_output *output = data;
+  free(output->name);
+  output->name = strdup(name);
+}
+
+static void xdg_output_handle_description(void *data,
+                                          struct zxdg_output_v1 *xdg_output,
+                                          const char *description) {
+  // Not exposed
+}
+
+static const struct zxdg_output_v1_listener xdg_output_listener = {
+    .logical_position = xdg_output_handle_logical_position,
+    .logical_size = xdg_output_handle_logical_size,
+    .done = xdg_output_handle_done,
+    .name = xdg_output_handle_name,
+    .description = xdg_output_handle_description,
+};
+
+static void destroy_output_proxies(struct libwooz_output *output) {
+  if (output->xdg_output != NULL) {
+    zxdg_output_v1_destroy(output->xdg_output);
+    output->xdg_output = NULL;
+  }
+  if (wl_output_get_version(output->wl_output) >=
+      WL_OUTPUT_RELEASE_SINCE_VERSION) {
+    wl_output_release(output->wl_output);
+  } else {
+    wl_output_destroy(output->wl_output);
+  }
+  output->wl_output = NULL;
+}
+
+static void handle_global(void *data, struct wl_registry *registry,
+                          uint32_t name, const char *interface,
+                          uint32_t version) {
+  struct libwooz *wooz = data;
+
+  if (strcmp(interface, wl_shm_interface.name) == 0) {
+    wooz->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+  } else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
+    uint32_t bind_version = (version > 2) ? 2 : version;
+    wooz->xdg_output_manager = wl_registry_bind(
+        registry, name, &zxdg_output_manager_v1_interface, bind_version);
+  } else if (strcmp(interface, wl_output_interface.name) == 0) {
+    struct libwooz_output *output = calloc(1, sizeof(struct libwooz_output));
+    if (output == NULL) {
+      return;
+    }
+    output->wooz = wooz;
+    output->global_name = name;
+    output->scale = 1;
+    uint32_t bind_version = (version > 3) ? 3 : version;
+    output->wl_output =
+        wl_registry_bind(registry, name, &wl_output_interface, bind_version);
+    wl_output_add_listener(output->wl_output, &output_listener, output);
+    wl_list_insert(wooz->outputs.prev, &output->link);
+    wooz->n_outputs++;
+  } else if (strcmp(interface, zwlr_screencopy_manager_v1_interface.name) ==
+             0) {
+    uint32_t bind_version = (version > 3) ? 3 : version;
+    wooz->screencopy_manager = wl_registry_bind(
+        registry, name, &zwlr_screencopy_manager_v1_interface, bind_version);
+  }
+}
+
+static void handle_global_remove(void *data, struct wl_registry *registry,
+                                 uint32_t name) {
+  struct libwooz *wooz = data;
+  struct libwooz_output *output;
+  wl_list_for_each(output, &wooz->outputs, link) {
+    if (output->global_name == name) {
+      wl_list_remove(&output->link);
+      wl_list_insert(&wooz->removed_outputs, &output->link);
+      wooz->n_outputs--;
+      destroy_output_proxies(output);
+      output->removed = true;
+      return;
+    }
+  }
+}
+
+static const struct wl_registry_listener registry_listener = {
+    .global = handle_global,
+    .global_remove = handle_global_remove,
+};
+
+LIBWOOZ_EXPORT int libwooz_api_version(void) { return LIBWOOZ_API_VERSION; }
+
+LIBWOOZ_EXPORT struct libwooz *libwooz_create(struct wl_display *display,
+                                              struct wl_event_queue *queue) {
+  struct libwooz *wooz = calloc(1, sizeof(struct libwooz));
+  if (wooz == NULL) {
+    return NULL;
+  }
+  wooz->display = display;
+  wooz->queue = queue;
+  wl_list_init(&wooz->outputs);
+  wl_list_init(&wooz->removed_outputs);
+
+  // Proxies inherit the queue of the proxy creating them, the caller's
+  // display keeps its own.
+  wooz->display_wrapper = wl_proxy_create_wrapper(display);
+  if (wooz->display_wrapper == NULL) {
+    free(wooz);
+    return NULL;
+  }
+  if (queue != NULL) {
+    wl_proxy_set_queue((struct wl_proxy *)wooz->display_wrapper, queue);
+  }
+
+  wooz->registry = wl_display_get_registry(wooz->display_wrapper);
+  wl_registry_add_listener(wooz->registry, &registry_listener, wooz);
+  if (roundtrip(wooz) < 0 || wooz->shm == NULL ||
+      wooz->screencopy_manager == NULL) {
+    libwooz_destroy(wooz);
+    return NULL;
+  }
+
+  if (wooz->xdg_output_manager != NULL) {
+    struct libwooz_output *output;
+    wl_list_for_each(output, &wooz->outputs, link) {
+      output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+          wooz->xdg_output_manager, output->wl_output);
+      zxdg_output_v1_add_listener(output->xdg_output, &xdg_output_listener,
+                                  output);
+    }
+  }
+  // Output events, and xdg-output ones, follow the bind.
+  if (roundtrip(wooz) < 0) {
+    libwooz_destroy(wooz);
+    return NULL;
+  }
+
+  if (wooz->xdg_output_manager == NULL) {
+    struct libwooz_output *output;
+    wl_list_for_each(output, &wooz->outputs, link) {
+      struct wooz_box geometry = {.x = output->x, .y = output->y};
+      libwooz_output_get_size(output, &geometry.width, &geometry.height);
+      double logical_scale;
+      guess_logical_geometry(&geometry, output->scale,
+                             &output->logical_geometry, &logical_scale);
+    }
+  }
+  return wooz;
+}
+
+LIBWOOZ_EXPORT void libwooz_destroy(struct libwooz *wooz) {
+  if (wooz == NULL) {
+    return;
+  }
+
+  struct libwooz_output *output, *output_tmp;
+  wl_list_for_each_safe(output, output_tmp, &wooz->outputs, link) {
+    destroy_output_proxies(output);
+  }
+  wl_list_insert_list(&wooz->outputs, &wooz->removed_outputs);
+  wl_list_for_each_safe(output, output_tmp, &wooz->outputs, link) {
+    wl_list_remove(&output->link);
+    free(output->name);
+    free(output);
+  }
+  if (wooz->screencopy_manager != NULL) {
+    zwlr_screencopy_manager_v1_destroy(wooz->screencopy_manager);
+  }
+  if (wooz->xdg_output_manager != NULL) {
+    zxdg_output_manager_v1_destroy(wooz->xdg_output_manager);
+  }
+  if (wooz->shm != NULL) {
+    wl_shm_destroy(wooz->shm);
+  }
+  wl_registry_destroy(wooz->registry);
+  wl_proxy_wrapper_destroy(wooz->display_wrapper);
+  free(wooz);
+}
+
+LIBWOOZ_EXPORT size_t libwooz_get_output_count(const struct libwooz *wooz) {
+  return wooz->n_outputs;
+}
+
+LIBWOOZ_EXPORT struct libwooz_output *libwooz_get_output(struct libwooz *wooz,
+                                                         size_t index) {
+  struct libwooz_output *output;
+  wl_list_for_each(output, &wooz->outputs, link) {
+    if (index-- == 0) {
+      return output;
+    }
+  }
+  return NULL;
+}
+
+LIBWOOZ_EXPORT struct libwooz_output *
+libwooz_find_output(struct libwooz *wooz, const char *name) {
+  struct libwooz_output *output;
+  wl_list_for_each(output, &wooz->outputs, link) {
+    if (output->name != NULL && strcmp(output->name, name) == 0) {
+      return output;
+    }
+  }
+  return NULL;
+}
+
+LIBWOOZ_EXPORT const char *
+libwooz_output_get_name(const struct libwooz_output *output) {
+  return output->name;
+}
+
+LIBWOOZ_EXPORT struct wl_output *
+libwooz_output_get_wl_output(const struct libwooz_output *output) {
+  return output->wl_output;
+}
+
+LIBWOOZ_EXPORT enum wl_output_transform
+libwooz_output_get_transform(const struct libwooz_output *output) {
+  return output->transform;
+}
+
+LIBWOOZ_EXPORT void libwooz_output_get_size(const struct libwooz_output *output,
+                                            int32_t *width, int32_t *height) {
+  bool rotated = output->transform & WL_OUTPUT_TRANSFORM_90;
+  *width = rotated ? output->mode_height : output->mode_width;
+  *height = rotated ? output->mode_width : output->mode_height;
+}
+
+LIBWOOZ_EXPORT void
+libwooz_output_get_logical_geometry(const struct libwooz_output *output,
+                                    int32_t *x, int32_t *y, int32_t *width,
+                                    int32_t *height) {
+  *x = output->logical_geometry.x;
+  *y = output->logical_geometry.y;
+  *width = output->logical_geometry.width;
+  *height = output->logical_geometry.height;
+}
+
+static struct wooz_buffer *capture_buffer(void *data,
+                                          const struct wooz_shm_offer *offer) {
+  struct libwooz_capture *capture = data;
+  if (!offer->valid) {
+    return NULL;
+  }
+  capture->buffer = create_buffer(capture->output->wooz->shm, offer->format,
+                                  offer->width, offer->height, offer->stride);
+  return capture->buffer;
+}
+
+static void capture_ready(void *data) {
+  struct libwooz_capture *capture = data;
+  capture->done = true;
+}
+
+static void capture_failed(void *data) {
+  struct libwooz_capture *capture = data;
+  capture->failed = true;
+}
+
+static const struct wooz_screencopy_handler capture_handler = {
+    .buffer = capture_buffer,
+    .ready = capture_ready,
+    .failed = capture_failed,
+};
+
+LIBWOOZ_EXPORT struct libwooz_capture *
+libwooz_capture_output(struct libwooz_output *output, bool overlay_cursor) {
+  struct libwooz *wooz = output->wooz;
+  if (output->removed) {
+    return NULL;
+  }
+  struct libwooz_capture *capture = calloc(1, sizeof(struct libwooz_capture));
+  if (capture == NULL) {
+    return NULL;
+  }
+  capture->output = output;
+  screencopy_start(&capture->copy,
+                   zwlr_screencopy_manager_v1_capture_output(
+                       wooz->screencopy_manager, overlay_cursor,
+                       output->wl_output),
+                   false, &capture_handler, capture);
+
+  // Don't wait on the frame of an output removed meanwhile.
+  while (!capture->done && !capture->failed) {
+    if (dispatch(wooz) < 0 || output->removed) {
+      capture->failed = true;
+    }
+  }
+  screencopy_cancel(&capture->copy);
+
+  if (capture->failed) {
+    libwooz_capture_destroy(capture);
+    return NULL;
+  }
+  return capture;
+}
+
+LIBWOOZ_EXPORT void libwooz_capture_destroy(struct libwooz_capture *capture) {
+  if (capture == NULL) {
+    return;
+  }
+  destroy_buffer(capture->buffer);
+  free(capture);
+}
+
+LIBWOOZ_EXPORT const void *
+libwooz_capture_get_data(const struct libwooz_capture *capture,
+                         int32_t *width, int32_t *height, int32_t *stride,
+                         enum wl_shm_format *format) {
+  const struct wooz_buffer *buffer = capture->buffer;
+  *width = buffer->width;
+  *height = buffer->height;
+  *stride = buffer->stride;
+  *format = buffer->format;
+  return buffer->data;
+}
+
+LIBWOOZ_EXPORT struct wl_buffer *
+libwooz_capture_get_wl_buffer(const struct libwooz_capture *capture) {
+  return capture->buffer->wl_buffer;
+}
+
+LIBWOOZ_EXPORT bool libwooz_view_zoom(struct libwooz_view *view, double ratio,
+                                      double window_width,
+                                      double window_height, double change,
+                                      double center_x, double center_y) {
+  struct wooz_boxf box = {view->x, view->y, view->width, view->height};
+  if (!view_zoom(&box, ratio, window_width, window_height, change, center_x,
+                 center_y)) {
+    return false;
+  }
+  *view = (struct libwooz_view){box.x, box.y, box.width, box.height};
+  return true;
+}
+
+LIBWOOZ_EXPORT void libwooz_view_clamp(struct libwooz_view *view,
+                                       double ratio, double width,
+                                       double height) {
+  struct wooz_boxf box = {view->x, view->y, view->width, view->height};
+  view_clamp(&box, ratio, width, height);
+  *view = (struct libwooz_view){box.x, box.y, box.width, box.height};
+}
@@ -1,18 +1,44 @@
 #include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
 #include <linux/input-event-codes.h>
-#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <time.h>
 #include <unistd.h>
+#include <wayland-cursor.h>
 
 #include "buffer.h"
+#include "event-loop.h"
+#include "history.h"
+#include "image.h"
+#include "input-log.h"
+#include "kernels.h"
 #include "output-layout.h"
+#include "predict.h"
+#include "publish.h"
+#include "record.h"
+#include "sat.h"
+#include "scale.h"
+#include "screencopy.h"
+#include "stats.h"
+#include "stream.h"
+#include "tiers.h"
+#include "tiles.h"
+#include "view.h"
 #include "wooz.h"
+#include "worker.h"
 
+#include "ext-image-capture-source-v1-protocol.h"
+#include "ext-image-copy-capture-v1-protocol.h"
+#include "presentation-time-protocol.h"
 #include "viewporter-protocol.h"
+#include "wlr-layer-shell-unstable-v1-protocol.h"
 #include "wlr-screencopy-unstable-v1-protocol.h"
 #include "xdg-output-unstable-v1-protocol.h"
 #include "xdg-shell-protocol.h"
@@ -23,6 +49,7 @@
 #define KEY_MINUS 12
 #define KEY_EQUAL 13
 #define KEY_Q 16
+#define KEY_D 32
 #define KEY_X 45
 #define KEY_KPMINUS 74
 #define KEY_KPPLUS 78
@@ -35,194 +62,2059 @@
 #define min(x, y) (x < y ? x : y)
 #define max(x, y) (x > y ? x : y)
 
-#define MAX_SCROLL 16
 #define DOUBLE_CLICK_TIME_MS 400
 #define KEYBOARD_PAN_STEP 50.0
 #define KEYBOARD_ZOOM_STEP 10.0
 #define KEY_REPEAT_DELAY_MS 500
 #define KEY_REPEAT_RATE_MS 50
+#define LENS_DEFAULT_ZOOM 2.0
+#define LENS_MAX_ZOOM 64.0
+#define LENS_KEYBOARD_ZOOM_STEP 1.25
+#define WINDOW_MAX_BUFFERS 3
+#define GRID_MIN_CELL 8.0          // Smallest on-screen pixel size with a grid
+#define GRID_LINE_COLOR 0x60000000 // Premultiplied ARGB8888
+#define GRID_MAX_BUFFERS 2
+#define CURSOR_DEFAULT_SIZE 24
+#define REFRESH_MIN_CHANGE 0.01 // Changed screen fraction worth speeding up for
+#define REFRESH_BACKOFF 1.25    // Interval growth when nothing changed
+#define PREDICT_SETTLE_MS 20 // Pointer resting once motion stops this long
+#define PREDICT_DEFAULT_REFRESH_MHZ 60000
+#define OUTPUT_CHANGE_RETRY_MS 16
+#define OUTPUT_CHANGE_FAILED_RETRY_MS 500 // Frames fail during modesets
+
+static void count_event(struct wooz_state *state,
+                        enum wooz_stats_listener listener) {
+  state->stats.events[listener]++;
+}
+
+// All commits go through here to be counted, whatever surface they are for.
+static void commit_surface(struct wooz_state *state,
+                           struct wl_surface *surface) {
+  wl_surface_commit(surface);
+  state->stats.commits++;
+}
+
+// Whether outputs are captured, or replaced by an image or input frames.
+static bool uses_capture(const struct wooz_state *state) {
+  return state->image == NULL && state->stream == NULL;
+}
+
+// Transform of the content of window buffers. Pre-rotated captures, images
+// and input frames are upright.
+static enum wl_output_transform
+content_transform(const struct wooz_output *output) {
+  return output->raw_buffer != NULL || !uses_capture(output->state)
+             ? WL_OUTPUT_TRANSFORM_NORMAL
+             : output->transform;
+}
+
+// The capture shown for output: the last one, its visual diff or an older
+// snapshot.
+static struct wooz_buffer *shown_capture(const struct wooz_output *output) {
+  if (output->history_age > 0) {
+    return output->history_buffer;
+  }
+  return output->show_diff ? output->diff_buffer : output->buffer;
+}
+
+// Buffers that may be shown keep their fd to be published.
+static struct wooz_buffer *create_shown_buffer(struct wooz_state *state,
+                                               enum wl_shm_format format,
+                                               int32_t width, int32_t height,
+                                               int32_t stride) {
+  if (state->publisher != NULL) {
+    return create_buffer_with_fd(state->shm, format, width, height, stride);
+  }
+  return create_buffer(state->shm, format, width, height, stride);
+}
+
+// Reuse the buffer in slot for a capture of the given layout, or replace it.
+// Returns NULL if it couldn't be created.
+static struct wooz_buffer *prepare_shown_buffer(struct wooz_state *state,
+                                                struct wooz_buffer **slot,
+                                                enum wl_shm_format format,
+                                                int32_t width, int32_t height,
+                                                int32_t stride) {
+  struct wooz_buffer *buffer = *slot;
+  if (buffer != NULL && !buffer->busy && buffer->format == format &&
+      buffer->width == width && buffer->height == height &&
+      buffer->stride == stride) {
+    return buffer;
+  }
+  if (buffer != NULL &&
+      reshape_buffer(buffer, format, width, height, stride)) {
+    return buffer;
+  }
+
+  destroy_buffer(buffer);
+  *slot = create_shown_buffer(state, format, width, height, stride);
+  if (*slot == NULL) {
+    fprintf(stderr, "failed to create buffer\n");
+  }
+  return *slot;
+}
+
+static double lens_initial_zoom(struct wooz_config *config) {
+  if (config->initial_zoom > 0.0) {
+    return 1.0 / (1.0 - config->initial_zoom);
+  }
+  return LENS_DEFAULT_ZOOM;
+}
+
+// The view a window of output starts with, also restored by unzooming.
+static struct wooz_boxf initial_view_source(const struct wooz_state *state,
+                                            const struct wooz_output *output) {
+  if (state->image != NULL) {
+    // One image pixel per output pixel, centered. Fitting the whole image
+    // would decode all of it.
+    int32_t width, height;
+    image_get_size(state->image, &width, &height);
+    return (struct wooz_boxf){
+        .x = (width - output->geometry.width) / 2.0,
+        .y = (height - output->geometry.height) / 2.0,
+        .width = (double)output->geometry.width,
+        .height = (double)output->geometry.height,
+    };
+  } else if (state->stream != NULL) {
+    return (struct wooz_boxf){
+        .width = state->stream->width,
+        .height = state->stream->height,
+    };
+  }
+  return (struct wooz_boxf){
+      .x = (double)output->geometry.x,
+      .y = (double)output->geometry.y,
+      .width = (double)output->geometry.width,
+      .height = (double)output->geometry.height,
+  };
+}
+
+// Start over from the initial view after the output geometry changed.
+static void reset_window_view(struct wooz_window *win) {
+  win->view_source = initial_view_source(win->state, win->output);
+  win->initial_view_source = win->view_source;
+  if (win->grid_viewport != NULL) {
+    wp_viewport_set_destination(win->grid_viewport,
+                                win->output->logical_geometry.width,
+                                win->output->logical_geometry.height);
+  }
+}
+
+static void restore_view(struct wooz_window *win) {
+  win->view_source = win->initial_view_source;
+  win->predict_dx = 0;
+  win->predict_dy = 0;
+  win->lens_zoom = lens_initial_zoom(&win->state->config);
+}
+
+static void apply_lens_zoom(struct wooz_window *win, double factor) {
+  win->lens_zoom = max(min(win->lens_zoom * factor, LENS_MAX_ZOOM), 1.0);
+}
+
+// Update pointer position from lens surface local coordinates and center the
+// lens on it. Surface coordinates are relative to the committed position, the
+// lens may have moved since without being rendered.
+static void lens_track_pointer(struct wooz_window *win, double sx, double sy) {
+  win->pointer_x = win->lens_committed_x + sx;
+  win->pointer_y = win->lens_committed_y + sy;
+  win->lens_x = (int32_t)(win->pointer_x - win->configure.width / 2.0);
+  win->lens_y = (int32_t)(win->pointer_y - win->configure.height / 2.0);
+}
+
+static struct wooz_buffer *get_window_buffer(struct wooz_window *win) {
+  struct wooz_output *output = win->output;
+
+  // Fullscreen windows may be left to pick their size.
+  int32_t width = win->configure.width != 0 ? win->configure.width
+                                            : output->logical_geometry.width;
+  int32_t height = win->configure.height != 0
+                       ? win->configure.height
+                       : output->logical_geometry.height;
+  width = (int32_t)(width * output->logical_scale + 0.5);
+  height = (int32_t)(height * output->logical_scale + 0.5);
+
+  for (int i = 0; i < WINDOW_MAX_BUFFERS; i++) {
+    struct wooz_buffer *buffer = win->buffers[i];
+    if (buffer != NULL && buffer->busy) {
+      continue;
+    }
+    if (buffer != NULL &&
+        (buffer->width != width || buffer->height != height)) {
+      destroy_buffer(buffer);
+      buffer = NULL;
+    }
+    if (buffer == NULL) {
+      // Images are decoded to XRGB8888, lenses copy the capture format.
+      enum wl_shm_format format = win->state->image != NULL
+                                      ? WL_SHM_FORMAT_XRGB8888
+                                      : output->buffer->format;
+      int32_t bpp = shm_format_bytes_per_pixel(format);
+      buffer = create_shown_buffer(win->state, format, width, height,
+                                   width * bpp);
+      if (buffer == NULL) {
+        fprintf(stderr, "failed to create window buffer\n");
+        exit(EXIT_FAILURE);
+      }
+      win->buffers[i] = buffer;
+    }
+    return buffer;
+  }
+
+  return NULL;
+}
+
+static void destroy_window_buffers(struct wooz_window *win) {
+  struct wooz_state *state = win->state;
+  if (state->record.window == win && state->record.buffer != NULL) {
+    state->record.buffer = NULL;
+    state->record.dirty = false;
+  }
+  for (int i = 0; i < WINDOW_MAX_BUFFERS; i++) {
+    destroy_buffer(win->buffers[i]);
+    win->buffers[i] = NULL;
+  }
+}
+
+static void render_window(struct wooz_window *win);
+static void update_detail(struct wooz_window *win);
+static bool create_window(struct wooz_state *state,
+                          struct wooz_output *output);
+static void handle_output_change(void *data);
+static void destroy_window(struct wooz_window *win);
+static void destroy_output(struct wooz_output *output);
+
+static void frame_handle_done(void *data, struct wl_callback *callback,
+                              uint32_t time) {
+  struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_FRAME_CALLBACK);
+
+  wl_callback_destroy(callback);
+  win->frame_callback = NULL;
+
+  if (win->needs_render) {
+    win->needs_render = false;
+    render_window(win);
+  }
+}
+
+static const struct wl_callback_listener frame_listener = {
+    .done = frame_handle_done,
+};
+
+static struct wooz_buffer *get_grid_buffer(struct wooz_window *win,
+                                           int32_t width, int32_t height) {
+  for (int i = 0; i < GRID_MAX_BUFFERS; i++) {
+    struct wooz_buffer *buffer = win->grid_buffers[i];
+    if (buffer != NULL && buffer->busy) {
+      continue;
+    }
+    if (buffer != NULL &&
+        (buffer->width != width || buffer->height != height)) {
+      destroy_buffer(buffer);
+      buffer = NULL;
+    }
+    if (buffer == NULL) {
+      buffer = create_buffer(win->state->shm, WL_SHM_FORMAT_ARGB8888, width,
+                             height, width * 4);
+      win->grid_buffers[i] = buffer;
+    }
+    return buffer;
+  }
+
+  return NULL;
+}
+
+static void destroy_grid_buffers(struct wooz_window *win) {
+  for (int i = 0; i < GRID_MAX_BUFFERS; i++) {
+    destroy_buffer(win->grid_buffers[i]);
+    win->grid_buffers[i] = NULL;
+  }
+}
+
+// Draw lines every cell_x columns and cell_y rows, starting at the top-left
+// corner.
+static void draw_grid(struct wooz_buffer *buffer, double cell_x,
+                      double cell_y) {
+  uint8_t *data = buffer->data;
+  size_t row_size = (size_t)buffer->width * sizeof(uint32_t);
+
+  // Rows without an horizontal line all share the same vertical lines.
+  uint32_t *pattern = calloc(buffer->width, sizeof(uint32_t));
+  if (pattern == NULL) {
+    return;
+  }
+  for (double x = 0; x < buffer->width; x += cell_x) {
+    pattern[(int32_t)x] = GRID_LINE_COLOR;
+  }
+
+  double next_line = 0;
+  for (int32_t y = 0; y < buffer->height; y++) {
+    uint32_t *row = (uint32_t *)(data + (size_t)y * buffer->stride);
+    if (y == (int32_t)next_line) {
+      for (int32_t x = 0; x < buffer->width; x++) {
+        row[x] = GRID_LINE_COLOR;
+      }
+      next_line += cell_y;
+    } else {
+      memcpy(row, pattern, row_size);
+    }
+  }
+
+  free(pattern);
+}
+
+// Keep the pixel grid subsurface in sync with view_source. The grid is only
+// redrawn when the on-screen pixel size changes, panning moves it through its
+// viewport. The parent commit applies the change.
+static void update_grid(struct wooz_window *win) {
+  struct wooz_output *output = win->output;
+  if (win->grid_surface == NULL) {
+    return;
+  }
+
+  double width = output->logical_geometry.width * output->logical_scale;
+  double height = output->logical_geometry.height * output->logical_scale;
+  double cell_x = width / win->view_source.width;
+  double cell_y = height / win->view_source.height;
+
+  if (cell_x < GRID_MIN_CELL || cell_y < GRID_MIN_CELL) {
+    if (win->grid_buffer != NULL) {
+      wl_surface_attach(win->grid_surface, NULL, 0, 0);
+      commit_surface(win->state, win->grid_surface);
+      win->grid_buffer = NULL;
+      win->grid_cell_x = win->grid_cell_y = 0;
+    }
+    return;
+  }
+
+  if (cell_x != win->grid_cell_x || cell_y != win->grid_cell_y) {
+    // One extra cell leaves room to shift the grid by the sub-pixel phase.
+    struct wooz_buffer *buffer =
+        get_grid_buffer(win, (int32_t)ceil(width + cell_x),
+                        (int32_t)ceil(height + cell_y));
+    // Keep the previous grid if the compositor still holds every buffer, the
+    // next render retries.
+    if (buffer != NULL) {
+      draw_grid(buffer, cell_x, cell_y);
+      wl_surface_attach(win->grid_surface, buffer->wl_buffer, 0, 0);
+      wl_surface_damage_buffer(win->grid_surface, 0, 0, INT32_MAX,
+                               INT32_MAX);
+      buffer->busy = true;
+      win->grid_buffer = buffer;
+      win->grid_cell_x = cell_x;
+      win->grid_cell_y = cell_y;
+    }
+  }
+  if (win->grid_buffer == NULL) {
+    return;
+  }
+
+  // The first pixel boundary is offset by the fraction of the pixel already
+  // scrolled past.
+  double phase_x =
+      (win->view_source.x - floor(win->view_source.x)) * win->grid_cell_x;
+  double phase_y =
+      (win->view_source.y - floor(win->view_source.y)) * win->grid_cell_y;
+  wp_viewport_set_source(win->grid_viewport, wl_fixed_from_double(phase_x),
+                         wl_fixed_from_double(phase_y),
+                         wl_fixed_from_double(width),
+                         wl_fixed_from_double(height));
+  commit_surface(win->state, win->grid_surface);
+}
+
+// Themes are loaded once per output scale, cursor images are then scaled by
+// the viewport of the cursor subsurface.
+static struct wl_cursor_theme *get_cursor_theme(struct wooz_state *state,
+                                                int32_t scale) {
+  size_t n = state->n_cursor_themes;
+  for (size_t i = 0; i < n; i++) {
+    if (state->cursor_themes[i].scale == scale) {
+      return state->cursor_themes[i].theme;
+    }
+  }
+  if (n == WOOZ_MAX_CURSOR_THEMES) {
+    return state->cursor_themes[n - 1].theme;
+  }
+
+  const char *size_env = getenv("XCURSOR_SIZE");
+  int size = size_env != NULL ? atoi(size_env) : 0;
+  if (size <= 0) {
+    size = CURSOR_DEFAULT_SIZE;
+  }
+  struct wl_cursor_theme *theme =
+      wl_cursor_theme_load(getenv("XCURSOR_THEME"), size * scale, state->shm);
+  if (theme == NULL) {
+    return NULL;
+  }
+
+  state->cursor_themes[n].scale = scale;
+  state->cursor_themes[n].theme = theme;
+  state->n_cursor_themes++;
+  return theme;
+}
+
+static void hide_cursor(struct wooz_window *win) {
+  if (win->cursor_image == NULL) {
+    return;
+  }
+  wl_surface_attach(win->cursor_surface, NULL, 0, 0);
+  commit_surface(win->state, win->cursor_surface);
+  win->cursor_image = NULL;
+  win->cursor_width = win->cursor_height = 0;
+}
+
+// Move the magnified cursor subsurface to the pointer. The cursor image is
+// only attached once, zoom changes only update its viewport. The parent
+// commit applies the change.
+static void update_cursor(struct wooz_window *win) {
+  struct wooz_output *output = win->output;
+  if (win->cursor_surface == NULL || !win->is_focused) {
+    return;
+  }
+
+  int32_t scale = output->scale > 0 ? output->scale : 1;
+  bool changed = false;
+  if (win->cursor_image == NULL) {
+    struct wl_cursor_theme *theme = get_cursor_theme(win->state, scale);
+    struct wl_cursor *cursor = NULL;
+    if (theme != NULL) {
+      cursor = wl_cursor_theme_get_cursor(theme, "default");
+      if (cursor == NULL) {
+        cursor = wl_cursor_theme_get_cursor(theme, "left_ptr");
+      }
+    }
+    if (cursor == NULL || cursor->image_count == 0) {
+      return;
+    }
+
+    win->cursor_image = cursor->images[0];
+    wl_surface_attach(win->cursor_surface,
+                      wl_cursor_image_get_buffer(win->cursor_image), 0, 0);
+    wl_surface_damage_buffer(win->cursor_surface, 0, 0, INT32_MAX,
+                             INT32_MAX);
+    changed = true;
+  }
+
+  // The cursor covers as many captured pixels as it would unzoomed.
+  double zoom = output->logical_geometry.width * output->logical_scale /
+                win->view_source.width;
+  double factor = zoom / scale;
+  struct wl_cursor_image *image = win->cursor_image;
+
+  int32_t width = max((int32_t)(image->width * factor + 0.5), 1);
+  int32_t height = max((int32_t)(image->height * factor + 0.5), 1);
+  if (width != win->cursor_width || height != win->cursor_height) {
+    wp_viewport_set_destination(win->cursor_viewport, width, height);
+    win->cursor_width = width;
+    win->cursor_height = height;
+    changed = true;
+  }
+  if (changed) {
+    commit_surface(win->state, win->cursor_surface);
+  }
+
+  wl_subsurface_set_position(
+      win->cursor_subsurface,
+      (int32_t)(win->pointer_x - image->hotspot_x * factor),
+      (int32_t)(win->pointer_y - image->hotspot_y * factor));
+}
+
+static void apply_zoom(struct wooz_window *win, double zoom_change,
+                       double center_x, double center_y) {
+  struct wooz_output *output = win->output;
+  view_zoom(&win->view_source, output->ratio, output->logical_geometry.width,
+            output->logical_geometry.height, zoom_change, center_x, center_y);
+}
+
+// Let --publish readers see what win shows: view of buffer, stored with
+// transform. It is also the next --record frame if win is recorded.
+static void publish_view(struct wooz_window *win,
+                         const struct wooz_buffer *buffer,
+                         enum wl_output_transform transform,
+                         const struct wooz_boxf *view) {
+  struct wooz_state *state = win->state;
+  if (state->publisher != NULL) {
+    publisher_publish(state->publisher, buffer, transform, view,
+                      win->output->name);
+  }
+  if (state->record.window == win) {
+    // Captures may be replaced before the frame is taken, only buffers of
+    // the window are kept.
+    state->record.buffer =
+        buffer == shown_capture(win->output) ? NULL : buffer;
+    state->record.transform = transform;
+    state->record.view = *view;
+    state->record.dirty = true;
+  }
+}
+
+// Take what the recorded window shows at RECORD_FPS, the last frame is
+// repeated while it doesn't change.
+static void handle_record_timer(void *data) {
+  struct wooz_state *state = data;
+  uint32_t due = recorder_frames_due(state->recorder);
+  if (due == 0) {
+    return;
+  }
+
+  struct wooz_window *win = state->record.window;
+  if (win != NULL && state->record.dirty) {
+    const struct wooz_buffer *buffer = state->record.buffer != NULL
+                                           ? state->record.buffer
+                                           : shown_capture(win->output);
+    // Dropped frames stay dirty, the view is taken again next time.
+    if (buffer != NULL &&
+        recorder_add(state->recorder, buffer, state->record.transform,
+                     &state->record.view)) {
+      state->record.dirty = false;
+      due--;
+    }
+  }
+  recorder_repeat(state->recorder, due);
+}
+
+// Record win, the recording starts with the first window at its size.
+static bool record_window(struct wooz_state *state, struct wooz_window *win) {
+  if (state->recorder == NULL) {
+    int32_t width = win->output->logical_geometry.width;
+    int32_t height = win->output->logical_geometry.height;
+    if (state->config.lens_width > 0) {
+      width = state->config.lens_width;
+      height = state->config.lens_height;
+    }
+    state->recorder = recorder_create(
+        state->event_loop, state->config.record_path, width, height);
+    if (state->recorder == NULL) {
+      fprintf(stderr, "failed to record to %s\n", state->config.record_path);
+      return false;
+    }
+    event_loop_schedule(state->event_loop, &state->record.timer, 0,
+                        1000 / RECORD_FPS);
+  }
+  state->record.window = win;
+  state->record.buffer = NULL;
+  state->record.dirty = false;
+  return true;
+}
+
+// Render into a buffer of our own: the lens region around the pointer, or the
+// visible region of the image.
+static void render_buffer(struct wooz_window *win) {
+  struct wooz_output *output = win->output;
+
+  // At most one commit per frame: defer until the compositor is done with
+  // the previous one.
+  if (win->frame_callback != NULL) {
+    win->needs_render = true;
+    return;
+  }
+
+  struct wooz_buffer *buffer = get_window_buffer(win);
+  if (buffer == NULL) {
+    // All buffers still held by the compositor, retry on next event.
+    win->needs_render = true;
+    return;
+  }
+
+  if (win->layer_surface != NULL) {
+    // Only the lens sized region around the pointer is scaled, per frame work
+    // doesn't depend on the output size.
+    struct wooz_boxf src = {
+        .width = buffer->width / win->lens_zoom,
+        .height = buffer->height / win->lens_zoom,
+    };
+    src.x = win->pointer_x * output->logical_scale - src.width / 2.0;
+    src.y = win->pointer_y * output->logical_scale - src.height / 2.0;
+    struct wooz_buffer *capture = shown_capture(output);
+    src.x = max(min(src.x, capture->width - src.width), 0);
+    src.y = max(min(src.y, capture->height - src.height), 0);
+    scale_nearest(buffer, capture, content_transform(output), &src);
+
+    zwlr_layer_surface_v1_set_margin(win->layer_surface, win->lens_y, 0, 0,
+                                     win->lens_x);
+    win->lens_committed_x = win->lens_x;
+    win->lens_committed_y = win->lens_y;
+  } else {
+    // Only tiles under the view are decoded.
+    image_render(win->state->image, buffer, &win->view_source);
+    update_grid(win);
+    update_cursor(win);
+  }
+
+  wl_surface_attach(win->surface, buffer->wl_buffer, 0, 0);
+  wl_surface_damage_buffer(win->surface, 0, 0, buffer->width, buffer->height);
+  buffer->busy = true;
+
+  win->frame_callback = wl_surface_frame(win->surface);
+  wl_callback_add_listener(win->frame_callback, &frame_listener, win);
+  commit_surface(win->state, win->surface);
+
+  struct wooz_boxf view = {.width = buffer->width, .height = buffer->height};
+  publish_view(win, buffer, WL_OUTPUT_TRANSFORM_NORMAL, &view);
+}
+
+// Views of an image keep the output aspect ratio. They may be larger than
+// the image, it is then centered.
+static void clamp_image_view(struct wooz_window *win) {
+  struct wooz_boxf *view = &win->view_source;
+  double ratio = win->output->ratio;
+  int32_t width, height;
+  image_get_size(win->state->image, &width, &height);
+
+  double max_width = max((double)width, height * ratio);
+  view->width = max(min(view->width, max_width), VIEW_MIN_SIZE * ratio);
+  view->height = view->width / ratio;
+  if (view->width >= width) {
+    view->x = (width - view->width) / 2.0;
+  } else {
+    view->x = max(min(view->x, width - view->width), 0);
+  }
+  if (view->height >= height) {
+    view->y = (height - view->height) / 2.0;
+  } else {
+    view->y = max(min(view->y, height - view->height), 0);
+  }
+}
+
+// Attach the newest complete input frame, at most one per display frame.
+static void attach_stream_frame(struct wooz_window *win) {
+  struct wooz_stream *stream = win->state->stream;
+  if (stream->ready == NULL || !win->is_configured) {
+    return;
+  }
+  if (win->frame_callback != NULL) {
+    win->needs_render = true;
+    return;
+  }
+
+  struct wooz_buffer *frame = stream_take_frame(stream);
+  win->output->buffer = frame;
+  wl_surface_attach(win->surface, frame->wl_buffer, 0, 0);
+  wl_surface_damage_buffer(win->surface, 0, 0, INT32_MAX, INT32_MAX);
+  frame->busy = true;
+
+  win->frame_callback = wl_surface_frame(win->surface);
+  wl_callback_add_listener(win->frame_callback, &frame_listener, win);
+}
+
+static void render_window(struct wooz_window *win) {
+  if (win->is_suspended) {
+    // The window isn't shown, render once it is resumed.
+    win->needs_render = true;
+    return;
+  }
+
+  if (win->layer_surface != NULL) {
+    // Outputs being recaptured after a change have no capture to sample.
+    if (win->output->buffer != NULL && win->output->changed_buffer == NULL) {
+      render_buffer(win);
+    }
+    return;
+  }
+  if (win->state->image != NULL) {
+    clamp_image_view(win);
+    render_buffer(win);
+    return;
+  }
+  if (win->state->stream != NULL) {
+    attach_stream_frame(win);
+  }
+  struct wooz_output *output = win->output;
+  if (output->buffer == NULL || output->changed_buffer != NULL) {
+    // No input frame yet, or the previous capture stays shown as it is.
+    commit_surface(win->state, win->surface);
+    return;
+  }
+
+  // Views of a downscaled capture stay in full resolution pixels.
+  int32_t width = output->buffer->width;
+  int32_t height = output->buffer->height;
+  double scale = 1.0;
+  if (output->tiers.scale > 0) {
+    width = output->geometry.width;
+    height = output->geometry.height;
+    scale = output->tiers.scale;
+  }
+
+  view_clamp(&win->view_source, output->ratio, width, height);
+
+  wp_viewport_set_source(win->viewport,
+                         wl_fixed_from_double(win->view_source.x / scale),
+                         wl_fixed_from_double(win->view_source.y / scale),
+                         wl_fixed_from_double(win->view_source.width / scale),
+                         wl_fixed_from_double(win->view_source.height / scale));
+
+  update_detail(win);
+  update_grid(win);
+  update_cursor(win);
+  commit_surface(win->state, win->surface);
+
+  struct wooz_boxf view = {
+      .x = win->view_source.x / scale,
+      .y = win->view_source.y / scale,
+      .width = win->view_source.width / scale,
+      .height = win->view_source.height / scale,
+  };
+  publish_view(win, shown_capture(output), content_transform(output), &view);
+}
+
+// Report the mean colour of the pick_size square under the pointer when it
+// changed.
+static void update_pick(struct wooz_window *win) {
+  struct wooz_state *state = win->state;
+  struct wooz_output *output = win->output;
+  struct wooz_buffer *buffer = output->buffer;
+  int32_t size = state->config.pick_size;
+
+  if (size == 0 || buffer == NULL) {
+    return;
+  }
+
+  // Pointer position in upright buffer coordinates.
+  double ux, uy;
+  if (win->layer_surface != NULL) {
+    ux = win->pointer_x * output->logical_scale;
+    uy = win->pointer_y * output->logical_scale;
+  } else {
+    ux = win->view_source.x + win->pointer_x * win->view_source.width /
+                                  output->logical_geometry.width;
+    uy = win->view_source.y + win->pointer_y * win->view_source.height /
+                                  output->logical_geometry.height;
+  }
+
+  int32_t x0 = (int32_t)ux - size / 2;
+  int32_t y0 = (int32_t)uy - size / 2;
+  int32_t x1 = x0 + size - 1;
+  int32_t y1 = y0 + size - 1;
+  x0 = max(x0, 0);
+  y0 = max(y0, 0);
+  x1 = min(x1, buffer->width - 1);
+  y1 = min(y1, buffer->height - 1);
+  if (x1 < x0 || y1 < y0) {
+    return;
+  }
+
+  // Transforms map the square to a raw buffer rectangle.
+  enum wl_output_transform transform = content_transform(output);
+  int32_t ax, ay, bx, by;
+  untransform_pixel(transform, buffer->width, buffer->height, x0, y0, &ax,
+                    &ay);
+  untransform_pixel(transform, buffer->width, buffer->height, x1, y1, &bx,
+                    &by);
+  struct wooz_box box = {
+      .x = min(ax, bx),
+      .y = min(ay, by),
+      .width = abs(bx - ax) + 1,
+      .height = abs(by - ay) + 1,
+  };
+
+  struct wooz_rgb rgb;
+  if (!region_mean(buffer, &box, &rgb)) {
+    return;
+  }
+  if (state->has_picked && rgb.r == state->picked.r &&
+      rgb.g == state->picked.g && rgb.b == state->picked.b) {
+    return;
+  }
+  state->picked = rgb;
+  state->has_picked = true;
+
+  printf("#%02x%02x%02x rgb(%d, %d, %d)\n", rgb.r, rgb.g, rgb.b, rgb.r, rgb.g,
+         rgb.b);
+  fflush(stdout);
+}
+
+static void handle_key_action(struct wooz_state *state, uint32_t key) {
+  struct wooz_window *win = state->focused;
+  if (win == NULL) {
+    return;
+  }
+
+  if (win->layer_surface != NULL) {
+    if (key == KEY_EQUAL || key == KEY_KPPLUS) {
+      apply_lens_zoom(win, LENS_KEYBOARD_ZOOM_STEP);
+    } else if (key == KEY_MINUS || key == KEY_KPMINUS) {
+      apply_lens_zoom(win, 1.0 / LENS_KEYBOARD_ZOOM_STEP);
+    } else {
+      // The lens follows the pointer, there is nothing to pan.
+      return;
+    }
+    render_window(win);
+    return;
+  }
+
+  switch (key) {
+  case KEY_EQUAL: // For keyboards where + is shift+=
+  case KEY_KPPLUS:
+    // Zoom in at center
+    apply_zoom(win, KEYBOARD_ZOOM_STEP,
+               win->output->logical_geometry.width / 2.0,
+               win->output->logical_geometry.height / 2.0);
+    render_window(win);
+    break;
+
+  case KEY_MINUS:
+  case KEY_KPMINUS:
+    // Zoom out at center
+    apply_zoom(win, -KEYBOARD_ZOOM_STEP,
+               win->output->logical_geometry.width / 2.0,
+               win->output->logical_geometry.height / 2.0);
+    render_window(win);
+    break;
+
+  case KEY_LEFT:
+    win->view_source.x -= KEYBOARD_PAN_STEP;
+    render_window(win);
+    break;
+
+  case KEY_RIGHT:
+    win->view_source.x += KEYBOARD_PAN_STEP;
+    render_window(win);
+    break;
+
+  case KEY_UP:
+    win->view_source.y -= KEYBOARD_PAN_STEP;
+    render_window(win);
+    break;
+
+  case KEY_DOWN:
+    win->view_source.y += KEYBOARD_PAN_STEP;
+    render_window(win);
+    break;
+  }
+}
+
+static void stop_key_repeat(struct wooz_state *state) {
+  event_loop_cancel(state->event_loop, &state->repeat_timer);
+  state->pressed_key = 0;
+}
+
+static void start_key_repeat(struct wooz_state *state, uint32_t key) {
+  state->pressed_key = key;
+  event_loop_schedule(state->event_loop, &state->repeat_timer,
+                      KEY_REPEAT_DELAY_MS, KEY_REPEAT_RATE_MS);
+}
+
+static void handle_key_repeat(void *data) {
+  struct wooz_state *state = data;
+  if (state->pressed_key != 0) {
+    handle_key_action(state, state->pressed_key);
+  }
+}
+
+static bool is_repeatable_key(uint32_t key) {
+  return key == KEY_EQUAL || key == KEY_KPPLUS || key == KEY_MINUS ||
+         key == KEY_KPMINUS || key == KEY_LEFT || key == KEY_RIGHT ||
+         key == KEY_UP || key == KEY_DOWN;
+}
+
+// Returns the capture target, (re)allocated to match the selected offer.
+// created is set when the buffer is new and holds no previous capture.
+static struct wooz_buffer *prepare_capture_buffer(struct wooz_output *output,
+                                                  bool *created) {
+  uint32_t format = output->capture_offer.format;
+  uint32_t width = output->capture_offer.width;
+  uint32_t height = output->capture_offer.height;
+  uint32_t stride = output->capture_offer.stride;
+
+  if (!output->capture_offer.valid) {
+    fprintf(stderr, "no supported buffer type offered for output %s\n",
+            output->name);
+    exit(EXIT_FAILURE);
+  }
+
+  // Recaptures go to the back buffer while the front one stays attached.
+  // Captures to pre-rotate go to a staging buffer instead.
+  bool pre_rotate = output->state->config.pre_rotate &&
+                    output->transform != WL_OUTPUT_TRANSFORM_NORMAL &&
+                    shm_format_bytes_per_pixel(format) != 0;
+  struct wooz_buffer **target =
+      output->recapture ? &output->back_buffer : &output->buffer;
+  if (pre_rotate) {
+    target = &output->raw_buffer;
+  } else if (output->tiers.scale > 0) {
+    // Strips are downscaled into the front buffer once copied.
+    target = &output->strip;
+  }
+
+  // Handle rotated screens.
+  bool rotated = !pre_rotate && output->transform & WL_OUTPUT_TRANSFORM_90;
+  int32_t upright_width = rotated ? height : width;
+
+  *created = *target == NULL || (*target)->format != format ||
+             (*target)->stride != (int32_t)stride ||
+             (*target)->size != (size_t)stride * height ||
+             (*target)->width != upright_width;
+  if (!*created) {
+    (*target)->sat_valid = false;
+    return *target;
+  }
+
+  // The output mode or transform changed, reuse the memory if it fits.
+  if (*target != NULL &&
+      !reshape_buffer(*target, format, width, height, stride)) {
+    destroy_buffer(*target);
+    *target = NULL;
+  }
+  if (*target == NULL) {
+    *target =
+        create_shown_buffer(output->state, format, width, height, stride);
+    if (*target == NULL) {
+      fprintf(stderr, "failed to create buffer\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (rotated) {
+    (*target)->width = height;
+    (*target)->height = width;
+  }
+
+  return *target;
+}
+
+static void add_capture_damage(struct wooz_output *output, int32_t x,
+                               int32_t y, int32_t width, int32_t height) {
+  struct wooz_box *box =
+      wl_array_add(&output->capture_damage, sizeof(struct wooz_box));
+  if (box != NULL) {
+    *box = (struct wooz_box){
+        .x = x,
+        .y = y,
+        .width = width,
+        .height = height,
+    };
+  }
+}
+
+static bool uses_image_copy_capture(struct wooz_state *state) {
+  return state->image_copy_manager != NULL &&
+         state->output_source_manager != NULL;
+}
+
+// Whether recaptures come with damage from the compositor.
+static bool capture_reports_damage(struct wooz_state *state) {
+  return uses_image_copy_capture(state) ||
+         zwlr_screencopy_manager_v1_get_version(state->screencopy_manager) >=
+             ZWLR_SCREENCOPY_FRAME_V1_COPY_WITH_DAMAGE_SINCE_VERSION;
+}
+
+// Whether a capture is requested, copied or processed.
+static bool capture_in_flight(struct wooz_output *output) {
+  return output->screencopy.frame != NULL ||
+         output->image_copy_frame != NULL || output->capture_pending ||
+         (output->worker != NULL && worker_is_busy(output->worker));
+}
+
+// Returns the buffer the staging capture is rotated upright into: the front
+// buffer, or the back one for recaptures.
+static struct wooz_buffer *prepare_upright_buffer(struct wooz_output *output) {
+  struct wooz_buffer *raw = output->raw_buffer;
+  struct wooz_buffer **target =
+      output->recapture ? &output->back_buffer : &output->buffer;
+
+  int32_t bpp = shm_format_bytes_per_pixel(raw->format);
+  int32_t width = raw->width, height = raw->height;
+  if (output->transform & WL_OUTPUT_TRANSFORM_90) {
+    width = raw->height;
+    height = raw->width;
+  }
+
+  if (*target != NULL &&
+      ((*target)->format != raw->format || (*target)->width != width ||
+       (*target)->height != height) &&
+      !reshape_buffer(*target, raw->format, width, height, width * bpp)) {
+    destroy_buffer(*target);
+    *target = NULL;
+  }
+  if (*target == NULL) {
+    *target = create_shown_buffer(output->state, raw->format, width, height,
+                                  width * bpp);
+    if (*target == NULL) {
+      fprintf(stderr, "failed to create buffer\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  (*target)->sat_valid = false;
+  return *target;
+}
+
+// Map a damage box of the staging capture to the upright buffer.
+static struct wooz_box upright_damage(const struct wooz_output *output,
+                                      const struct wooz_box *box) {
+  const struct wooz_buffer *raw = output->raw_buffer;
+
+  // Going back from raw to upright applies the inverse transform, only
+  // 90 and 270 degrees rotations aren't their own inverse.
+  enum wl_output_transform inverse = output->transform;
+  if (inverse == WL_OUTPUT_TRANSFORM_90) {
+    inverse = WL_OUTPUT_TRANSFORM_270;
+  } else if (inverse == WL_OUTPUT_TRANSFORM_270) {
+    inverse = WL_OUTPUT_TRANSFORM_90;
+  }
+
+  int32_t ax, ay, bx, by;
+  untransform_pixel(inverse, raw->width, raw->height, box->x, box->y, &ax,
+                    &ay);
+  untransform_pixel(inverse, raw->width, raw->height,
+                    box->x + box->width - 1, box->y + box->height - 1, &bx,
+                    &by);
+  return (struct wooz_box){
+      .x = min(ax, bx),
+      .y = min(ay, by),
+      .width = abs(bx - ax) + 1,
+      .height = abs(by - ay) + 1,
+  };
+}
+
+// Find the tiles of the capture that changed since the front buffer.
+static void diff_capture(const struct wooz_buffer *front,
+                         struct wooz_capture_work *work) {
+  struct wooz_buffer *back = work->target;
+  if (!update_tile_hashes(back) || front->tile_hashes == NULL ||
+      front->tile_cols != back->tile_cols ||
+      front->tile_rows != back->tile_rows) {
+    return;
+  }
+
+  size_t n_tiles = (size_t)back->tile_cols * back->tile_rows;
+  work->changed = calloc(n_tiles, sizeof(bool));
+  if (work->changed != NULL) {
+    work->n_changed = diff_tile_hashes(front, back, work->changed);
+  }
+}
+
+// Present a recapture damaging only the tiles that changed since the previous
+// one. Nothing is committed if the screen didn't change. Returns the changed
+// fraction of the screen.
+static double present_capture(struct wooz_output *output) {
+  struct wooz_buffer *front = output->buffer;
+  struct wooz_buffer *back = output->back_buffer;
+  struct wooz_capture_work *work = &output->capture_work;
+
+  // Damage reported by the compositor saves hashing the whole capture.
+  bool has_damage = output->capture_damage.size > 0;
+
+  double fraction = 1.0;
+  if (has_damage) {
+    double area = 0;
+    struct wooz_box *box;
+    wl_array_for_each(box, &output->capture_damage) {
+      area += (double)box->width * box->height;
+    }
+    fraction = min(area / ((double)back->width * back->height), 1.0);
+  }
+
+  bool *changed = work->changed;
+  work->changed = NULL;
+  if (changed != NULL) {
+    if (work->n_changed == 0) {
+      free(changed);
+      return 0.0;
+    }
+    fraction = (double)work->n_changed / (back->tile_cols * back->tile_rows);
+  }
+
+  output->buffer = back;
+  output->back_buffer = front;
+
+  struct wooz_window *win;
+  wl_list_for_each(win, &output->state->windows, link) {
+    if (win->output != output || !win->is_configured) {
+      continue;
+    }
+
+    // The lens samples the front buffer on its next render.
+    if (win->layer_surface == NULL) {
+      wl_surface_attach(win->surface, back->wl_buffer, 0, 0);
+      if (has_damage) {
+        struct wooz_box *box;
+        wl_array_for_each(box, &output->capture_damage) {
+          struct wooz_box damage = *box;
+          if (output->raw_buffer != NULL) {
+            damage = upright_damage(output, box);
+          }
+          wl_surface_damage_buffer(win->surface, damage.x, damage.y,
+                                   damage.width, damage.height);
+        }
+      } else if (changed != NULL) {
+        damage_tiles(win->surface, back, changed);
+      } else {
+        wl_surface_damage_buffer(win->surface, 0, 0, INT32_MAX, INT32_MAX);
+      }
+      back->busy = true;
+    }
+    render_window(win);
+    if (win == output->state->focused) {
+      update_pick(win);
+    }
+  }
+
+  free(changed);
+  return fraction;
+}
+
+static void schedule_refresh(struct wooz_output *output) {
+  // Recaptures after output changes don't start refreshing.
+  if (output->state->config.refresh_ms == 0) {
+    return;
+  }
+  event_loop_schedule(output->state->event_loop, &output->refresh_timer,
+                      (uint32_t)output->refresh_interval, 0);
+}
+
+// Adapt the next recapture delay to how much the screen changed, within the
+// --refresh bounds.
+static void adapt_refresh_interval(struct wooz_output *output,
+                                   double changed) {
+  struct wooz_config *config = &output->state->config;
+  if (config->refresh_max_ms == 0) {
+    return;
+  }
+
+  // Capturing faster than the output refreshes can't bring anything new, nor
+  // can requesting captures faster than they complete.
+  double lower = config->refresh_ms;
+  if (output->refresh_mhz > 0 && 1e6 / output->refresh_mhz > lower) {
+    lower = 1e6 / output->refresh_mhz;
+  }
+  // Captures reporting damage wait for it, their latency isn't a cost.
+  double latency = output->capture_stats.last / 1e6;
+  if (!capture_reports_damage(output->state) && latency > lower) {
+    lower = latency;
+  }
+  double upper = max(config->refresh_max_ms, lower);
+
+  // Back off on a static screen, catch up quickly once it changes and leave
+  // small changes like a blinking caret alone.
+  double interval = output->refresh_interval;
+  if (changed == 0.0) {
+    interval *= REFRESH_BACKOFF;
+  } else if (changed >= REFRESH_MIN_CHANGE) {
+    interval /= 2;
+  }
+  output->refresh_interval = max(min(interval, upper), lower);
+}
+
+// Runs on the output worker thread: it only touches pixels and tile hashes
+// of buffers the event loop leaves alone until finish_capture().
+static void process_capture(void *data) {
+  struct wooz_output *output = data;
+  struct wooz_capture_work *work = &output->capture_work;
+
+  if (output->raw_buffer != NULL) {
+    rotate_buffer(work->target, output->raw_buffer, work->transform);
+  }
+  if (work->hash) {
+    update_tile_hashes(work->target);
+  }
+  if (work->diff) {
+    diff_capture(output->buffer, work);
+  }
+  if (work->visual_diff != NULL &&
+      !diff_buffers(work->visual_diff, output->buffer, work->target,
+                    &work->n_different)) {
+    work->visual_diff = NULL;
+  }
+}
+
+// Show the whole capture of output again, once replaced or toggled.
+// Unconfigured windows attach it when configured.
+static void attach_capture(struct wooz_output *output) {
+  struct wooz_buffer *buffer = shown_capture(output);
+  struct wooz_window *win;
+  wl_list_for_each(win, &output->state->windows, link) {
+    if (win->output != output || !win->is_configured) {
+      continue;
+    }
+    // The lens samples the shown capture on its next render.
+    if (win->layer_surface == NULL) {
+      wl_surface_attach(win->surface, buffer->wl_buffer, 0, 0);
+      wl_surface_damage_buffer(win->surface, 0, 0, INT32_MAX, INT32_MAX);
+      buffer->busy = true;
+    }
+    render_window(win);
+  }
+}
+
+// Show the diff of a recapture against the previous capture. The recapture
+// becomes the capture, the next diff is made against it.
+static void show_diff(struct wooz_output *output) {
+  struct wooz_capture_work *work = &output->capture_work;
+  free(work->changed);
+  work->changed = NULL;
+
+  struct wooz_buffer *front = output->buffer;
+  output->buffer = output->back_buffer;
+  output->back_buffer = front;
+  output->show_diff = true;
+  attach_capture(output);
+
+  printf("%zu pixels differ on output %s\n", work->n_different,
+         output->name != NULL ? output->name : "");
+  fflush(stdout);
+}
+
+// Keep the capture of output as the newest snapshot of --history.
+static void push_history(struct wooz_output *output) {
+  struct wooz_state *state = output->state;
+  if (state->config.history_size == 0) {
+    return;
+  }
+  if (output->history == NULL) {
+    output->history = history_create(state->config.history_size);
+  }
+  if (output->history == NULL ||
+      !history_push(output->history, output->buffer)) {
+    fprintf(stderr, "failed to keep a snapshot of output %s\n",
+            output->name);
+  }
+}
+
+// The history buffer a snapshot is restored to, the other one may be shown.
+static struct wooz_buffer **history_spare(struct wooz_output *output) {
+  int shown = output->history_buffers[0] == output->history_buffer ? 0 : 1;
+  return &output->history_buffers[1 - shown];
+}
+
+// Show the snapshot step captures older than the shown one, newer if step is
+// negative. Refreshing resumes once back to the capture.
+static void step_history(struct wooz_output *output, int step) {
+  struct wooz_state *state = output->state;
+  struct wooz_history *history = output->history;
+  if (history == NULL || history->count == 0 || output->buffer == NULL) {
+    return;
+  }
+  if (capture_in_flight(output)) {
+    // The capture in flight becomes the newest snapshot first.
+    output->history_pending += step;
+    return;
+  }
+
+  size_t age = output->history_age;
+  if (step < 0) {
+    age = (size_t)-step < age ? age - (size_t)-step : 0;
+  } else {
+    age = min(age + (size_t)step, history->count - 1);
+  }
+  if (age == output->history_age) {
+    return;
+  }
+
+  if (age == 0) {
+    output->history_age = 0;
+    attach_capture(output);
+    schedule_refresh(output);
+  } else {
+    struct wooz_buffer *buffer = prepare_shown_buffer(
+        state, history_spare(output), history->format, history->width,
+        history->height, history->stride);
+    if (buffer == NULL) {
+      return;
+    }
+    history_restore(history, history_get(history, age), buffer);
+    output->history_buffer = buffer;
+    output->history_age = age;
+    output->show_diff = false;
+    event_loop_cancel(state->event_loop, &output->refresh_timer);
+    attach_capture(output);
+  }
+
+  const struct wooz_snapshot *snapshot = history_get(history, age);
+  printf("snapshot %zu of %zu on output %s, %.1f s old\n", age,
+         history->count - 1, output->name != NULL ? output->name : "",
+         (stats_now() - snapshot->time) / 1e9);
+  fflush(stdout);
+}
+
+// A first capture of output is complete. Once running, it is the capture of
+// an output that was added or changed.
+static void capture_ready(struct wooz_output *output) {
+  struct wooz_state *state = output->state;
+  push_history(output);
+  if (!state->running) {
+    ++state->n_done;
+    return;
+  }
+
+  bool shown = false;
+  struct wooz_window *win;
+  wl_list_for_each(win, &state->windows, link) {
+    if (win->output != output) {
+      continue;
+    }
+    shown = true;
+    reset_window_view(win);
+    if (win->layer_surface == NULL) {
+      wl_surface_set_buffer_transform(win->surface, content_transform(output));
+    }
+  }
+  // The capture before the change is no longer shown once replaced.
+  struct wooz_buffer *changed = output->changed_buffer;
+  output->changed_buffer = NULL;
+  if (!shown && !create_window(state, output)) {
+    fprintf(stderr, "failed to create window for output %s\n",
+            output->name);
+    destroy_buffer(changed);
+    return;
+  }
+  attach_capture(output);
+  destroy_buffer(changed);
+
+  output->refresh_interval = state->config.refresh_ms;
+  schedule_refresh(output);
+}
+
+static void finish_capture(void *data) {
+  struct wooz_output *output = data;
+
+  if (!output->recapture) {
+    capture_ready(output);
+    return;
+  }
+  output->recapture = false;
+  if (output->capture_work.visual_diff != NULL) {
+    show_diff(output);
+    push_history(output);
+  } else {
+    double changed = present_capture(output);
+    if (changed > 0.0) {
+      push_history(output);
+    }
+    adapt_refresh_interval(output, changed);
+    schedule_refresh(output);
+  }
+
+  if (output->history_pending != 0) {
+    int step = output->history_pending;
+    output->history_pending = 0;
+    step_history(output, step);
+  }
+}
+
+static void strip_done(struct wooz_output *output);
+
+// The buffer a visual diff against target goes to, NULL if it couldn't be
+// created.
+static struct wooz_buffer *
+prepare_diff_buffer(struct wooz_output *output,
+                    const struct wooz_buffer *target) {
+  return prepare_shown_buffer(output->state, &output->diff_buffer,
+                              target->format, target->width, target->height,
+                              target->stride);
+}
+
+static void capture_done(struct wooz_output *output) {
+  if (output->tiers.scale > 0) {
+    strip_done(output);
+    return;
+  }
+  capture_stats_end(&output->capture_stats, true);
+
+  // Buffers are allocated here, jobs can't make Wayland requests.
+  struct wooz_capture_work *work = &output->capture_work;
+  *work = (struct wooz_capture_work){
+      .target = output->recapture ? output->back_buffer : output->buffer,
+      .transform = output->transform,
+  };
+  if (output->raw_buffer != NULL) {
+    work->target = prepare_upright_buffer(output);
+  }
+  if (output->recapture) {
+    // Damage reported by the compositor saves hashing the whole capture.
+    work->diff = output->capture_damage.size == 0;
+    if (output->diff_pending) {
+      output->diff_pending = false;
+      work->visual_diff = prepare_diff_buffer(output, work->target);
+    }
+    // Snapshots are stored by tile hash, diffs already hash the capture.
+    work->hash = output->state->config.history_size > 0 && !work->diff;
+  } else {
+    // Recaptures are compared against the initial capture, unless the
+    // compositor reports damage itself.
+    work->hash = (output->state->config.refresh_ms > 0 &&
+                  !capture_reports_damage(output->state)) ||
+                 output->state->config.history_size > 0;
+  }
+
+  if (output->worker == NULL ||
+      !worker_submit(output->worker, process_capture, finish_capture,
+                     output)) {
+    process_capture(output);
+    finish_capture(output);
+  }
+}
+
+static void capture_failed(struct wooz_output *output) {
+  capture_stats_end(&output->capture_stats, false);
+  fprintf(stderr, "failed to copy output %s\n", output->name);
+
+  if (output->recapture) {
+    // Keep showing the previous capture.
+    output->recapture = false;
+    schedule_refresh(output);
+    return;
+  }
+  if (!output->state->running) {
+    exit(EXIT_FAILURE);
+  }
 
-static void restore_view(struct wooz_window *win) {
-  win->view_source = win->initial_view_source;
+  // The capture of an output added or changed at runtime, other outputs
+  // keep running while it is retried.
+  output->change_failed = true;
+  event_loop_schedule(output->state->event_loop, &output->change_timer,
+                      OUTPUT_CHANGE_FAILED_RETRY_MS, 0);
 }
 
-static void apply_zoom(struct wooz_window *win, double zoom_change,
-                       double center_x, double center_y) {
-  double ratio = win->output->ratio;
+static void screencopy_event(void *data) {
+  struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_SCREENCOPY_FRAME);
+}
+
+static struct wooz_buffer *
+screencopy_buffer(void *data, const struct wooz_shm_offer *offer) {
+  struct wooz_output *output = data;
+  output->capture_offer = *offer;
+  bool created;
+  return prepare_capture_buffer(output, &created);
+}
+
+static void screencopy_damage(void *data, int32_t x, int32_t y,
+                              int32_t width, int32_t height) {
+  add_capture_damage(data, x, y, width, height);
+}
+
+static void screencopy_flags(void *data, uint32_t flags) {
+  struct wooz_output *output = data;
+  output->screencopy_frame_flags = flags;
+}
 
-  // Calculate the zoom change in pixels
-  double scroll = zoom_change;
+static void screencopy_ready(void *data) { capture_done(data); }
 
-  if (win->view_source.width - scroll * ratio < MAX_SCROLL ||
-      win->view_source.height - scroll < MAX_SCROLL)
+static void screencopy_failed(void *data) { capture_failed(data); }
+
+static const struct wooz_screencopy_handler screencopy_handler = {
+    .event = screencopy_event,
+    .buffer = screencopy_buffer,
+    .damage = screencopy_damage,
+    .flags = screencopy_flags,
+    .ready = screencopy_ready,
+    .failed = screencopy_failed,
+};
+
+// Capture the next strip of full resolution rows of a tiered output.
+static void capture_strip(struct wooz_output *output) {
+  struct wooz_state *state = output->state;
+  int32_t height = output->logical_geometry.height;
+
+  int32_t rows = (int32_t)(output->tiers.strip_rows / output->logical_scale);
+  output->strip_height = min(max(rows, 1), height - output->strip_y);
+
+  output->capture_damage.size = 0;
+  screencopy_start(&output->screencopy,
+                   zwlr_screencopy_manager_v1_capture_output_region(
+                       state->screencopy_manager, false, output->wl_output, 0,
+                       output->strip_y, output->logical_geometry.width,
+                       output->strip_height),
+                   output->recapture, &screencopy_handler, output);
+}
+
+// Downscale a copied strip, the capture is complete after the last one.
+// Strips are small, they are processed inline.
+static void strip_done(struct wooz_output *output) {
+  struct wooz_state *state = output->state;
+  struct wooz_buffer *strip = output->strip;
+
+  if (output->buffer == NULL) {
+    int32_t scale = output->tiers.scale;
+    int32_t width = (output->geometry.width + scale - 1) / scale;
+    int32_t height = (output->geometry.height + scale - 1) / scale;
+    int32_t bpp = shm_format_bytes_per_pixel(strip->format);
+    if (bpp == 0) {
+      fprintf(stderr, "unsupported capture format for --memory-budget\n");
+      exit(EXIT_FAILURE);
+    }
+    output->buffer = create_shown_buffer(state, strip->format, width, height,
+                                         width * bpp);
+    if (output->buffer == NULL ||
+        !downscaler_init(&output->downscaler, output->buffer, scale)) {
+      fprintf(stderr, "failed to create buffer\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Strip boundaries are logical, rounding may repeat or skip a row.
+  int32_t y = (int32_t)(output->strip_y * output->logical_scale + 0.5);
+  downscaler_add(&output->downscaler, strip, y);
+
+  output->strip_y += output->strip_height;
+  if (output->strip_y < output->logical_geometry.height) {
+    capture_strip(output);
     return;
+  }
 
-  // Calculate center point as ratio of viewport
-  double dx = center_x / (double)win->output->logical_geometry.width;
-  double dy = center_y / (double)win->output->logical_geometry.height;
+  downscaler_finish(&output->downscaler);
+  destroy_buffer(output->strip);
+  output->strip = NULL;
+  capture_stats_end(&output->capture_stats, true);
+  capture_ready(output);
+}
 
-  win->view_source.x += scroll * ratio * dx;
-  win->view_source.width -= scroll * ratio;
-  win->view_source.y += scroll * dy;
-  win->view_source.height -= scroll;
+// The detail buffer a new detail capture goes to, the other one may be shown.
+static struct wooz_buffer **detail_spare(struct wooz_output *output) {
+  return &output->details[output->details[0] == output->detail ? 1 : 0];
 }
 
-static void render_window(struct wooz_window *win) {
-  win->view_source.width =
-      max(min(win->view_source.width, win->output->buffer->width),
-          MAX_SCROLL * win->output->ratio);
-  win->view_source.height = max(
-      min(win->view_source.height, win->output->buffer->height), MAX_SCROLL);
-  win->view_source.x = max(min(win->view_source.x, win->output->buffer->width -
-                                                       win->view_source.width),
-                           0);
-  win->view_source.y = max(min(win->view_source.y, win->output->buffer->height -
-                                                       win->view_source.height),
-                           0);
+static struct wooz_buffer *detail_buffer(void *data,
+                                         const struct wooz_shm_offer *offer) {
+  struct wooz_output *output = data;
+  if (!offer->valid) {
+    fprintf(stderr, "no supported buffer type offered for output %s\n",
+            output->name);
+    return NULL;
+  }
 
-  wp_viewport_set_source(win->viewport,
-                         wl_fixed_from_double(win->view_source.x),
-                         wl_fixed_from_double(win->view_source.y),
-                         wl_fixed_from_double(win->view_source.width),
-                         wl_fixed_from_double(win->view_source.height));
+  // A spare still held by the compositor may still be read, it is replaced
+  // instead of overwritten.
+  struct wooz_buffer **target = detail_spare(output);
+  if (*target != NULL &&
+      ((*target)->busy || (*target)->format != offer->format ||
+       (*target)->stride != (int32_t)offer->stride ||
+       (*target)->size != (size_t)offer->stride * offer->height)) {
+    destroy_buffer(*target);
+    *target = NULL;
+  }
+  if (*target == NULL) {
+    *target = create_shown_buffer(output->state, offer->format,
+                                  offer->width, offer->height, offer->stride);
+    if (*target == NULL) {
+      fprintf(stderr, "failed to create buffer\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return *target;
+}
+
+static void detail_ready(void *data) {
+  struct wooz_output *output = data;
+  output->detail = *detail_spare(output);
+  double scale = output->logical_scale;
+  output->detail_box = (struct wooz_boxf){
+      .x = output->detail_region.x * scale,
+      .y = output->detail_region.y * scale,
+      .width = output->detail_region.width * scale,
+      .height = output->detail_region.height * scale,
+  };
+
+  // Rendering requests the next detail if the view moved meanwhile.
+  struct wooz_window *win;
+  wl_list_for_each(win, &output->state->windows, link) {
+    if (win->output == output && win->is_configured) {
+      render_window(win);
+    }
+  }
+}
 
-  wl_surface_commit(win->surface);
+static void detail_failed(void *data) {
+  struct wooz_output *output = data;
+  // Keep showing the downscaled capture.
+  fprintf(stderr, "failed to copy a detail of output %s\n", output->name);
 }
 
-static void handle_key_action(struct wooz_state *state, uint32_t key) {
-  struct wooz_window *win = state->focused;
-  if (win == NULL) {
+static const struct wooz_screencopy_handler detail_handler = {
+    .event = screencopy_event,
+    .buffer = detail_buffer,
+    .ready = detail_ready,
+    .failed = detail_failed,
+};
+
+// Capture the full resolution region of the detail size centered on center,
+// in buffer coordinates.
+static void capture_detail(struct wooz_output *output, double center_x,
+                           double center_y) {
+  struct wooz_state *state = output->state;
+  double scale = output->logical_scale;
+  double width = output->tiers.detail_width;
+  double height = output->tiers.detail_height;
+  double x = max(min(center_x - width / 2, output->geometry.width - width), 0);
+  double y =
+      max(min(center_y - height / 2, output->geometry.height - height), 0);
+
+  // Regions are logical, rounded inwards to stay within the budget but
+  // reaching the output edges.
+  struct wooz_box *logical = &output->logical_geometry;
+  int32_t x0 = (int32_t)floor(x / scale);
+  int32_t y0 = (int32_t)floor(y / scale);
+  int32_t x1 = x + width >= output->geometry.width
+                   ? logical->width
+                   : max((int32_t)floor((x + width) / scale), x0 + 1);
+  int32_t y1 = y + height >= output->geometry.height
+                   ? logical->height
+                   : max((int32_t)floor((y + height) / scale), y0 + 1);
+  output->detail_region = (struct wooz_box){
+      .x = x0,
+      .y = y0,
+      .width = x1 - x0,
+      .height = y1 - y0,
+  };
+
+  screencopy_start(&output->detail_copy,
+                   zwlr_screencopy_manager_v1_capture_output_region(
+                       state->screencopy_manager, false, output->wl_output,
+                       x0, y0, x1 - x0, y1 - y0),
+                   false, &detail_handler, output);
+}
+
+// Show the detail capture over the part of the view it covers.
+static void update_detail_surface(struct wooz_window *win) {
+  struct wooz_output *output = win->output;
+  struct wooz_buffer *detail = output->detail;
+  const struct wooz_boxf *view = &win->view_source;
+  const struct wooz_boxf *box = &output->detail_box;
+  int32_t width = output->logical_geometry.width;
+  int32_t height = output->logical_geometry.height;
+  double sx = width / view->width;
+  double sy = height / view->height;
+
+  // Destination edges are snapped inwards to surface pixels.
+  int32_t x0 = max((int32_t)ceil((box->x - view->x) * sx), 0);
+  int32_t y0 = max((int32_t)ceil((box->y - view->y) * sy), 0);
+  int32_t x1 =
+      min((int32_t)floor((box->x + box->width - view->x) * sx), width);
+  int32_t y1 =
+      min((int32_t)floor((box->y + box->height - view->y) * sy), height);
+  if (detail == NULL || x1 <= x0 || y1 <= y0) {
+    if (win->detail_buffer != NULL) {
+      wl_surface_attach(win->detail_surface, NULL, 0, 0);
+      commit_surface(win->state, win->detail_surface);
+      win->detail_buffer = NULL;
+    }
     return;
   }
 
-  switch (key) {
-  case KEY_EQUAL: // For keyboards where + is shift+=
-  case KEY_KPPLUS:
-    // Zoom in at center
-    apply_zoom(win, KEYBOARD_ZOOM_STEP,
-               win->output->logical_geometry.width / 2.0,
-               win->output->logical_geometry.height / 2.0);
-    render_window(win);
-    break;
+  // Back to detail buffer pixels, the buffer may be a rounding off the box
+  // size. The source must stay within the buffer.
+  double bx = detail->width / box->width;
+  double by = detail->height / box->height;
+  wl_fixed_t src_x =
+      wl_fixed_from_double(max((view->x + x0 / sx - box->x) * bx, 0));
+  wl_fixed_t src_y =
+      wl_fixed_from_double(max((view->y + y0 / sy - box->y) * by, 0));
+  wl_fixed_t src_width = wl_fixed_from_double((x1 - x0) / sx * bx);
+  wl_fixed_t src_height = wl_fixed_from_double((y1 - y0) / sy * by);
+  src_width = min(src_width, wl_fixed_from_int(detail->width) - src_x);
+  src_height = min(src_height, wl_fixed_from_int(detail->height) - src_y);
+
+  if (win->detail_buffer != detail) {
+    wl_surface_attach(win->detail_surface, detail->wl_buffer, 0, 0);
+    wl_surface_damage_buffer(win->detail_surface, 0, 0, INT32_MAX,
+                             INT32_MAX);
+    detail->busy = true;
+    win->detail_buffer = detail;
+  }
+  wl_subsurface_set_position(win->detail_subsurface, x0, y0);
+  wp_viewport_set_source(win->detail_viewport, src_x, src_y, src_width,
+                         src_height);
+  wp_viewport_set_destination(win->detail_viewport, x1 - x0, y1 - y0);
+  commit_surface(win->state, win->detail_surface);
+}
 
-  case KEY_MINUS:
-  case KEY_KPMINUS:
-    // Zoom out at center
-    apply_zoom(win, -KEYBOARD_ZOOM_STEP,
-               win->output->logical_geometry.width / 2.0,
-               win->output->logical_geometry.height / 2.0);
-    render_window(win);
-    break;
+// Request a detail capture when the last one doesn't cover what matters: the
+// view if the detail size holds it, the region around the pointer otherwise.
+static void update_detail(struct wooz_window *win) {
+  struct wooz_output *output = win->output;
+  if (win->detail_surface == NULL || output->tiers.scale == 0) {
+    return;
+  }
+  update_detail_surface(win);
+
+  // Margins absorb the rounding of regions to logical pixels.
+  const struct wooz_boxf *view = &win->view_source;
+  double margin = 2 * output->logical_scale;
+  double width = output->tiers.detail_width;
+  double height = output->tiers.detail_height;
+  struct wooz_boxf interest = *view;
+  if (view->width + margin > width || view->height + margin > height) {
+    double scale = view->width / output->logical_geometry.width;
+    interest.width = width / 2;
+    interest.height = height / 2;
+    interest.x = view->x + win->pointer_x * scale - interest.width / 2;
+    interest.y = view->y + win->pointer_y * scale - interest.height / 2;
+    interest.x = max(min(interest.x, output->geometry.width - interest.width),
+                     0);
+    interest.y = max(
+        min(interest.y, output->geometry.height - interest.height), 0);
+  }
 
-  case KEY_LEFT:
-    win->view_source.x -= KEYBOARD_PAN_STEP;
-    render_window(win);
-    break;
+  // Half a pixel of slack for boxes scaled from logical coordinates.
+  const struct wooz_boxf *box = &output->detail_box;
+  if (output->detail_copy.frame != NULL ||
+      (output->detail != NULL && interest.x + 0.5 >= box->x &&
+       interest.y + 0.5 >= box->y &&
+       interest.x + interest.width <= box->x + box->width + 0.5 &&
+       interest.y + interest.height <= box->y + box->height + 0.5)) {
+    return;
+  }
+  capture_detail(output, interest.x + interest.width / 2,
+                 interest.y + interest.height / 2);
+}
 
-  case KEY_RIGHT:
-    win->view_source.x += KEYBOARD_PAN_STEP;
-    render_window(win);
-    break;
+static void image_copy_frame_handle_transform(
+    void *data, struct ext_image_copy_capture_frame_v1 *frame,
+    uint32_t transform) {
+  struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_FRAME);
+  // Nothing else to do, the output transform is used
+}
 
-  case KEY_UP:
-    win->view_source.y -= KEYBOARD_PAN_STEP;
-    render_window(win);
-    break;
+static void
+image_copy_frame_handle_damage(void *data,
+                               struct ext_image_copy_capture_frame_v1 *frame,
+                               int32_t x, int32_t y, int32_t width,
+                               int32_t height) {
+  struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_FRAME);
+  add_capture_damage(output, x, y, width, height);
+}
 
-  case KEY_DOWN:
-    win->view_source.y += KEYBOARD_PAN_STEP;
-    render_window(win);
-    break;
-  }
+static void image_copy_frame_handle_presentation_time(
+    void *data, struct ext_image_copy_capture_frame_v1 *frame,
+    uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec) {
+  struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_FRAME);
 }
 
-static void stop_key_repeat(struct wooz_state *state) {
-  if (state->repeat_timer_fd >= 0 && state->pressed_key != 0) {
-    struct itimerspec its = {0};
-    timerfd_settime(state->repeat_timer_fd, 0, &its, NULL);
-    state->pressed_key = 0;
+static void
+image_copy_frame_handle_ready(void *data,
+                              struct ext_image_copy_capture_frame_v1 *frame) {
+  struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_FRAME);
+
+  ext_image_copy_capture_frame_v1_destroy(frame);
+  output->image_copy_frame = NULL;
+  capture_done(output);
+}
+
+static void
+image_copy_frame_handle_failed(void *data,
+                               struct ext_image_copy_capture_frame_v1 *frame,
+                               uint32_t reason) {
+  struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_FRAME);
+
+  ext_image_copy_capture_frame_v1_destroy(frame);
+  output->image_copy_frame = NULL;
+  // Partial damage is useless, the next capture damages the whole buffer.
+  output->capture_damage.size = 0;
+
+  if (reason ==
+      EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS) {
+    // Retry once the session sent its new constraints.
+    output->capture_pending = true;
+    return;
   }
+  capture_failed(output);
 }
 
-static void start_key_repeat(struct wooz_state *state, uint32_t key) {
-  state->pressed_key = key;
+static const struct ext_image_copy_capture_frame_v1_listener
+    image_copy_frame_listener = {
+        .transform = image_copy_frame_handle_transform,
+        .damage = image_copy_frame_handle_damage,
+        .presentation_time = image_copy_frame_handle_presentation_time,
+        .ready = image_copy_frame_handle_ready,
+        .failed = image_copy_frame_handle_failed,
+};
 
-  if (state->repeat_timer_fd < 0) {
-    state->repeat_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-    if (state->repeat_timer_fd < 0) {
-      return;
+static void image_copy_capture(struct wooz_output *output) {
+  bool created;
+  struct wooz_buffer *buffer = prepare_capture_buffer(output, &created);
+
+  struct ext_image_copy_capture_session_v1 *session =
+      output->image_copy_session;
+  output->image_copy_frame =
+      ext_image_copy_capture_session_v1_create_frame(session);
+  ext_image_copy_capture_frame_v1_add_listener(
+      output->image_copy_frame, &image_copy_frame_listener, output);
+  ext_image_copy_capture_frame_v1_attach_buffer(output->image_copy_frame,
+                                                buffer->wl_buffer);
+
+  // Buffers alternate, this one misses what the previous frame, captured in
+  // the other buffer, reported as damaged. The compositor then only copies
+  // that and what changed since.
+  if (created || output->capture_damage.size == 0) {
+    ext_image_copy_capture_frame_v1_damage_buffer(output->image_copy_frame, 0,
+                                                  0, INT32_MAX, INT32_MAX);
+  } else {
+    struct wooz_box *box;
+    wl_array_for_each(box, &output->capture_damage) {
+      ext_image_copy_capture_frame_v1_damage_buffer(
+          output->image_copy_frame, box->x, box->y, box->width, box->height);
     }
   }
+  output->capture_damage.size = 0;
 
-  struct itimerspec its;
-  its.it_value.tv_sec = KEY_REPEAT_DELAY_MS / 1000;
-  its.it_value.tv_nsec = (KEY_REPEAT_DELAY_MS % 1000) * 1000000;
-  its.it_interval.tv_sec = KEY_REPEAT_RATE_MS / 1000;
-  its.it_interval.tv_nsec = (KEY_REPEAT_RATE_MS % 1000) * 1000000;
+  ext_image_copy_capture_frame_v1_capture(output->image_copy_frame);
+}
 
-  timerfd_settime(state->repeat_timer_fd, 0, &its, NULL);
+// Session constraints are resent as a whole whenever they change.
+static void image_copy_session_reset_constraints(struct wooz_output *output) {
+  if (output->image_copy_session_ready) {
+    output->image_copy_session_ready = false;
+    output->capture_offer.valid = false;
+  }
 }
 
-static bool is_repeatable_key(uint32_t key) {
-  return key == KEY_EQUAL || key == KEY_KPPLUS || key == KEY_MINUS ||
-         key == KEY_KPMINUS || key == KEY_LEFT || key == KEY_RIGHT ||
-         key == KEY_UP || key == KEY_DOWN;
+static void image_copy_session_handle_buffer_size(
+    void *data, struct ext_image_copy_capture_session_v1 *session,
+    uint32_t width, uint32_t height) {
+  struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_SESSION);
+
+  image_copy_session_reset_constraints(output);
+  output->capture_offer.width = width;
+  output->capture_offer.height = height;
 }
 
-static void screencopy_frame_handle_buffer(
-    void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t format,
-    uint32_t width, uint32_t height, uint32_t stride) {
+static void image_copy_session_handle_shm_format(
+    void *data, struct ext_image_copy_capture_session_v1 *session,
+    uint32_t format) {
   struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_SESSION);
 
-  output->buffer =
-      create_buffer(output->state->shm, format, width, height, stride);
-  if (output->buffer == NULL) {
-    fprintf(stderr, "failed to create buffer\n");
-    exit(EXIT_FAILURE);
-  }
+  image_copy_session_reset_constraints(output);
 
-  // Handle rotated screens.
-  if (output->transform & WL_OUTPUT_TRANSFORM_90) {
-    int32_t tmp = output->buffer->width;
-    output->buffer->width = output->buffer->height;
-    output->buffer->height = tmp;
+  // Strides are up to us, only formats with a known pixel size are usable.
+  // The first of the most preferred ones is kept, as for screencopy.
+  int preference = shm_format_preference(format);
+  if (preference == 0) {
+    return;
   }
+  if (!output->capture_offer.valid ||
+      preference > shm_format_preference(output->capture_offer.format)) {
+    output->capture_offer.format = format;
+    output->capture_offer.valid = true;
+  }
+}
 
-  zwlr_screencopy_frame_v1_copy(frame, output->buffer->wl_buffer);
+static void image_copy_session_handle_dmabuf_device(
+    void *data, struct ext_image_copy_capture_session_v1 *session,
+    struct wl_array *device) {
+  struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_SESSION);
+  // Nothing else to do, captures are always copied to wl_shm buffers
 }
 
-static void screencopy_frame_handle_flags(
-    void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t flags) {
+static void image_copy_session_handle_dmabuf_format(
+    void *data, struct ext_image_copy_capture_session_v1 *session,
+    uint32_t format, struct wl_array *modifiers) {
   struct wooz_output *output = data;
-  output->screencopy_frame_flags = flags;
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_SESSION);
+  // Nothing else to do, captures are always copied to wl_shm buffers
 }
 
-static void screencopy_frame_handle_ready(
-    void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t tv_sec_hi,
-    uint32_t tv_sec_lo, uint32_t tv_nsec) {
+static void image_copy_session_handle_done(
+    void *data, struct ext_image_copy_capture_session_v1 *session) {
   struct wooz_output *output = data;
-  ++output->state->n_done;
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_SESSION);
+
+  output->image_copy_session_ready = true;
+  output->capture_offer.stride =
+      output->capture_offer.width *
+      shm_format_bytes_per_pixel(output->capture_offer.format);
+
+  if (output->capture_pending) {
+    output->capture_pending = false;
+    image_copy_capture(output);
+  }
 }
 
-static void
-screencopy_frame_handle_failed(void *data,
-                               struct zwlr_screencopy_frame_v1 *frame) {
+static void image_copy_session_handle_stopped(
+    void *data, struct ext_image_copy_capture_session_v1 *session) {
   struct wooz_output *output = data;
-  fprintf(stderr, "failed to copy output %s\n", output->name);
-  exit(EXIT_FAILURE);
+  count_event(output->state, WOOZ_STATS_IMAGE_COPY_SESSION);
+
+  // A new session is created on the next capture.
+  ext_image_copy_capture_session_v1_destroy(session);
+  output->image_copy_session = NULL;
+  output->image_copy_session_ready = false;
+  output->capture_offer.valid = false;
+
+  if (output->capture_pending) {
+    output->capture_pending = false;
+    capture_failed(output);
+  }
 }
 
-static const struct zwlr_screencopy_frame_v1_listener
-    screencopy_frame_listener = {
-        .buffer = screencopy_frame_handle_buffer,
-        .flags = screencopy_frame_handle_flags,
-        .ready = screencopy_frame_handle_ready,
-        .failed = screencopy_frame_handle_failed,
+static const struct ext_image_copy_capture_session_v1_listener
+    image_copy_session_listener = {
+        .buffer_size = image_copy_session_handle_buffer_size,
+        .shm_format = image_copy_session_handle_shm_format,
+        .dmabuf_device = image_copy_session_handle_dmabuf_device,
+        .dmabuf_format = image_copy_session_handle_dmabuf_format,
+        .done = image_copy_session_handle_done,
+        .stopped = image_copy_session_handle_stopped,
 };
 
+static void capture_output(struct wooz_output *output, bool recapture) {
+  struct wooz_state *state = output->state;
+
+  output->recapture = recapture;
+  capture_stats_begin(&output->capture_stats);
+
+  if (output->tiers.scale > 0) {
+    // Only strips are ever held at full resolution, see --memory-budget.
+    output->strip_y = 0;
+    capture_strip(output);
+    return;
+  }
+
+  if (uses_image_copy_capture(state)) {
+    // Sessions are kept for the whole run, buffer constraints are only
+    // negotiated once.
+    if (output->image_copy_session == NULL) {
+      if (output->image_capture_source == NULL) {
+        output->image_capture_source =
+            ext_output_image_capture_source_manager_v1_create_source(
+                state->output_source_manager, output->wl_output);
+      }
+      output->image_copy_session =
+          ext_image_copy_capture_manager_v1_create_session(
+              state->image_copy_manager, output->image_capture_source, 0);
+      ext_image_copy_capture_session_v1_add_listener(
+          output->image_copy_session, &image_copy_session_listener, output);
+    }
+
+    if (!output->image_copy_session_ready) {
+      output->capture_pending = true;
+      return;
+    }
+    image_copy_capture(output);
+    return;
+  }
+
+  // Recaptures only complete once the output changed, the damage events then
+  // tell which regions did.
+  output->capture_damage.size = 0;
+  screencopy_start(&output->screencopy,
+                   zwlr_screencopy_manager_v1_capture_output(
+                       state->screencopy_manager, false, output->wl_output),
+                   output->recapture, &screencopy_handler, output);
+}
+
+static void handle_stats_signal(int fd, uint32_t events, void *data) {
+  struct wooz_state *state = data;
+
+  struct signalfd_siginfo info;
+  while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+    print_stats(stderr, state, state->config.stats);
+  }
+}
+
+static void read_stream(struct wooz_state *state) {
+  bool new_frame;
+  if (!stream_read(state->stream, &new_frame)) {
+    // Keep showing the last frame once the input ends.
+    event_loop_remove_fd(state->event_loop, state->stream_source);
+    state->stream_source = NULL;
+    event_loop_cancel(state->event_loop, &state->stream_timer);
+  }
+  // Partial reads have nothing new to show.
+  if (!new_frame) {
+    return;
+  }
+
+  struct wooz_window *win;
+  wl_list_for_each(win, &state->windows, link) {
+    render_window(win);
+    if (win == state->focused) {
+      update_pick(win);
+    }
+  }
+}
+
+static void handle_stream_input(int fd, uint32_t events, void *data) {
+  read_stream(data);
+}
+
+// Regular files can't be polled, they are always readable.
+static void handle_stream_timer(void *data) { read_stream(data); }
+
+// Whether a window of output, or of any output if NULL, isn't suspended.
+static bool has_active_window(struct wooz_state *state,
+                              struct wooz_output *output) {
+  struct wooz_window *win;
+  wl_list_for_each(win, &state->windows, link) {
+    if ((output == NULL || win->output == output) && !win->is_suspended) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Recaptures are chained: the next one is scheduled once the current one
+// completes.
+static void handle_refresh(void *data) {
+  struct wooz_output *output = data;
+
+  // Outputs not shown are rescheduled when a window is resumed, diffs and
+  // snapshots once hidden.
+  if (output->buffer == NULL || output->show_diff ||
+      output->history_age > 0 || capture_in_flight(output) ||
+      !has_active_window(output->state, output)) {
+    return;
+  }
+  // Don't write to a buffer the compositor may still be reading.
+  if (output->back_buffer != NULL && output->back_buffer->busy) {
+    schedule_refresh(output);
+    return;
+  }
+  capture_output(output, true);
+}
+
+// Diff a recapture against the shown capture, or hide the diff.
+static void toggle_diff(struct wooz_output *output) {
+  if (output->show_diff) {
+    output->show_diff = false;
+    attach_capture(output);
+    schedule_refresh(output);
+    return;
+  }
+
+  // Images and input frames aren't recaptured, nor are downscaled captures.
+  // Snapshots aren't diffed.
+  if (!uses_capture(output->state) || output->tiers.scale > 0 ||
+      output->buffer == NULL || output->diff_pending ||
+      output->history_age > 0) {
+    return;
+  }
+  if (!can_diff_format(output->buffer->format)) {
+    fprintf(stderr, "captures of output %s can't be diffed\n", output->name);
+    return;
+  }
+  if (capture_in_flight(output)) {
+    // A recapture in flight is diffed once copied.
+    output->diff_pending = output->recapture;
+    return;
+  }
+  output->diff_pending = true;
+  event_loop_cancel(output->state->event_loop, &output->refresh_timer);
+  capture_output(output, true);
+}
+
+// Outputs present at startup are set up by main, later changes are applied
+// from the event loop, once the events of both wl_output and xdg_output are
+// in.
+static void schedule_output_change(struct wooz_output *output) {
+  struct wooz_state *state = output->state;
+  if (state->running && !timer_is_scheduled(&output->change_timer)) {
+    event_loop_schedule(state->event_loop, &output->change_timer, 0, 0);
+  }
+}
+
 static void xdg_output_handle_logical_position(
     void *data, struct zxdg_output_v1 *xdg_output, int32_t x, int32_t y) {
   struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_XDG_OUTPUT);
 
   output->logical_geometry.x = x;
   output->logical_geometry.y = y;
@@ -232,6 +2124,7 @@ static void xdg_output_handle_logical_size(void *data,
                                            struct zxdg_output_v1 *xdg_output,
                                            int32_t width, int32_t height) {
   struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_XDG_OUTPUT);
 
   output->logical_geometry.width = width;
   output->logical_geometry.height = height;
@@ -240,25 +2133,30 @@ static void xdg_output_handle_logical_size(void *data,
 static void xdg_output_handle_done(void *data,
                                    struct zxdg_output_v1 *xdg_output) {
   struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_XDG_OUTPUT);
 
   // Guess the output scale from the logical size
   int32_t width = output->geometry.width;
   output->logical_scale = (double)width / output->logical_geometry.width;
   output->ratio = (double)output->logical_geometry.width /
                   (double)output->logical_geometry.height;
+
+  schedule_output_change(output);
 }
 
 static void xdg_output_handle_name(void *data,
                                    struct zxdg_output_v1 *xdg_output,
                                    const char *name) {
   struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_XDG_OUTPUT);
   output->name = strdup(name);
 }
 
 static void xdg_output_handle_description(void *data,
                                           struct zxdg_output_v1 *xdg_output,
                                           const char *name) {
-  // No-op
+  struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_XDG_OUTPUT);
 }
 
 static const struct zxdg_output_v1_listener xdg_output_listener = {
@@ -275,6 +2173,7 @@ static void output_handle_geometry(void *data, struct wl_output *wl_output,
                                    const char *make, const char *model,
                                    int32_t transform) {
   struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_OUTPUT);
 
   output->geometry.x = x;
   output->geometry.y = y;
@@ -285,20 +2184,26 @@ static void output_handle_mode(void *data, struct wl_output *wl_output,
                                uint32_t flags, int32_t width, int32_t height,
                                int32_t refresh) {
   struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_OUTPUT);
 
   if ((flags & WL_OUTPUT_MODE_CURRENT) != 0) {
     output->geometry.width = output->transform ? height : width;
     output->geometry.height = output->transform ? width : height;
+    output->refresh_mhz = refresh;
+    output->mode_changed = true;
   }
 }
 
 static void output_handle_done(void *data, struct wl_output *wl_output) {
-  // No-op
+  struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_OUTPUT);
+  schedule_output_change(output);
 }
 
 static void output_handle_scale(void *data, struct wl_output *wl_output,
                                 int32_t factor) {
   struct wooz_output *output = data;
+  count_event(output->state, WOOZ_STATS_OUTPUT);
   output->scale = factor;
 }
 
@@ -311,6 +2216,9 @@ static const struct wl_output_listener output_listener = {
 
 static void xdg_wm_base_ping(void *data, struct xdg_wm_base *shell,
                              uint32_t serial) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_XDG_WM_BASE);
+
   xdg_wm_base_pong(shell, serial);
 }
 
@@ -318,11 +2226,102 @@ static const struct xdg_wm_base_listener xdg_wm_base_listener = {
     .ping = &xdg_wm_base_ping,
 };
 
+// Free what a hidden output can rebuild, only the attached capture is kept.
+static void release_output_buffers(struct wooz_output *output) {
+  if (!capture_in_flight(output)) {
+    if (output->back_buffer != NULL && !output->back_buffer->busy) {
+      destroy_buffer(output->back_buffer);
+      output->back_buffer = NULL;
+    }
+    destroy_buffer(output->raw_buffer);
+    output->raw_buffer = NULL;
+  }
+  if (output->detail_copy.frame == NULL) {
+    struct wooz_buffer **spare = detail_spare(output);
+    if (*spare != NULL && !(*spare)->busy) {
+      destroy_buffer(*spare);
+      *spare = NULL;
+    }
+  }
+
+  for (size_t i = 0; i < sizeof(output->history_buffers) / sizeof(void *);
+       i++) {
+    struct wooz_buffer **buffer = &output->history_buffers[i];
+    if (*buffer != NULL && !(*buffer)->busy &&
+        (*buffer != output->history_buffer || output->history_age == 0)) {
+      if (*buffer == output->history_buffer) {
+        output->history_buffer = NULL;
+      }
+      destroy_buffer(*buffer);
+      *buffer = NULL;
+    }
+  }
+
+  if (output->buffer != NULL) {
+    free(output->buffer->sat);
+    output->buffer->sat = NULL;
+    output->buffer->sat_valid = false;
+  }
+
+  struct wooz_window *win;
+  wl_list_for_each(win, &output->state->windows, link) {
+    if (win->output != output) {
+      continue;
+    }
+    for (int i = 0; i < GRID_MAX_BUFFERS; i++) {
+      struct wooz_buffer *buffer = win->grid_buffers[i];
+      if (buffer != NULL && buffer != win->grid_buffer && !buffer->busy) {
+        destroy_buffer(buffer);
+        win->grid_buffers[i] = NULL;
+      }
+    }
+  }
+}
+
+// Keep recapturing only outputs with a window shown.
+static void update_refresh_timers(struct wooz_state *state) {
+  if (state->config.refresh_ms == 0) {
+    return;
+  }
+
+  struct wooz_output *output;
+  wl_list_for_each(output, &state->outputs, link) {
+    if (!has_active_window(state, output)) {
+      event_loop_cancel(state->event_loop, &output->refresh_timer);
+    } else if (output->buffer != NULL && !capture_in_flight(output) &&
+               !timer_is_scheduled(&output->refresh_timer)) {
+      // Catch up with what changed while suspended right away.
+      event_loop_schedule(state->event_loop, &output->refresh_timer, 0, 0);
+    }
+  }
+}
+
+// Stop all work for a window the compositor doesn't show.
+static void suspend_window(struct wooz_window *win) {
+  struct wooz_state *state = win->state;
+
+  if (win->frame_callback != NULL) {
+    wl_callback_destroy(win->frame_callback);
+    win->frame_callback = NULL;
+  }
+  if (state->focused == win) {
+    stop_key_repeat(state);
+  }
+  if (!has_active_window(state, win->output)) {
+    release_output_buffers(win->output);
+  }
+  update_refresh_timers(state);
+}
+
 static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
                                   uint32_t serial) {
   struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_XDG_SURFACE);
 
-  wl_surface_set_buffer_transform(win->surface, win->output->transform);
+  wl_surface_set_buffer_transform(win->surface,
+                                  content_transform(win->output));
+  bool was_suspended = win->is_suspended;
+  win->is_suspended = win->configure.is_suspended;
   win->is_configured = true;
   win->is_maximized = win->configure.is_maximized;
   win->is_fullscreen = win->configure.is_fullscreen;
@@ -335,7 +2334,11 @@ static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
                   win->is_tiled_left || win->is_tiled_right;
 
   xdg_surface_ack_configure(win->xdg_surface, serial);
-  wl_surface_attach(win->surface, win->output->buffer->wl_buffer, 0, 0);
+  struct wooz_buffer *buffer = shown_capture(win->output);
+  if (buffer != NULL) {
+    wl_surface_attach(win->surface, buffer->wl_buffer, 0, 0);
+    buffer->busy = true;
+  }
 
   if (win->viewport != NULL && win->configure.width != 0 &&
       win->configure.height != 0) {
@@ -343,19 +2346,47 @@ static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
                                 win->configure.height);
   }
 
-  // Apply initial zoom on first configure
+  // Windows may be suspended from their first configure on.
+  if (win->is_suspended && !was_suspended) {
+    suspend_window(win);
+  } else if (!win->is_suspended && was_suspended) {
+    update_refresh_timers(win->state);
+    if (win->needs_render) {
+      win->needs_render = false;
+      render_window(win);
+      return; // render_window already commits
+    }
+  }
+
+  // Apply initial zoom on first configure, suspended windows render it once
+  // resumed.
   if (!win->initial_zoom_applied && win->state->config.initial_zoom > 0.0) {
     double center_x = win->output->logical_geometry.width / 2.0;
     double center_y = win->output->logical_geometry.height / 2.0;
     double zoom_pixels =
         win->output->geometry.height * win->state->config.initial_zoom;
     apply_zoom(win, -zoom_pixels, center_x, center_y);
-    render_window(win);
     win->initial_zoom_applied = true;
-    return; // render_window already calls wl_surface_commit
+    render_window(win);
+    if (!win->is_suspended) {
+      return; // render_window already commits
+    }
+  }
+
+  if (win->output->tiers.scale > 0 && !win->is_suspended) {
+    // The viewport source of a downscaled capture is set when rendering.
+    render_window(win);
+    return; // render_window already commits
   }
 
-  wl_surface_commit(win->surface);
+  if (!uses_capture(win->state) && !win->is_suspended &&
+      win->frame_callback == NULL) {
+    // Images and input frames aren't attached until rendered.
+    render_window(win);
+    return; // render_window already commits
+  }
+
+  commit_surface(win->state, win->surface);
 }
 
 static const struct xdg_surface_listener xdg_surface_listener = {
@@ -366,6 +2397,9 @@ static void xdg_toplevel_configure(void *data,
                                    struct xdg_toplevel *xdg_toplevel,
                                    int32_t width, int32_t height,
                                    struct wl_array *states) {
+  struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_XDG_TOPLEVEL);
+
   bool is_activated = false;
   bool is_fullscreen = false;
   bool is_maximized = false;
@@ -411,8 +2445,6 @@ static void xdg_toplevel_configure(void *data,
     }
   }
 
-  (void)is_suspended;
-
   /*
    * Changes done here are ignored until the configure event has
    * been ack:ed in xdg_surface_configure().
@@ -420,7 +2452,6 @@ static void xdg_toplevel_configure(void *data,
    * So, just store the config data and apply it later, in
    * xdg_surface_configure() after we've ack:ed the event.
    */
-  struct wooz_window *win = data;
   win->configure.is_activated = is_activated;
   win->configure.is_fullscreen = is_fullscreen;
   win->configure.is_maximized = is_maximized;
@@ -429,18 +2460,23 @@ static void xdg_toplevel_configure(void *data,
   win->configure.is_tiled_bottom = is_tiled_bottom;
   win->configure.is_tiled_left = is_tiled_left;
   win->configure.is_tiled_right = is_tiled_right;
+  win->configure.is_suspended = is_suspended;
   win->configure.width = width;
   win->configure.height = height;
 }
 
 static void xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
   struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_XDG_TOPLEVEL);
   win->state->n_done = 0;
 }
 
 static void xdg_toplevel_configure_bounds(void *data,
                                           struct xdg_toplevel *xdg_toplevel,
                                           int32_t width, int32_t height) {
+  struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_XDG_TOPLEVEL);
+
   /* TODO: ensure we don't pick a bigger size */
 }
 
@@ -448,6 +2484,7 @@ static void xdg_toplevel_wm_capabilities(void *data,
                                          struct xdg_toplevel *xdg_toplevel,
                                          struct wl_array *caps) {
   struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_XDG_TOPLEVEL);
 
   win->wm_capabilities.maximize = false;
   win->wm_capabilities.minimize = false;
@@ -480,45 +2517,200 @@ static const struct xdg_toplevel_listener xdg_toplevel_listener = {
     .wm_capabilities = xdg_toplevel_wm_capabilities,
 };
 
-static void pointer_handle_enter(void *data, struct wl_pointer *pointer,
-                                 uint32_t serial, struct wl_surface *surface,
-                                 wl_fixed_t sx, wl_fixed_t sy) {
-  struct wooz_state *state = data;
+static void layer_surface_configure(void *data,
+                                    struct zwlr_layer_surface_v1 *layer_surface,
+                                    uint32_t serial, uint32_t width,
+                                    uint32_t height) {
+  struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_LAYER_SURFACE);
+
+  zwlr_layer_surface_v1_ack_configure(layer_surface, serial);
+  win->is_configured = true;
+
+  if (win->configure.width != (int)width ||
+      win->configure.height != (int)height) {
+    destroy_window_buffers(win);
+    win->configure.width = width;
+    win->configure.height = height;
+    wp_viewport_set_destination(win->viewport, width, height);
+  }
+
+  render_window(win);
+}
+
+static void layer_surface_closed(void *data,
+                                 struct zwlr_layer_surface_v1 *layer_surface) {
+  struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_LAYER_SURFACE);
+  win->state->n_done = 0;
+}
+
+static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
+    .configure = layer_surface_configure,
+    .closed = layer_surface_closed,
+};
+
+static uint64_t presentation_now(struct wooz_state *state) {
+  struct timespec ts;
+  clock_gettime(state->presentation_clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void presentation_feedback_handle_sync_output(
+    void *data, struct wp_presentation_feedback *feedback,
+    struct wl_output *output) {
+  struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_PRESENTATION_FEEDBACK);
+}
+
+static void presentation_feedback_handle_presented(
+    void *data, struct wp_presentation_feedback *feedback,
+    uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+    uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags) {
+  struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_PRESENTATION_FEEDBACK);
+
+  uint64_t presented =
+      ((uint64_t)tv_sec_hi << 32 | tv_sec_lo) * 1000000000ull + tv_nsec;
+  if (presented > win->feedback_commit_time) {
+    predictor_presented(&win->predictor,
+                        presented - win->feedback_commit_time);
+  }
+
+  wp_presentation_feedback_destroy(feedback);
+  win->presentation_feedback = NULL;
+}
+
+static void presentation_feedback_handle_discarded(
+    void *data, struct wp_presentation_feedback *feedback) {
+  struct wooz_window *win = data;
+  count_event(win->state, WOOZ_STATS_PRESENTATION_FEEDBACK);
+
+  wp_presentation_feedback_destroy(feedback);
+  win->presentation_feedback = NULL;
+}
+
+static const struct wp_presentation_feedback_listener
+    presentation_feedback_listener = {
+        .sync_output = presentation_feedback_handle_sync_output,
+        .presented = presentation_feedback_handle_presented,
+        .discarded = presentation_feedback_handle_discarded,
+};
+
+// Measure how long the next commit takes to be presented, one commit at a
+// time.
+static void request_presentation_feedback(struct wooz_window *win) {
+  struct wooz_state *state = win->state;
+  if (state->presentation == NULL || win->presentation_feedback != NULL ||
+      win->is_suspended) {
+    return;
+  }
+  win->presentation_feedback =
+      wp_presentation_feedback(state->presentation, win->surface);
+  wp_presentation_feedback_add_listener(win->presentation_feedback,
+                                        &presentation_feedback_listener, win);
+  win->feedback_commit_time = presentation_now(state);
+}
+
+// Nanoseconds until a commit made now is presented.
+static uint64_t presentation_horizon(struct wooz_window *win) {
+  if (win->predictor.latency_samples > 0) {
+    return win->predictor.latency;
+  }
+  // Without feedback, assume the next display frame.
+  int32_t refresh_mhz = win->output->refresh_mhz > 0
+                            ? win->output->refresh_mhz
+                            : PREDICT_DEFAULT_REFRESH_MHZ;
+  return 1000000000000ull / refresh_mhz;
+}
+
+static void set_predict_offset(struct wooz_window *win, double dx,
+                               double dy) {
+  win->view_source.x += dx - win->predict_dx;
+  win->view_source.y += dy - win->predict_dy;
+  win->predict_dx = dx;
+  win->predict_dy = dy;
+}
 
+// Offset the view by how far the pointer is expected to move before the
+// next commit is presented, so it doesn't lag behind fast movements.
+static void predict_view(struct wooz_window *win, uint32_t time, double x,
+                         double y) {
+  predictor_motion(&win->predictor, time, x, y);
+  uint64_t horizon = presentation_horizon(win);
+  double px, py;
+  predictor_predict(&win->predictor, horizon, &px, &py);
+  set_predict_offset(win, px - x, py - y);
+
+  // No motion event comes once the pointer rests, the view must then go
+  // back to where it is.
+  event_loop_schedule(win->state->event_loop, &win->predict_timer,
+                      horizon / 1000000 + PREDICT_SETTLE_MS, 0);
+}
+
+static void handle_predict_timer(void *data) {
+  struct wooz_window *win = data;
+  predictor_stop(&win->predictor);
+  set_predict_offset(win, 0, 0);
+  render_window(win);
+}
+
+static void input_enter(struct wooz_state *state, struct wooz_window *entered,
+                        wl_fixed_t sx, wl_fixed_t sy) {
   struct wooz_window *window;
   wl_list_for_each(window, &state->windows, link) {
-    if (window->surface == surface) {
+    if (window == entered) {
       window->is_focused = true;
       state->focused = window;
+      if (window->layer_surface != NULL) {
+        lens_track_pointer(window, wl_fixed_to_double(sx),
+                           wl_fixed_to_double(sy));
+        render_window(window);
+        update_pick(window);
+        continue;
+      }
       window->pointer_x = wl_fixed_to_double(sx);
       window->pointer_y = wl_fixed_to_double(sy);
+      update_pick(window);
+      if (window->cursor_surface != NULL) {
+        update_cursor(window);
+        commit_surface(window->state, window->surface);
+      }
     } else {
       window->is_focused = false;
     }
   }
 }
 
-static void pointer_handle_leave(void *data, struct wl_pointer *pointer,
-                                 uint32_t serial, struct wl_surface *surface) {
-  struct wooz_state *state = data;
-
-  struct wooz_window *window;
-  wl_list_for_each(window, &state->windows, link) {
-    if (window->surface == surface) {
-      window->is_focused = false;
-      break;
-    }
+static void input_leave(struct wooz_window *win) {
+  if (win == NULL) {
+    return;
+  }
+  win->is_focused = false;
+  if (win->cursor_surface != NULL) {
+    hide_cursor(win);
+    commit_surface(win->state, win->surface);
   }
 }
 
-static void pointer_handle_motion(void *data, struct wl_pointer *pointer,
-                                  uint32_t time, wl_fixed_t sx, wl_fixed_t sy) {
-  struct wooz_state *state = data;
+static void input_motion(struct wooz_state *state, uint32_t time,
+                         wl_fixed_t sx, wl_fixed_t sy) {
   struct wooz_window *win = state->focused;
+  if (win == NULL) {
+    // The focused window was removed with its output.
+    return;
+  }
 
   double x = wl_fixed_to_double(sx);
   double y = wl_fixed_to_double(sy);
 
+  if (win->layer_surface != NULL) {
+    lens_track_pointer(win, x, y);
+    render_window(win);
+    update_pick(win);
+    return;
+  }
+
   if (win->pointer_pressed) {
     double scale = win->view_source.width / win->output->logical_geometry.width;
 
@@ -541,18 +2733,36 @@ static void pointer_handle_motion(void *data, struct wl_pointer *pointer,
 
     win->view_source.x += dx;
     win->view_source.y += dy;
+    if (state->config.predict) {
+      predict_view(win, time, x, y);
+      request_presentation_feedback(win);
+    }
     render_window(win);
   }
 
   win->pointer_x = x;
   win->pointer_y = y;
+  update_pick(win);
+
+  // Only subsurfaces move, the capture isn't attached again. The detail
+  // follows the pointer while the view is larger than it.
+  if (win->detail_surface != NULL) {
+    update_detail(win);
+  }
+  if (win->cursor_surface != NULL) {
+    update_cursor(win);
+  }
+  if (win->detail_surface != NULL || win->cursor_surface != NULL) {
+    commit_surface(win->state, win->surface);
+  }
 }
 
-static void pointer_handle_button(void *data, struct wl_pointer *pointer,
-                                  uint32_t serial, uint32_t time,
-                                  uint32_t button, uint32_t button_state) {
-  struct wooz_state *state = data;
+static void input_button(struct wooz_state *state, uint32_t time,
+                         uint32_t button, uint32_t button_state) {
   struct wooz_window *win = state->focused;
+  if (win == NULL) {
+    return;
+  }
 
   if (button == BTN_LEFT) {
     if (button_state == WL_POINTER_BUTTON_STATE_PRESSED) {
@@ -577,12 +2787,24 @@ static void pointer_handle_button(void *data, struct wl_pointer *pointer,
   }
 }
 
-static void pointer_handle_axis(void *data, struct wl_pointer *pointer,
-                                uint32_t time, uint32_t axis,
-                                wl_fixed_t value) {
-
-  struct wooz_state *state = data;
+static void input_axis(struct wooz_state *state, uint32_t axis,
+                       wl_fixed_t value) {
   struct wooz_window *win = state->focused;
+  if (win == NULL) {
+    return;
+  }
+
+  if (win->layer_surface != NULL) {
+    if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL) {
+      double scroll = wl_fixed_to_double(value);
+      if (state->config.invert_scroll) {
+        scroll = -scroll;
+      }
+      apply_lens_zoom(win, 1.0 + scroll / 100.0);
+      render_window(win);
+    }
+    return;
+  }
 
   double scale = win->view_source.width / win->output->geometry.width;
   // x10 for faster zoom.
@@ -596,37 +2818,12 @@ static void pointer_handle_axis(void *data, struct wl_pointer *pointer,
   if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL) {
     apply_zoom(win, scroll, win->pointer_x, win->pointer_y);
     render_window(win);
+    update_pick(win);
   }
 }
 
-static const struct wl_pointer_listener pointer_listener = {
-    .enter = pointer_handle_enter,
-    .leave = pointer_handle_leave,
-    .motion = pointer_handle_motion,
-    .button = pointer_handle_button,
-    .axis = pointer_handle_axis,
-};
-
-static void keyboard_handle_keymap(void *data, struct wl_keyboard *keyboard,
-                                   uint32_t format, int32_t fd, uint32_t size) {
-  close(fd);
-}
-
-static void keyboard_handle_enter(void *data, struct wl_keyboard *keyboard,
-                                  uint32_t serial, struct wl_surface *surface,
-                                  struct wl_array *keys) {
-  // No-op
-}
-
-static void keyboard_handle_leave(void *data, struct wl_keyboard *keyboard,
-                                  uint32_t serial, struct wl_surface *surface) {
-  // No-op
-}
-
-static void keyboard_handle_key(void *data, struct wl_keyboard *keyboard,
-                                uint32_t serial, uint32_t time, uint32_t key,
-                                uint32_t key_state) {
-  struct wooz_state *state = data;
+static void input_key(struct wooz_state *state, uint32_t key,
+                      uint32_t key_state) {
   struct wooz_window *win = state->focused;
 
   if (win == NULL) {
@@ -655,6 +2852,18 @@ static void keyboard_handle_key(void *data, struct wl_keyboard *keyboard,
     }
     break;
 
+  case KEY_D:
+    toggle_diff(win->output);
+    break;
+
+  case KEY_COMMA:
+    step_history(win->output, 1);
+    break;
+
+  case KEY_DOT:
+    step_history(win->output, -1);
+    break;
+
   case KEY_0:
   case KEY_KP0:
     // Restore/unzoom
@@ -680,17 +2889,274 @@ static void keyboard_handle_key(void *data, struct wl_keyboard *keyboard,
   }
 }
 
+// Act on a seat event or one replayed by --replay-input. win is the window
+// entered or left, NULL for other events.
+static void dispatch_input(struct wooz_state *state, struct wooz_window *win,
+                           const struct wooz_input_event *event) {
+  switch (event->type) {
+  case WOOZ_INPUT_ENTER:
+    input_enter(state, win, event->x, event->y);
+    break;
+  case WOOZ_INPUT_LEAVE:
+    input_leave(win);
+    break;
+  case WOOZ_INPUT_MOTION:
+    input_motion(state, event->time, event->x, event->y);
+    break;
+  case WOOZ_INPUT_BUTTON:
+    input_button(state, event->time, event->code, event->state);
+    break;
+  case WOOZ_INPUT_AXIS:
+    input_axis(state, event->code, event->x);
+    break;
+  case WOOZ_INPUT_KEY:
+    input_key(state, event->code, event->state);
+    break;
+  case WOOZ_INPUT_KEYBOARD_LEAVE:
+    // No release event follows once the keyboard left.
+    stop_key_repeat(state);
+    break;
+  default:
+    break;
+  }
+}
+
+// Seat events are logged by --record-input, and ignored while --replay-input
+// feeds its own.
+static void handle_input(struct wooz_state *state, struct wooz_window *win,
+                         struct wooz_input_event *event) {
+  if (state->replay.log != NULL) {
+    return;
+  }
+  if (state->input_log != NULL) {
+    const char *name = win != NULL ? win->output->name : NULL;
+    snprintf(event->output, sizeof(event->output), "%s",
+             name != NULL ? name : "-");
+    input_log_write(state->input_log, event);
+  }
+  dispatch_input(state, win, event);
+}
+
+// Window of output name as logged by handle_input(), NULL if there is none.
+static struct wooz_window *find_output_window(struct wooz_state *state,
+                                              const char *name) {
+  struct wooz_window *win;
+  wl_list_for_each(win, &state->windows, link) {
+    const char *output = win->output->name != NULL ? win->output->name : "-";
+    if (strcmp(output, name) == 0) {
+      return win;
+    }
+  }
+  return NULL;
+}
+
+static void finish_replay(struct wooz_state *state) {
+  struct wooz_input_log *log = state->replay.log;
+  if (log->invalid) {
+    fprintf(stderr, "invalid event at line %zu of %s\n", log->line,
+            state->config.replay_path);
+  }
+  uint64_t elapsed = stats_now() - state->replay.start;
+  printf("replayed %zu events in %.3f ms, %" PRIu64 " commits\n",
+         state->replay.n_events, elapsed / 1e6,
+         state->stats.commits - state->replay.commits);
+  input_log_destroy(log);
+  state->replay.log = NULL;
+  state->n_done = 0;
+}
+
+// Feed the logged events at their pace, or one per event loop iteration with
+// --replay-fast so rendering still happens in between.
+static void handle_replay_timer(void *data) {
+  struct wooz_state *state = data;
+  struct wooz_input_event *event = &state->replay.next;
+  while (state->replay.has_next) {
+    uint64_t due = event->when - state->replay.offset;
+    uint64_t elapsed = stats_now() - state->replay.start;
+    if (!state->config.replay_fast && due > elapsed) {
+      event_loop_schedule(state->event_loop, &state->replay.timer,
+                          (due - elapsed + 999999) / 1000000, 0);
+      return;
+    }
+
+    struct wooz_window *win = NULL;
+    if (event->type == WOOZ_INPUT_ENTER || event->type == WOOZ_INPUT_LEAVE) {
+      win = find_output_window(state, event->output);
+    }
+    dispatch_input(state, win, event);
+    state->replay.n_events++;
+    state->replay.has_next = input_log_read(state->replay.log, event);
+    if (state->config.replay_fast && state->replay.has_next) {
+      event_loop_schedule(state->event_loop, &state->replay.timer, 0, 0);
+      return;
+    }
+  }
+  finish_replay(state);
+}
+
+static bool windows_configured(struct wooz_state *state) {
+  struct wooz_window *win;
+  wl_list_for_each(win, &state->windows, link) {
+    if (!win->is_configured) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void start_replay(struct wooz_state *state) {
+  state->replay.has_next =
+      input_log_read(state->replay.log, &state->replay.next);
+  state->replay.offset = state->replay.next.when;
+  state->replay.start = stats_now();
+  state->replay.commits = state->stats.commits;
+  event_loop_schedule(state->event_loop, &state->replay.timer, 0, 0);
+}
+
+static struct wooz_window *find_surface_window(struct wooz_state *state,
+                                               struct wl_surface *surface) {
+  struct wooz_window *win;
+  wl_list_for_each(win, &state->windows, link) {
+    if (win->surface == surface) {
+      return win;
+    }
+  }
+  return NULL;
+}
+
+static void pointer_handle_enter(void *data, struct wl_pointer *pointer,
+                                 uint32_t serial, struct wl_surface *surface,
+                                 wl_fixed_t sx, wl_fixed_t sy) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_POINTER);
+
+  struct wooz_window *win = find_surface_window(state, surface);
+  if (win != NULL && win->cursor_surface != NULL &&
+      state->replay.log == NULL) {
+    // The magnified cursor replaces the compositor one.
+    wl_pointer_set_cursor(pointer, serial, NULL, 0, 0);
+  }
+  struct wooz_input_event event = {
+      .type = WOOZ_INPUT_ENTER,
+      .x = sx,
+      .y = sy,
+  };
+  handle_input(state, win, &event);
+}
+
+static void pointer_handle_leave(void *data, struct wl_pointer *pointer,
+                                 uint32_t serial, struct wl_surface *surface) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_POINTER);
+
+  struct wooz_input_event event = {.type = WOOZ_INPUT_LEAVE};
+  handle_input(state, find_surface_window(state, surface), &event);
+}
+
+static void pointer_handle_motion(void *data, struct wl_pointer *pointer,
+                                  uint32_t time, wl_fixed_t sx, wl_fixed_t sy) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_POINTER);
+
+  struct wooz_input_event event = {
+      .type = WOOZ_INPUT_MOTION,
+      .time = time,
+      .x = sx,
+      .y = sy,
+  };
+  handle_input(state, NULL, &event);
+}
+
+static void pointer_handle_button(void *data, struct wl_pointer *pointer,
+                                  uint32_t serial, uint32_t time,
+                                  uint32_t button, uint32_t button_state) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_POINTER);
+
+  struct wooz_input_event event = {
+      .type = WOOZ_INPUT_BUTTON,
+      .time = time,
+      .code = button,
+      .state = button_state,
+  };
+  handle_input(state, NULL, &event);
+}
+
+static void pointer_handle_axis(void *data, struct wl_pointer *pointer,
+                                uint32_t time, uint32_t axis,
+                                wl_fixed_t value) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_POINTER);
+
+  struct wooz_input_event event = {
+      .type = WOOZ_INPUT_AXIS,
+      .time = time,
+      .code = axis,
+      .x = value,
+  };
+  handle_input(state, NULL, &event);
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+    .enter = pointer_handle_enter,
+    .leave = pointer_handle_leave,
+    .motion = pointer_handle_motion,
+    .button = pointer_handle_button,
+    .axis = pointer_handle_axis,
+};
+
+static void keyboard_handle_keymap(void *data, struct wl_keyboard *keyboard,
+                                   uint32_t format, int32_t fd, uint32_t size) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_KEYBOARD);
+
+  close(fd);
+}
+
+static void keyboard_handle_enter(void *data, struct wl_keyboard *keyboard,
+                                  uint32_t serial, struct wl_surface *surface,
+                                  struct wl_array *keys) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_KEYBOARD);
+}
+
+static void keyboard_handle_leave(void *data, struct wl_keyboard *keyboard,
+                                  uint32_t serial, struct wl_surface *surface) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_KEYBOARD);
+
+  struct wooz_input_event event = {.type = WOOZ_INPUT_KEYBOARD_LEAVE};
+  handle_input(state, NULL, &event);
+}
+
+static void keyboard_handle_key(void *data, struct wl_keyboard *keyboard,
+                                uint32_t serial, uint32_t time, uint32_t key,
+                                uint32_t key_state) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_KEYBOARD);
+
+  struct wooz_input_event event = {
+      .type = WOOZ_INPUT_KEY,
+      .time = time,
+      .code = key,
+      .state = key_state,
+  };
+  handle_input(state, NULL, &event);
+}
+
 static void keyboard_handle_modifiers(void *data, struct wl_keyboard *keyboard,
                                       uint32_t serial, uint32_t mods_depressed,
                                       uint32_t mods_latched,
                                       uint32_t mods_locked, uint32_t group) {
-  // No-op
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_KEYBOARD);
 }
 
 static void keyboard_handle_repeat_info(void *data,
                                         struct wl_keyboard *keyboard,
                                         int32_t rate, int32_t delay) {
-  // No-op
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_KEYBOARD);
 }
 
 static const struct wl_keyboard_listener keyboard_listener = {
@@ -705,6 +3171,7 @@ static const struct wl_keyboard_listener keyboard_listener = {
 static void seat_handle_capabilities(void *data, struct wl_seat *seat,
                                      uint32_t capabilities) {
   struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_SEAT);
 
   if ((capabilities & WL_SEAT_CAPABILITY_POINTER) != 0) {
     state->pointer = wl_seat_get_pointer(seat);
@@ -731,14 +3198,30 @@ static const struct wl_seat_listener seat_listener = {
     .capabilities = seat_handle_capabilities,
 };
 
+static void presentation_handle_clock_id(void *data,
+                                         struct wp_presentation *presentation,
+                                         uint32_t clk_id) {
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_PRESENTATION);
+  state->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+    .clock_id = presentation_handle_clock_id,
+};
+
 static void handle_global(void *data, struct wl_registry *registry,
                           uint32_t name, const char *interface,
                           uint32_t version) {
   struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_REGISTRY);
 
   if (strcmp(interface, wl_compositor_interface.name) == 0) {
     state->compositor =
         wl_registry_bind(registry, name, &wl_compositor_interface, 5);
+  } else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+    state->subcompositor =
+        wl_registry_bind(registry, name, &wl_subcompositor_interface, 1);
   } else if (strcmp(interface, wl_shm_interface.name) == 0) {
     state->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
   } else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
@@ -748,21 +3231,57 @@ static void handle_global(void *data, struct wl_registry *registry,
   } else if (strcmp(interface, wl_output_interface.name) == 0) {
     struct wooz_output *output = calloc(1, sizeof(struct wooz_output));
     output->state = state;
+    output->global_name = name;
     output->scale = 1;
+    wl_array_init(&output->capture_damage);
+    timer_init(&output->refresh_timer, handle_refresh, output);
+    timer_init(&output->change_timer, handle_output_change, output);
     output->wl_output =
         wl_registry_bind(registry, name, &wl_output_interface, 3);
     wl_output_add_listener(output->wl_output, &output_listener, output);
     wl_list_insert(&state->outputs, &output->link);
+
+    // Outputs present at startup get their xdg_output in main.
+    if (state->running && state->xdg_output_manager != NULL) {
+      output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+          state->xdg_output_manager, output->wl_output);
+      zxdg_output_v1_add_listener(output->xdg_output, &xdg_output_listener,
+                                  output);
+    }
   } else if (strcmp(interface, zwlr_screencopy_manager_v1_interface.name) ==
              0) {
+    uint32_t bind_version = (version > 3) ? 3 : version;
     state->screencopy_manager = wl_registry_bind(
-        registry, name, &zwlr_screencopy_manager_v1_interface, 1);
+        registry, name, &zwlr_screencopy_manager_v1_interface, bind_version);
+  } else if (strcmp(interface,
+                    ext_output_image_capture_source_manager_v1_interface
+                        .name) == 0) {
+    state->output_source_manager = wl_registry_bind(
+        registry, name, &ext_output_image_capture_source_manager_v1_interface,
+        1);
+  } else if (strcmp(interface,
+                    ext_image_copy_capture_manager_v1_interface.name) == 0) {
+    state->image_copy_manager = wl_registry_bind(
+        registry, name, &ext_image_copy_capture_manager_v1_interface, 1);
   } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
-    state->shell = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+    // Version 6 reports suspended toplevels.
+    uint32_t bind_version = (version > 6) ? 6 : version;
+    state->shell = wl_registry_bind(registry, name, &xdg_wm_base_interface,
+                                    bind_version);
     xdg_wm_base_add_listener(state->shell, &xdg_wm_base_listener, state);
   } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
     state->viewporter =
         wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+  } else if (strcmp(interface, wp_presentation_interface.name) == 0 &&
+             state->config.predict) {
+    state->presentation =
+        wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+    wp_presentation_add_listener(state->presentation, &presentation_listener,
+                                 state);
+  } else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
+    uint32_t bind_version = (version > 3) ? 3 : version;
+    state->layer_shell = wl_registry_bind(
+        registry, name, &zwlr_layer_shell_v1_interface, bind_version);
   } else if (strcmp(interface, wl_seat_interface.name) == 0) {
     state->seat = wl_registry_bind(registry, name, &wl_seat_interface, 1);
     wl_seat_add_listener(state->seat, &seat_listener, state);
@@ -771,7 +3290,37 @@ static void handle_global(void *data, struct wl_registry *registry,
 
 static void handle_global_remove(void *data, struct wl_registry *registry,
                                  uint32_t name) {
-  // who cares
+  struct wooz_state *state = data;
+  count_event(state, WOOZ_STATS_REGISTRY);
+
+  struct wooz_output *output;
+  bool found = false;
+  wl_list_for_each(output, &state->outputs, link) {
+    if (output->global_name == name) {
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    return;
+  }
+  if (!state->running && output->active) {
+    fprintf(stderr, "output %s was removed during startup\n", output->name);
+    exit(EXIT_FAILURE);
+  }
+
+  struct wooz_window *win, *tmp;
+  wl_list_for_each_safe(win, tmp, &state->windows, link) {
+    if (win->output == output) {
+      destroy_window(win);
+    }
+  }
+  destroy_output(output);
+
+  if (state->running && wl_list_empty(&state->windows)) {
+    // Nothing left to show.
+    state->n_done = 0;
+  }
 }
 
 static const struct wl_registry_listener registry_listener = {
@@ -787,10 +3336,51 @@ static const char usage[] =
     "  --map-close KEY         Set key to close (e.g., 'Esc', 'q')\n"
     "  --mouse-track           Enable mouse tracking (follow mouse without "
     "clicking)\n"
+    "  --predict               Follow the pointer where it will be when the "
+    "view is\n"
+    "                          shown, with --mouse-track\n"
     "  --output NAME           Run on specific output (e.g., 'DP-1')\n"
     "  --zoom-in PERCENT       Set initial zoom percentage (e.g., '10%', "
     "'50%')\n"
     "  --invert-scroll         Invert scroll direction (scroll up zooms in)\n"
+    "  --lens WxH              Show a WxH magnifier lens following the "
+    "pointer\n"
+    "  --refresh MS[:MAX]      Recapture the screen every MS milliseconds, "
+    "or\n"
+    "                          adaptively between MS and MAX\n"
+    "  --history N             Keep the last N captures to step through, "
+    "with\n"
+    "                          --refresh\n"
+    "  --pick SIZE             Print the mean colour of the SIZExSIZE square "
+    "under\n"
+    "                          the pointer\n"
+    "  --pixel-grid            Show pixel boundaries at high zoom\n"
+    "  --pre-rotate            Rotate captures of transformed outputs "
+    "upright once\n"
+    "  --magnify-cursor        Draw the cursor magnified with the view\n"
+    "  --stats[=FORMAT]        Print statistics on exit and SIGUSR1 (text, "
+    "json)\n"
+    "  --image FILE            Show a PNM, PAM, QOI or PNG image instead of "
+    "the\n"
+    "                          screen\n"
+    "  --input-raw WxH:FORMAT  Show raw frames read from stdin instead of the "
+    "screen\n"
+    "  --memory-budget MB      Keep captures within MB megabytes, "
+    "downscaled away\n"
+    "                          from the view and the pointer\n"
+    "  --kernels MODE          Pixel kernels instruction set: auto, "
+    "calibrate,\n"
+    "                          scalar, sse2, avx2 or avx512\n"
+    "  --publish PATH          Publish the view to readers of the unix "
+    "socket\n"
+    "                          PATH\n"
+    "  --record FILE           Record the view to FILE as a Y4M video\n"
+    "  --record-input FILE     Log pointer and keyboard events to FILE\n"
+    "  --replay-input FILE     Replay the events logged to FILE, report the "
+    "time\n"
+    "                          and commits it took and quit\n"
+    "  --replay-fast           Replay events as fast as they are handled\n"
+    "  --version               Show version and selected kernels and quit\n"
     "\n"
     "Controls:\n"
     "  Mouse scroll            Zoom in/out at mouse position\n"
@@ -800,6 +3390,9 @@ static const char usage[] =
     "  +/-                     Zoom in/out at center\n"
     "  Arrow keys              Pan the view\n"
     "  0                       Restore/unzoom\n"
+    "  d                       Diff a recapture against the capture, or hide\n"
+    "                          the diff\n"
+    "  ,/.                     Step back/forward through the kept captures\n"
     "  Esc                     Exit (default)\n";
 
 static bool should_include_output(struct wooz_output *output,
@@ -818,6 +3411,397 @@ static bool should_include_output(struct wooz_output *output,
   return strcmp(output->name, filter) == 0;
 }
 
+static void destroy_window(struct wooz_window *win) {
+  struct wooz_state *state = win->state;
+  if (state->focused == win) {
+    stop_key_repeat(state);
+    state->focused = NULL;
+  }
+  if (state->record.window == win) {
+    // The next window created is recorded instead.
+    state->record.window = NULL;
+    state->record.buffer = NULL;
+  }
+
+  wl_list_remove(&win->link);
+  if (win->frame_callback != NULL)
+    wl_callback_destroy(win->frame_callback);
+  if (win->presentation_feedback != NULL)
+    wp_presentation_feedback_destroy(win->presentation_feedback);
+  event_loop_cancel(state->event_loop, &win->predict_timer);
+  if (win->layer_surface != NULL)
+    zwlr_layer_surface_v1_destroy(win->layer_surface);
+  destroy_window_buffers(win);
+  if (win->grid_viewport != NULL)
+    wp_viewport_destroy(win->grid_viewport);
+  if (win->grid_subsurface != NULL)
+    wl_subsurface_destroy(win->grid_subsurface);
+  if (win->grid_surface != NULL)
+    wl_surface_destroy(win->grid_surface);
+  destroy_grid_buffers(win);
+  if (win->detail_viewport != NULL)
+    wp_viewport_destroy(win->detail_viewport);
+  if (win->detail_subsurface != NULL)
+    wl_subsurface_destroy(win->detail_subsurface);
+  if (win->detail_surface != NULL)
+    wl_surface_destroy(win->detail_surface);
+  if (win->cursor_viewport != NULL)
+    wp_viewport_destroy(win->cursor_viewport);
+  if (win->cursor_subsurface != NULL)
+    wl_subsurface_destroy(win->cursor_subsurface);
+  if (win->cursor_surface != NULL)
+    wl_surface_destroy(win->cursor_surface);
+  if (win->xdg_toplevel != NULL)
+    xdg_toplevel_destroy(win->xdg_toplevel);
+  if (win->xdg_surface != NULL)
+    xdg_surface_destroy(win->xdg_surface);
+  if (win->viewport != NULL)
+    wp_viewport_destroy(win->viewport);
+  if (win->surface != NULL)
+    wl_surface_destroy(win->surface);
+  free(win);
+}
+
+static void destroy_output(struct wooz_output *output) {
+  struct wooz_state *state = output->state;
+  event_loop_cancel(state->event_loop, &output->refresh_timer);
+  event_loop_cancel(state->event_loop, &output->change_timer);
+  worker_destroy(output->worker);
+  free(output->capture_work.changed);
+  wl_list_remove(&output->link);
+  if (output->name != NULL)
+    free(output->name);
+  screencopy_cancel(&output->screencopy);
+  if (output->image_copy_frame != NULL) {
+    ext_image_copy_capture_frame_v1_destroy(output->image_copy_frame);
+  }
+  screencopy_cancel(&output->detail_copy);
+  if (output->image_copy_session != NULL) {
+    ext_image_copy_capture_session_v1_destroy(output->image_copy_session);
+  }
+  if (output->image_capture_source != NULL) {
+    ext_image_capture_source_v1_destroy(output->image_capture_source);
+  }
+  if (state->stream == NULL) {
+    // Input frames are owned by the stream.
+    destroy_buffer(output->buffer);
+  }
+  destroy_buffer(output->back_buffer);
+  destroy_buffer(output->changed_buffer);
+  destroy_buffer(output->raw_buffer);
+  destroy_buffer(output->diff_buffer);
+  destroy_buffer(output->history_buffers[0]);
+  destroy_buffer(output->history_buffers[1]);
+  history_destroy(output->history);
+  destroy_buffer(output->strip);
+  destroy_buffer(output->details[0]);
+  destroy_buffer(output->details[1]);
+  free(output->downscaler.sums);
+  wl_array_release(&output->capture_damage);
+  if (output->xdg_output != NULL) {
+    zxdg_output_v1_destroy(output->xdg_output);
+  }
+  wl_output_release(output->wl_output);
+  free(output);
+}
+
+// Show output in a new window. Returns false if it couldn't be created.
+static bool create_window(struct wooz_state *state,
+                          struct wooz_output *output) {
+  struct wooz_window *win = calloc(1, sizeof(struct wooz_window));
+  if (win == NULL) {
+    return false;
+  }
+  wl_list_insert(&state->windows, &win->link);
+  win->state = state;
+  win->output = output;
+  timer_init(&win->predict_timer, handle_predict_timer, win);
+  win->surface = wl_compositor_create_surface(state->compositor);
+  win->viewport = wp_viewporter_get_viewport(state->viewporter, win->surface);
+  win->view_source = initial_view_source(state, output);
+  win->initial_view_source = win->view_source;
+
+  if (state->config.record_path != NULL && state->record.window == NULL &&
+      !record_window(state, win)) {
+    return false;
+  }
+
+  if (win->surface == NULL) {
+    fprintf(stderr, "failed to create wayland surface\n");
+    return false;
+  }
+
+  if (state->config.lens_width > 0) {
+    int32_t width = state->config.lens_width;
+    int32_t height = state->config.lens_height;
+    win->lens_zoom = lens_initial_zoom(&state->config);
+    win->lens_x = (output->logical_geometry.width - width) / 2;
+    win->lens_y = (output->logical_geometry.height - height) / 2;
+    win->pointer_x = win->lens_x + width / 2.0;
+    win->pointer_y = win->lens_y + height / 2.0;
+
+    win->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+        state->layer_shell, win->surface, output->wl_output,
+        ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "wooz");
+    zwlr_layer_surface_v1_add_listener(win->layer_surface,
+                                       &layer_surface_listener, win);
+    zwlr_layer_surface_v1_set_size(win->layer_surface, width, height);
+    zwlr_layer_surface_v1_set_anchor(win->layer_surface,
+                                     ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
+                                         ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT);
+    zwlr_layer_surface_v1_set_exclusive_zone(win->layer_surface, -1);
+    zwlr_layer_surface_v1_set_margin(win->layer_surface, win->lens_y, 0, 0,
+                                     win->lens_x);
+    win->lens_committed_x = win->lens_x;
+    win->lens_committed_y = win->lens_y;
+    zwlr_layer_surface_v1_set_keyboard_interactivity(
+        win->layer_surface,
+        ZWLR_LAYER_SURFACE_V1_KEYBOARD_INTERACTIVITY_EXCLUSIVE);
+
+    commit_surface(win->state, win->surface);
+    return true;
+  }
+
+  win->xdg_surface = xdg_wm_base_get_xdg_surface(state->shell, win->surface);
+  xdg_surface_add_listener(win->xdg_surface, &xdg_surface_listener, win);
+  win->xdg_toplevel = xdg_surface_get_toplevel(win->xdg_surface);
+  xdg_toplevel_add_listener(win->xdg_toplevel, &xdg_toplevel_listener, win);
+  xdg_toplevel_set_app_id(win->xdg_toplevel, "dev.negrel.wooz");
+  xdg_toplevel_set_title(win->xdg_toplevel, "wooz");
+  xdg_toplevel_set_fullscreen(win->xdg_toplevel, output->wl_output);
+
+  if (output->tiers.scale > 0) {
+    // Created first to be stacked below the grid and the cursor.
+    win->detail_surface = wl_compositor_create_surface(state->compositor);
+    win->detail_subsurface = wl_subcompositor_get_subsurface(
+        state->subcompositor, win->detail_surface, win->surface);
+    win->detail_viewport =
+        wp_viewporter_get_viewport(state->viewporter, win->detail_surface);
+
+    struct wl_region *region =
+        wl_compositor_create_region(state->compositor);
+    wl_surface_set_input_region(win->detail_surface, region);
+    wl_region_destroy(region);
+    commit_surface(win->state, win->detail_surface);
+  }
+
+  if (state->config.pixel_grid) {
+    win->grid_surface = wl_compositor_create_surface(state->compositor);
+    win->grid_subsurface = wl_subcompositor_get_subsurface(
+        state->subcompositor, win->grid_surface, win->surface);
+    win->grid_viewport =
+        wp_viewporter_get_viewport(state->viewporter, win->grid_surface);
+    wp_viewport_set_destination(win->grid_viewport,
+                                output->logical_geometry.width,
+                                output->logical_geometry.height);
+
+    // Pointer events go through to the main surface.
+    struct wl_region *region =
+        wl_compositor_create_region(state->compositor);
+    wl_surface_set_input_region(win->grid_surface, region);
+    wl_region_destroy(region);
+    commit_surface(win->state, win->grid_surface);
+  }
+
+  if (state->config.magnify_cursor) {
+    // Created after the grid to be stacked above it.
+    win->cursor_surface = wl_compositor_create_surface(state->compositor);
+    win->cursor_subsurface = wl_subcompositor_get_subsurface(
+        state->subcompositor, win->cursor_surface, win->surface);
+    win->cursor_viewport =
+        wp_viewporter_get_viewport(state->viewporter, win->cursor_surface);
+
+    struct wl_region *region =
+        wl_compositor_create_region(state->compositor);
+    wl_surface_set_input_region(win->cursor_surface, region);
+    wl_region_destroy(region);
+    commit_surface(win->state, win->cursor_surface);
+  }
+
+  commit_surface(win->state, win->surface);
+  return true;
+}
+
+static void record_applied(struct wooz_output *output) {
+  output->applied.geometry = output->geometry;
+  output->applied.logical_geometry = output->logical_geometry;
+  output->applied.transform = output->transform;
+}
+
+// Show an output added at runtime, or recapture a shown output whose mode,
+// scale or transform changed.
+static void handle_output_change(void *data) {
+  struct wooz_output *output = data;
+  struct wooz_state *state = output->state;
+
+  if (state->xdg_output_manager == NULL) {
+    if (output->mode_changed) {
+      guess_output_logical_geometry(output);
+    } else {
+      // Only the scale changed, the geometry is already upright.
+      guess_logical_geometry(&output->geometry, output->scale,
+                             &output->logical_geometry,
+                             &output->logical_scale);
+    }
+    output->mode_changed = false;
+  }
+  if (output->logical_geometry.width == 0) {
+    // Waiting for xdg-output.
+    return;
+  }
+
+  bool transform_changed = output->transform != output->applied.transform;
+  if (output->active && !transform_changed && !output->change_failed &&
+      memcmp(&output->geometry, &output->applied.geometry,
+             sizeof(output->geometry)) == 0 &&
+      memcmp(&output->logical_geometry, &output->applied.logical_geometry,
+             sizeof(output->logical_geometry)) == 0) {
+    return;
+  }
+
+  if (!output->active) {
+    // Input frames are shown on a single output.
+    if (!should_include_output(output, state->config.output_filter) ||
+        state->stream != NULL) {
+      return;
+    }
+    output->active = true;
+    record_applied(output);
+    if (!uses_capture(state)) {
+      if (!create_window(state, output)) {
+        fprintf(stderr, "failed to create window for output %s\n",
+                output->name);
+      }
+      return;
+    }
+    // Outputs added at runtime aren't planned into --memory-budget.
+    output->worker = worker_create(state->event_loop);
+    capture_output(output, false);
+    return;
+  }
+
+  if (!uses_capture(state)) {
+    record_applied(output);
+    struct wooz_window *win;
+    wl_list_for_each(win, &state->windows, link) {
+      if (win->output == output) {
+        reset_window_view(win);
+        render_window(win);
+      }
+    }
+    return;
+  }
+
+  // Buffers in use by a capture or by the compositor are left alone.
+  if (capture_in_flight(output) || output->detail_copy.frame != NULL ||
+      (output->back_buffer != NULL && output->back_buffer->busy)) {
+    event_loop_schedule(state->event_loop, &output->change_timer,
+                        OUTPUT_CHANGE_RETRY_MS, 0);
+    return;
+  }
+  record_applied(output);
+  output->change_failed = false;
+  event_loop_cancel(state->event_loop, &output->refresh_timer);
+  output->diff_pending = false;
+  output->show_diff = false;
+  output->history_age = 0;
+  output->history_pending = 0;
+  if (output->history != NULL) {
+    history_clear(output->history);
+  }
+
+  if (output->tiers.scale > 0) {
+    // Tiered captures can't be pre-rotated, the output is then captured
+    // whole.
+    if (output->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+        !plan_tiers(output->geometry.width, output->geometry.height,
+                    output->tiers_budget, &output->tiers)) {
+      fprintf(stderr, "warning: output %s no longer fits --memory-budget, "
+                      "capturing it at full resolution\n",
+              output->name);
+      output->tiers.scale = 0;
+    }
+    struct wooz_window *win;
+    wl_list_for_each(win, &state->windows, link) {
+      if (win->output == output && win->detail_buffer != NULL) {
+        wl_surface_attach(win->detail_surface, NULL, 0, 0);
+        commit_surface(win->state, win->detail_surface);
+        win->detail_buffer = NULL;
+      }
+    }
+    destroy_buffer(output->details[0]);
+    destroy_buffer(output->details[1]);
+    output->details[0] = output->details[1] = NULL;
+    output->detail = NULL;
+  }
+  if (transform_changed) {
+    destroy_buffer(output->raw_buffer);
+    output->raw_buffer = NULL;
+  }
+
+  // Windows keep showing the previous capture until the new one is attached,
+  // it may still be read by the compositor. The spare buffer, idle, is
+  // reshaped in place when its pool is large enough, or created. After a
+  // failed capture, the previous one is still kept.
+  if (output->changed_buffer == NULL) {
+    output->changed_buffer = output->buffer;
+    output->buffer = output->back_buffer;
+    output->back_buffer = NULL;
+  }
+  capture_output(output, false);
+}
+
+// Plan the captures of the included outputs to fit --memory-budget. Captures
+// of transformed outputs are kept whole, the others share what is left in
+// proportion to their size. Returns false if they can't fit.
+static bool plan_memory_budget(struct wooz_state *state) {
+  size_t budget = state->config.memory_budget;
+  size_t total = 0, tierable = 0;
+  struct wooz_output *output;
+  wl_list_for_each(output, &state->outputs, link) {
+    if (!should_include_output(output, state->config.output_filter)) {
+      continue;
+    }
+    size_t size = (size_t)output->geometry.width * output->geometry.height * 4;
+    total += size;
+    if (output->transform == WL_OUTPUT_TRANSFORM_NORMAL) {
+      tierable += size;
+    }
+  }
+  if (total <= budget) {
+    return true;
+  }
+
+  if (state->screencopy_manager == NULL || state->subcompositor == NULL) {
+    fprintf(stderr, "--memory-budget requires wlr-screencopy-unstable-v1 "
+                    "and wl_subcompositor\n");
+    return false;
+  }
+  size_t fixed = total - tierable;
+  if (tierable == 0 || fixed >= budget) {
+    fprintf(stderr, "memory budget too small for the captures of "
+                    "transformed outputs\n");
+    return false;
+  }
+
+  wl_list_for_each(output, &state->outputs, link) {
+    if (!should_include_output(output, state->config.output_filter) ||
+        output->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+      continue;
+    }
+    size_t size = (size_t)output->geometry.width * output->geometry.height * 4;
+    size_t share = (size_t)((double)(budget - fixed) * size / tierable);
+    output->tiers_budget = share;
+    if (!plan_tiers(output->geometry.width, output->geometry.height, share,
+                    &output->tiers)) {
+      fprintf(stderr, "memory budget too small for output %s\n",
+              output->name);
+      return false;
+    }
+  }
+  return true;
+}
+
 static uint32_t parse_key_name(const char *name) {
   if (strcmp(name, "Esc") == 0 || strcmp(name, "Escape") == 0) {
     return KEY_ESC;
@@ -829,16 +3813,46 @@ static uint32_t parse_key_name(const char *name) {
   return 0; // Invalid key
 }
 
+static void print_version(void) {
+  printf("wooz %s\n", WOOZ_VERSION);
+  printf("cpu: %s\n", isa_name(kernels_supported_isa()));
+  printf("kernels:");
+  for (int i = 0; i < WOOZ_KERNEL_COUNT; i++) {
+    printf(" %s=%s", kernel_name(i), isa_name(kernel_isa(i)));
+  }
+  printf("\n");
+}
+
 int main(int argc, char *argv[]) {
-  struct wooz_config config = {0};
+  struct wooz_config config = {.max_isa = WOOZ_ISA_COUNT - 1};
+  bool show_version = false;
 
   static struct option long_options[] = {
       {"help", no_argument, 0, 'h'},
       {"map-close", required_argument, 0, 'c'},
       {"mouse-track", no_argument, 0, 'm'},
+      {"predict", no_argument, 0, 'P'},
       {"output", required_argument, 0, 'o'},
       {"zoom-in", required_argument, 0, 'z'},
       {"invert-scroll", no_argument, 0, 'i'},
+      {"lens", required_argument, 0, 'l'},
+      {"refresh", required_argument, 0, 'r'},
+      {"history", required_argument, 0, 'H'},
+      {"pick", required_argument, 0, 'p'},
+      {"pixel-grid", no_argument, 0, 'g'},
+      {"pre-rotate", no_argument, 0, 'R'},
+      {"magnify-cursor", no_argument, 0, 'C'},
+      {"stats", optional_argument, 0, 'S'},
+      {"image", required_argument, 0, 'I'},
+      {"input-raw", required_argument, 0, 'F'},
+      {"memory-budget", required_argument, 0, 'M'},
+      {"kernels", required_argument, 0, 'K'},
+      {"publish", required_argument, 0, 'u'},
+      {"record", required_argument, 0, 'w'},
+      {"record-input", required_argument, 0, 'L'},
+      {"replay-input", required_argument, 0, 'Y'},
+      {"replay-fast", no_argument, 0, 'T'},
+      {"version", no_argument, 0, 'V'},
       {0, 0, 0, 0}};
 
   int opt;
@@ -861,6 +3875,9 @@ int main(int argc, char *argv[]) {
     case 'm':
       config.mouse_track = true;
       break;
+    case 'P':
+      config.predict = true;
+      break;
     case 'o':
       config.output_filter = strdup(optarg);
       break;
@@ -882,26 +3899,274 @@ int main(int argc, char *argv[]) {
     case 'i':
       config.invert_scroll = true;
       break;
+    case 'g':
+      config.pixel_grid = true;
+      break;
+    case 'R':
+      config.pre_rotate = true;
+      break;
+    case 'C':
+      config.magnify_cursor = true;
+      break;
+    case 'S':
+      if (optarg == NULL || strcmp(optarg, "text") == 0) {
+        config.stats = WOOZ_STATS_TEXT;
+      } else if (strcmp(optarg, "json") == 0) {
+        config.stats = WOOZ_STATS_JSON;
+      } else {
+        fprintf(stderr, "Invalid stats format: %s (text or json)\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'I':
+      config.image_path = strdup(optarg);
+      break;
+    case 'F': {
+      char *endptr;
+      long width = strtol(optarg, &endptr, 10);
+      long height = 0;
+      if (*endptr == 'x') {
+        height = strtol(endptr + 1, &endptr, 10);
+      }
+      if (*endptr != ':' ||
+          !parse_shm_format(endptr + 1, &config.input_format) ||
+          width <= 0 || height <= 0 || width > INT16_MAX ||
+          height > INT16_MAX) {
+        fprintf(stderr,
+                "Invalid raw input: %s (e.g. '1920x1080:xrgb8888')\n",
+                optarg);
+        return EXIT_FAILURE;
+      }
+      config.input_width = width;
+      config.input_height = height;
+      break;
+    }
+    case 'M': {
+      char *endptr;
+      long budget = strtol(optarg, &endptr, 10);
+      if (*endptr != '\0' || budget <= 0 ||
+          (unsigned long)budget > SIZE_MAX >> 20) {
+        fprintf(stderr, "Invalid memory budget: %s (e.g. '256')\n", optarg);
+        return EXIT_FAILURE;
+      }
+      config.memory_budget = (size_t)budget << 20;
+      break;
+    }
+    case 'K':
+      if (strcmp(optarg, "calibrate") == 0) {
+        config.calibrate_kernels = true;
+      } else if (strcmp(optarg, "auto") != 0 &&
+                 !parse_isa(optarg, &config.max_isa)) {
+        fprintf(stderr,
+                "Invalid kernels: %s (auto, calibrate, scalar, sse2, avx2 "
+                "or avx512)\n",
+                optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'u':
+      config.publish_path = strdup(optarg);
+      break;
+    case 'w':
+      config.record_path = strdup(optarg);
+      break;
+    case 'L':
+      config.input_log_path = strdup(optarg);
+      break;
+    case 'Y':
+      config.replay_path = strdup(optarg);
+      break;
+    case 'T':
+      config.replay_fast = true;
+      break;
+    case 'V':
+      show_version = true;
+      break;
+    case 'l': {
+      char *endptr;
+      config.lens_width = strtol(optarg, &endptr, 10);
+      if (*endptr == 'x') {
+        config.lens_height = strtol(endptr + 1, &endptr, 10);
+      }
+      if (*endptr != '\0' || config.lens_width <= 0 ||
+          config.lens_height <= 0) {
+        fprintf(stderr, "Invalid lens size: %s (e.g. '400x300')\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    }
+    case 'r': {
+      char *endptr;
+      long refresh = strtol(optarg, &endptr, 10);
+      long refresh_max = 0;
+      if (*endptr == ':') {
+        refresh_max = strtol(endptr + 1, &endptr, 10);
+      }
+      if (*endptr != '\0' || refresh <= 0 || refresh > UINT32_MAX ||
+          refresh_max < 0 || refresh_max > UINT32_MAX ||
+          (refresh_max != 0 && refresh_max < refresh)) {
+        fprintf(stderr,
+                "Invalid refresh interval: %s (e.g. '500' or '16:1000')\n",
+                optarg);
+        return EXIT_FAILURE;
+      }
+      config.refresh_ms = refresh;
+      config.refresh_max_ms = refresh_max;
+      break;
+    }
+    case 'H': {
+      char *endptr;
+      long size = strtol(optarg, &endptr, 10);
+      if (*endptr != '\0' || size < 2 || size > INT16_MAX) {
+        fprintf(stderr, "Invalid history size: %s (e.g. '64')\n", optarg);
+        return EXIT_FAILURE;
+      }
+      config.history_size = size;
+      break;
+    }
+    case 'p': {
+      char *endptr;
+      long size = strtol(optarg, &endptr, 10);
+      if (*endptr != '\0' || size <= 0 || size * size > SAT_MAX_AREA) {
+        fprintf(stderr, "Invalid pick size: %s (e.g. '1', '5')\n", optarg);
+        return EXIT_FAILURE;
+      }
+      config.pick_size = size;
+      break;
+    }
     default:
       fprintf(stderr, "%s", usage);
       return EXIT_FAILURE;
     }
   }
 
+  if (config.image_path != NULL &&
+      (config.lens_width > 0 || config.refresh_ms > 0 ||
+       config.pick_size > 0 || config.pre_rotate || config.input_width > 0)) {
+    fprintf(stderr, "--image can't be combined with --lens, --refresh, "
+                    "--pick, --pre-rotate or --input-raw\n");
+    return EXIT_FAILURE;
+  }
+  if (config.input_width > 0 && (config.lens_width > 0 ||
+                                 config.refresh_ms > 0 || config.pre_rotate)) {
+    fprintf(stderr, "--input-raw can't be combined with --lens, --refresh "
+                    "or --pre-rotate\n");
+    return EXIT_FAILURE;
+  }
+
+  if (config.memory_budget > 0 &&
+      (config.lens_width > 0 || config.refresh_ms > 0 ||
+       config.pick_size > 0 || config.image_path != NULL ||
+       config.input_width > 0)) {
+    fprintf(stderr, "--memory-budget can't be combined with --lens, "
+                    "--refresh, --pick, --image or --input-raw\n");
+    return EXIT_FAILURE;
+  }
+
+  if (config.history_size > 0 && config.refresh_ms == 0) {
+    fprintf(stderr, "--history requires --refresh\n");
+    return EXIT_FAILURE;
+  }
+  if (config.predict && !config.mouse_track) {
+    fprintf(stderr, "--predict requires --mouse-track\n");
+    return EXIT_FAILURE;
+  }
+  if (config.replay_fast && config.replay_path == NULL) {
+    fprintf(stderr, "--replay-fast requires --replay-input\n");
+    return EXIT_FAILURE;
+  }
+  if (config.input_log_path != NULL && config.replay_path != NULL) {
+    fprintf(stderr, "--record-input can't be combined with --replay-input\n");
+    return EXIT_FAILURE;
+  }
+
+  // Kernels are fixed before any pixel is processed or worker started.
+  if (config.calibrate_kernels) {
+    kernels_calibrate(config.max_isa);
+  } else {
+    kernels_select(config.max_isa);
+  }
+  if (show_version) {
+    print_version();
+    return EXIT_SUCCESS;
+  }
+
   struct wooz_state state = {0};
   state.config = config;
-  state.repeat_timer_fd = -1;
+  timer_init(&state.repeat_timer, handle_key_repeat, &state);
+  timer_init(&state.record.timer, handle_record_timer, &state);
+  timer_init(&state.replay.timer, handle_replay_timer, &state);
+  timer_init(&state.stream_timer, handle_stream_timer, &state);
+  state.presentation_clock = CLOCK_MONOTONIC;
   wl_list_init(&state.outputs);
   wl_list_init(&state.windows);
 
+  if (state.config.image_path != NULL) {
+    state.image =
+        image_open(state.config.image_path, IMAGE_DEFAULT_CACHE_SIZE);
+    if (state.image == NULL) {
+      return EXIT_FAILURE;
+    }
+  }
+
   state.display = wl_display_connect(NULL);
   if (state.display == NULL) {
     fprintf(stderr, "failed to create display\n");
     return EXIT_FAILURE;
   }
 
+  state.event_loop = event_loop_create(state.display);
+  if (state.event_loop == NULL) {
+    fprintf(stderr, "failed to create event loop\n");
+    return EXIT_FAILURE;
+  }
+
+  if (state.config.publish_path != NULL) {
+    state.publisher =
+        publisher_create(state.event_loop, state.config.publish_path);
+    if (state.publisher == NULL) {
+      fprintf(stderr, "failed to listen on %s\n", state.config.publish_path);
+      return EXIT_FAILURE;
+    }
+  }
+  if (state.config.input_log_path != NULL) {
+    state.input_log = input_log_create(state.config.input_log_path);
+    if (state.input_log == NULL) {
+      fprintf(stderr, "failed to create %s\n", state.config.input_log_path);
+      return EXIT_FAILURE;
+    }
+  }
+  if (state.config.replay_path != NULL) {
+    state.replay.log = input_log_open(state.config.replay_path);
+    if (state.replay.log == NULL) {
+      fprintf(stderr, "failed to read input log %s\n",
+              state.config.replay_path);
+      return EXIT_FAILURE;
+    }
+  }
+
+  state.stats.start_time = stats_now();
+  state.stats_signal_fd = -1;
+  if (state.config.stats != WOOZ_STATS_NONE) {
+    // SIGUSR1 is read from the event loop instead of interrupting it.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    state.stats_signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (state.stats_signal_fd >= 0) {
+      state.stats_signal_source =
+          event_loop_add_fd(state.event_loop, state.stats_signal_fd, EPOLLIN,
+                            handle_stats_signal, &state);
+    }
+    if (state.stats_signal_source == NULL) {
+      fprintf(stderr, "warning: failed to watch SIGUSR1 for --stats\n");
+    }
+  }
+
   state.registry = wl_display_get_registry(state.display);
   wl_registry_add_listener(state.registry, &registry_listener, &state);
+  state.stats.roundtrips++;
   if (wl_display_roundtrip(state.display) < 0) {
     fprintf(stderr, "wl_display_roundtrip() failed\n");
     return EXIT_FAILURE;
@@ -919,14 +4184,45 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "compositor doesn't support wl_shm\n");
     return EXIT_FAILURE;
   }
-  if (state.screencopy_manager == NULL) {
-    fprintf(stderr, "compositor doesn't support wlr-screencopy-unstable-v1\n");
+  if (state.config.input_width > 0) {
+    state.stream = stream_create(state.shm, STDIN_FILENO,
+                                 state.config.input_format,
+                                 state.config.input_width,
+                                 state.config.input_height);
+    if (state.stream != NULL && state.stream->is_file) {
+      event_loop_schedule(state.event_loop, &state.stream_timer, 0,
+                          1000 / STREAM_FILE_FPS);
+    } else if (state.stream != NULL) {
+      state.stream_source =
+          event_loop_add_fd(state.event_loop, STDIN_FILENO, EPOLLIN,
+                            handle_stream_input, &state);
+    }
+    if (state.stream == NULL ||
+        (!state.stream->is_file && state.stream_source == NULL)) {
+      fprintf(stderr, "failed to read raw frames from stdin\n");
+      return EXIT_FAILURE;
+    }
+  }
+  if (uses_capture(&state) && state.screencopy_manager == NULL &&
+      !uses_image_copy_capture(&state)) {
+    fprintf(stderr, "compositor doesn't support ext-image-copy-capture-v1 nor "
+                    "wlr-screencopy-unstable-v1\n");
     return EXIT_FAILURE;
   }
   if (state.viewporter == NULL) {
     fprintf(stderr, "compositor doesn't support viewporter\n");
     return EXIT_FAILURE;
   }
+  if ((state.config.pixel_grid || state.config.magnify_cursor) &&
+      state.subcompositor == NULL) {
+    fprintf(stderr, "compositor doesn't support wl_subcompositor\n");
+    return EXIT_FAILURE;
+  }
+  if (state.config.lens_width > 0 && state.layer_shell == NULL) {
+    fprintf(stderr, "compositor doesn't support wlr-layer-shell-unstable-v1, "
+                    "required by --lens\n");
+    return EXIT_FAILURE;
+  }
   if (state.seat == NULL) {
     fprintf(stderr, "compositor doesn't support seat\n");
     return EXIT_FAILURE;
@@ -945,6 +4241,7 @@ int main(int argc, char *argv[]) {
                                   output);
     }
 
+    state.stats.roundtrips++;
     if (wl_display_roundtrip(state.display) < 0) {
       fprintf(stderr, "wl_display_roundtrip() failed\n");
       return EXIT_FAILURE;
@@ -956,9 +4253,14 @@ int main(int argc, char *argv[]) {
     struct wooz_output *output;
     wl_list_for_each(output, &state.outputs, link) {
       guess_output_logical_geometry(output);
+      output->mode_changed = false;
     }
   }
 
+  if (state.config.memory_budget > 0 && !plan_memory_budget(&state)) {
+    return EXIT_FAILURE;
+  }
+
   size_t n_pending = 0;
   struct wooz_output *output;
   wl_list_for_each(output, &state.outputs, link) {
@@ -967,11 +4269,16 @@ int main(int argc, char *argv[]) {
       continue;
     }
 
-    output->screencopy_frame = zwlr_screencopy_manager_v1_capture_output(
-        state.screencopy_manager, false, output->wl_output);
-    zwlr_screencopy_frame_v1_add_listener(output->screencopy_frame,
-                                          &screencopy_frame_listener, output);
+    output->active = true;
+    record_applied(output);
 
+    // Images and input frames replace the capture.
+    if (uses_capture(&state)) {
+      // Outputs process their captures in parallel, inline if the thread
+      // can't be started.
+      output->worker = worker_create(state.event_loop);
+      capture_output(output, false);
+    }
     ++n_pending;
   }
 
@@ -985,8 +4292,10 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  bool done = false;
-  while (!done && wl_display_dispatch(state.display) != -1) {
+  // Captures are processed by the output workers, their completion goes
+  // through the event loop.
+  bool done = !uses_capture(&state);
+  while (!done && event_loop_dispatch(state.event_loop) != -1) {
     done = (state.n_done == n_pending);
   }
   if (!done) {
@@ -1000,119 +4309,94 @@ int main(int argc, char *argv[]) {
       continue;
     }
 
-    struct wooz_window *win = calloc(1, sizeof(struct wooz_window));
-    wl_list_insert(&state.windows, &win->link);
-    win->state = &state;
-    win->output = output;
-    win->surface = wl_compositor_create_surface(state.compositor);
-    win->viewport = wp_viewporter_get_viewport(state.viewporter, win->surface);
-    win->view_source = (struct wooz_boxf){
-        .x = (double)output->geometry.x,
-        .y = (double)output->geometry.y,
-        .width = (double)output->geometry.width,
-        .height = (double)output->geometry.height,
-    };
-    // Store initial view for restore/unzoom
-    win->initial_view_source = win->view_source;
+    // Input frames are shown on a single output, they can't be shared.
+    if (state.stream != NULL && !wl_list_empty(&state.windows)) {
+      break;
+    }
 
-    if (win->surface == NULL) {
-      fprintf(stderr, "failed to create wayland surface\n");
+    if (!create_window(&state, output)) {
       return EXIT_FAILURE;
     }
-
-    win->xdg_surface = xdg_wm_base_get_xdg_surface(state.shell, win->surface);
-    xdg_surface_add_listener(win->xdg_surface, &xdg_surface_listener, win);
-    win->xdg_toplevel = xdg_surface_get_toplevel(win->xdg_surface);
-    xdg_toplevel_add_listener(win->xdg_toplevel, &xdg_toplevel_listener, win);
-    xdg_toplevel_set_app_id(win->xdg_toplevel, "dev.negrel.wooz");
-    xdg_toplevel_set_title(win->xdg_toplevel, "wooz");
-    xdg_toplevel_set_fullscreen(win->xdg_toplevel, output->wl_output);
-
-    wl_surface_commit(win->surface);
   }
 
   state.n_done = 1;
+  state.running = true;
 
-  // Main event loop with timer support
-  int wl_fd = wl_display_get_fd(state.display);
-  struct pollfd fds[2];
-
-  while (state.n_done) {
-    // Prepare events before dispatching
-    while (wl_display_prepare_read(state.display) != 0) {
-      wl_display_dispatch_pending(state.display);
-    }
-    wl_display_flush(state.display);
-
-    // Set up polling
-    fds[0].fd = wl_fd;
-    fds[0].events = POLLIN;
-    fds[1].fd = state.repeat_timer_fd;
-    fds[1].events = POLLIN;
-
-    int nfds = (state.repeat_timer_fd >= 0) ? 2 : 1;
-
-    if (poll(fds, nfds, -1) < 0) {
-      wl_display_cancel_read(state.display);
-      break;
+  if (state.replay.log != NULL) {
+    // Replayed events go to windows, they must be shown first.
+    while (state.n_done && !windows_configured(&state) &&
+           event_loop_dispatch(state.event_loop) != -1) {
     }
+    start_replay(&state);
+  }
 
-    // Handle timer events
-    if (nfds > 1 && (fds[1].revents & POLLIN)) {
-      uint64_t expirations;
-      read(state.repeat_timer_fd, &expirations, sizeof(expirations));
-      if (state.pressed_key != 0) {
-        handle_key_action(&state, state.pressed_key);
+  if (state.config.refresh_ms > 0) {
+    wl_list_for_each(output, &state.outputs, link) {
+      if (output->buffer != NULL) {
+        output->refresh_interval = state.config.refresh_ms;
+        schedule_refresh(output);
       }
     }
+  }
 
-    // Handle Wayland events
-    if (fds[0].revents & POLLIN) {
-      wl_display_read_events(state.display);
-      wl_display_dispatch_pending(state.display);
-    } else {
-      wl_display_cancel_read(state.display);
+  while (state.n_done) {
+    if (event_loop_dispatch(state.event_loop) < 0) {
+      break;
     }
   }
 
-  // Clean up key repeat timer
-  if (state.repeat_timer_fd >= 0) {
-    stop_key_repeat(&state);
-    close(state.repeat_timer_fd);
+  stop_key_repeat(&state);
+  wl_list_for_each(output, &state.outputs, link) {
+    event_loop_cancel(state.event_loop, &output->refresh_timer);
+  }
+
+  if (state.config.stats != WOOZ_STATS_NONE) {
+    print_stats(stderr, &state, state.config.stats);
+  }
+  event_loop_remove_fd(state.event_loop, state.stats_signal_source);
+  event_loop_remove_fd(state.event_loop, state.stream_source);
+  event_loop_cancel(state.event_loop, &state.stream_timer);
+  if (state.stats_signal_fd >= 0) {
+    close(state.stats_signal_fd);
   }
 
   struct wooz_window *win;
   struct wooz_window *window_tmp;
   wl_list_for_each_safe(win, window_tmp, &state.windows, link) {
-    output = win->output;
-
-    // Free window.
-    wl_list_remove(&win->link);
-    if (win->xdg_toplevel != NULL)
-      xdg_toplevel_destroy(win->xdg_toplevel);
-    if (win->xdg_surface != NULL)
-      xdg_surface_destroy(win->xdg_surface);
-    if (win->viewport != NULL)
-      wp_viewport_destroy(win->viewport);
-    if (win->surface != NULL)
-      wl_surface_destroy(win->surface);
-    free(win);
-
-    // Free output.
-    wl_list_remove(&output->link);
-    if (output->name != NULL)
-      free(output->name);
-    if (output->screencopy_frame != NULL) {
-      zwlr_screencopy_frame_v1_destroy(output->screencopy_frame);
-    }
-    destroy_buffer(output->buffer);
-    if (output->xdg_output != NULL) {
-      zxdg_output_v1_destroy(output->xdg_output);
+    destroy_window(win);
+  }
+  struct wooz_output *output_tmp;
+  wl_list_for_each_safe(output, output_tmp, &state.outputs, link) {
+    destroy_output(output);
+  }
+  stream_destroy(state.stream);
+  publisher_destroy(state.publisher);
+  event_loop_cancel(state.event_loop, &state.record.timer);
+  event_loop_cancel(state.event_loop, &state.replay.timer);
+  input_log_destroy(state.input_log);
+  input_log_destroy(state.replay.log);
+  bool recorded = recorder_destroy(state.recorder);
+  if (!recorded) {
+    fprintf(stderr, "failed to write %s\n", state.config.record_path);
+  }
+  if (state.screencopy_manager != NULL) {
+    zwlr_screencopy_manager_v1_destroy(state.screencopy_manager);
+  }
+  if (state.image_copy_manager != NULL) {
+    ext_image_copy_capture_manager_v1_destroy(state.image_copy_manager);
+  }
+  if (state.output_source_manager != NULL) {
+    ext_output_image_capture_source_manager_v1_destroy(
+        state.output_source_manager);
+  }
+  if (state.layer_shell != NULL) {
+    if (zwlr_layer_shell_v1_get_version(state.layer_shell) >=
+        ZWLR_LAYER_SHELL_V1_DESTROY_SINCE_VERSION) {
+      zwlr_layer_shell_v1_destroy(state.layer_shell);
+    } else {
+      wl_proxy_destroy((struct wl_proxy *)state.layer_shell);
     }
-    wl_output_release(output->wl_output);
-    free(output);
   }
-  zwlr_screencopy_manager_v1_destroy(state.screencopy_manager);
   if (state.xdg_output_manager != NULL) {
     zxdg_output_manager_v1_destroy(state.xdg_output_manager);
   }
@@ -1125,15 +4409,31 @@ int main(int argc, char *argv[]) {
   wl_seat_release(state.seat);
   xdg_wm_base_destroy(state.shell);
   wp_viewporter_destroy(state.viewporter);
+  if (state.presentation != NULL) {
+    wp_presentation_destroy(state.presentation);
+  }
   wl_shm_destroy(state.shm);
   wl_registry_destroy(state.registry);
+  for (size_t i = 0; i < state.n_cursor_themes; i++) {
+    wl_cursor_theme_destroy(state.cursor_themes[i].theme);
+  }
+  if (state.subcompositor != NULL) {
+    wl_subcompositor_destroy(state.subcompositor);
+  }
   wl_compositor_destroy(state.compositor);
+  event_loop_destroy(state.event_loop);
   wl_display_disconnect(state.display);
+  image_destroy(state.image);
 
   // Free config resources
   if (state.config.output_filter != NULL) {
     free(state.config.output_filter);
   }
+  free(state.config.image_path);
+  free(state.config.publish_path);
+  free(state.config.record_path);
+  free(state.config.input_log_path);
+  free(state.config.replay_path);
 
-  return EXIT_SUCCESS;
+  return recorded ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,62 @@
+#include "predict.h"
+
+#define NSEC_PER_MSEC 1000000.0
+
+// Motion events further apart than this belong to different movements.
+#define PREDICT_MAX_GAP_MS 100
+// Weight of the newest motion in the smoothed velocity, hand movements change
+// direction quickly.
+#define PREDICT_VELOCITY_WEIGHT 0.5
+
+void predictor_motion(struct wooz_predictor *predictor, uint32_t time,
+                      double x, double y) {
+  if (predictor->has_motion) {
+    // Timestamps have an undefined base and wrap around, only differences
+    // are meaningful.
+    uint32_t dt = time - predictor->time;
+    if (dt > PREDICT_MAX_GAP_MS) {
+      predictor_stop(predictor);
+    } else if (dt == 0) {
+      // Several events within one millisecond, the next one measures the
+      // velocity over the whole interval.
+      predictor->x = x;
+      predictor->y = y;
+      return;
+    } else {
+      double vx = (x - predictor->x) / dt;
+      double vy = (y - predictor->y) / dt;
+      predictor->vx += PREDICT_VELOCITY_WEIGHT * (vx - predictor->vx);
+      predictor->vy += PREDICT_VELOCITY_WEIGHT * (vy - predictor->vy);
+    }
+  }
+
+  predictor->x = x;
+  predictor->y = y;
+  predictor->time = time;
+  predictor->has_motion = true;
+}
+
+void predictor_stop(struct wooz_predictor *predictor) {
+  predictor->vx = 0;
+  predictor->vy = 0;
+}
+
+void predictor_presented(struct wooz_predictor *predictor, uint64_t latency) {
+  if (predictor->latency_samples == 0) {
+    predictor->latency = latency;
+  } else {
+    predictor->latency = predictor->latency - predictor->latency / 8 +
+                         latency / 8;
+  }
+  predictor->latency_samples++;
+}
+
+void predictor_predict(const struct wooz_predictor *predictor,
+                       uint64_t horizon, double *x, double *y) {
+  double ms = horizon / NSEC_PER_MSEC;
+  if (ms > PREDICT_MAX_HORIZON_MS) {
+    ms = PREDICT_MAX_HORIZON_MS;
+  }
+  *x = predictor->x + predictor->vx * ms;
+  *y = predictor->y + predictor->vy * ms;
+}
@@ -0,0 +1,232 @@
+#define _GNU_SOURCE // accept4
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "publish.h"
+
+static void reader_destroy(struct wooz_publish_reader *reader) {
+  event_loop_remove_fd(reader->publisher->loop, reader->source);
+  close(reader->fd);
+  wl_list_remove(&reader->link);
+  free(reader);
+}
+
+// Readers aren't expected to send anything, this only notices them leave.
+static void handle_reader(int fd, uint32_t events, void *data) {
+  struct wooz_publish_reader *reader = data;
+
+  char discard[64];
+  ssize_t n;
+  while ((n = recv(fd, discard, sizeof(discard), MSG_DONTWAIT)) > 0) {
+  }
+  if (n == 0 || (errno != EAGAIN && errno != EINTR) ||
+      (events & (EPOLLHUP | EPOLLERR)) != 0) {
+    reader_destroy(reader);
+  }
+}
+
+static void handle_connection(int fd, uint32_t events, void *data) {
+  struct wooz_publisher *publisher = data;
+
+  int reader_fd;
+  while ((reader_fd = accept4(fd, NULL, NULL,
+                              SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    struct wooz_publish_reader *reader =
+        calloc(1, sizeof(struct wooz_publish_reader));
+    if (reader == NULL) {
+      close(reader_fd);
+      continue;
+    }
+    reader->publisher = publisher;
+    reader->fd = reader_fd;
+    reader->source = event_loop_add_fd(publisher->loop, reader_fd, EPOLLIN,
+                                       handle_reader, reader);
+    if (reader->source == NULL) {
+      close(reader_fd);
+      free(reader);
+      continue;
+    }
+    wl_list_insert(&publisher->readers, &reader->link);
+  }
+}
+
+struct wooz_publisher *publisher_create(struct wooz_event_loop *loop,
+                                        const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return NULL;
+  }
+  strcpy(addr.sun_path, path);
+
+  // Only sockets are replaced, wooz may have been killed without cleaning up.
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  struct wooz_publisher *publisher = calloc(1, sizeof(struct wooz_publisher));
+  if (publisher == NULL) {
+    close(fd);
+    unlink(path);
+    return NULL;
+  }
+  publisher->loop = loop;
+  publisher->fd = fd;
+  publisher->path = strdup(path);
+  wl_list_init(&publisher->readers);
+  publisher->source =
+      event_loop_add_fd(loop, fd, EPOLLIN, handle_connection, publisher);
+  if (publisher->path == NULL || publisher->source == NULL) {
+    publisher_destroy(publisher);
+    return NULL;
+  }
+  return publisher;
+}
+
+void publisher_destroy(struct wooz_publisher *publisher) {
+  if (publisher == NULL) {
+    return;
+  }
+  struct wooz_publish_reader *reader, *tmp;
+  wl_list_for_each_safe(reader, tmp, &publisher->readers, link) {
+    reader_destroy(reader);
+  }
+  if (publisher->source != NULL) {
+    event_loop_remove_fd(publisher->loop, publisher->source);
+  }
+  close(publisher->fd);
+  if (publisher->path != NULL) {
+    unlink(publisher->path);
+    free(publisher->path);
+  }
+  free(publisher);
+}
+
+static bool reader_knows(const struct wooz_publish_reader *reader,
+                         uint64_t id) {
+  for (size_t i = 0; i < PUBLISH_KNOWN_BUFFERS; i++) {
+    if (reader->known[i] == id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A read-only descriptor of the memfd behind fd: readers can map the buffer
+// but not write to it.
+static int open_read_only(int fd) {
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// Returns false if the reader is gone. The read-only descriptor of fd is
+// opened into read_fd when first needed.
+static bool send_frame(struct wooz_publisher *publisher,
+                       struct wooz_publish_reader *reader,
+                       const struct wooz_publish_frame *frame, int fd,
+                       int *read_fd) {
+  struct iovec iov = {
+      .iov_base = (void *)frame,
+      .iov_len = sizeof(*frame),
+  };
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+  };
+
+  bool attach_fd = !reader_knows(reader, frame->buffer);
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  if (attach_fd) {
+    if (*read_fd < 0) {
+      *read_fd = open_read_only(fd);
+    }
+    if (*read_fd < 0) {
+      // The frame is sent once the descriptor can be, as for full sockets.
+      publisher->skipped++;
+      return true;
+    }
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), read_fd, sizeof(int));
+  }
+
+  if (sendmsg(reader->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      publisher->skipped++;
+      return true;
+    }
+    return false;
+  }
+
+  if (attach_fd) {
+    reader->known[reader->next_known] = frame->buffer;
+    reader->next_known = (reader->next_known + 1) % PUBLISH_KNOWN_BUFFERS;
+  }
+  return true;
+}
+
+void publisher_publish(struct wooz_publisher *publisher,
+                       const struct wooz_buffer *buffer,
+                       enum wl_output_transform transform,
+                       const struct wooz_boxf *view, const char *output) {
+  if (buffer->fd < 0 || wl_list_empty(&publisher->readers)) {
+    return;
+  }
+
+  struct wooz_publish_frame frame = {
+      .version = PUBLISH_VERSION,
+      .format = buffer->format,
+      .sequence = ++publisher->sequence,
+      .buffer = buffer->id,
+      .size = buffer->size,
+      .width = buffer->width,
+      .height = buffer->height,
+      .stride = buffer->stride,
+      .transform = transform,
+      .x = view->x,
+      .y = view->y,
+      .view_width = view->width,
+      .view_height = view->height,
+  };
+  if (output != NULL) {
+    snprintf(frame.output, sizeof(frame.output), "%s", output);
+  }
+
+  int read_fd = -1;
+  struct wooz_publish_reader *reader, *tmp;
+  wl_list_for_each_safe(reader, tmp, &publisher->readers, link) {
+    if (!send_frame(publisher, reader, &frame, buffer->fd, &read_fd)) {
+      reader_destroy(reader);
+    }
+  }
+  if (read_fd >= 0) {
+    close(read_fd);
+  }
+}
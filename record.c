@@ -0,0 +1,184 @@
+#include <stdlib.h>
+
+#include "kernels.h"
+#include "record.h"
+#include "scale.h"
+#include "stats.h"
+#include "worker.h"
+
+#define RECORD_BPP 4
+
+static size_t plane_size(const struct wooz_recorder *recorder) {
+  return (size_t)recorder->width * recorder->height * 3 / 2;
+}
+
+static void write_planes(struct wooz_recorder *recorder, uint32_t n) {
+  static const char header[] = "FRAME\n";
+  size_t size = plane_size(recorder);
+  for (uint32_t i = 0; i < n && !recorder->failed; i++) {
+    if (fwrite(header, 1, sizeof(header) - 1, recorder->file) !=
+            sizeof(header) - 1 ||
+        fwrite(recorder->planes, 1, size, recorder->file) != size) {
+      recorder->failed = true;
+    }
+  }
+}
+
+static void convert_frame(struct wooz_recorder *recorder,
+                          const struct wooz_record_frame *frame) {
+  int32_t width = recorder->width;
+  int32_t height = recorder->height;
+  uint8_t *y = recorder->planes;
+  uint8_t *u = y + (size_t)width * height;
+  uint8_t *v = u + (size_t)width * height / 4;
+  const uint8_t *src = frame->pixels.data;
+  size_t stride = frame->pixels.stride;
+  for (int32_t row = 0; row < height; row += 2) {
+    rgb_to_yuv420(src + row * stride, src + (row + 1) * stride, width,
+                  frame->shifts, y + (size_t)row * width,
+                  y + (size_t)(row + 1) * width,
+                  u + (size_t)row / 2 * width / 2,
+                  v + (size_t)row / 2 * width / 2);
+  }
+}
+
+// Repeats of the previous frame go first, its planes are still there.
+static void write_frame(struct wooz_recorder *recorder,
+                        const struct wooz_record_frame *frame) {
+  write_planes(recorder, frame->repeat);
+  convert_frame(recorder, frame);
+  write_planes(recorder, 1);
+  recorder->converted++;
+}
+
+static void write_head(void *data) {
+  struct wooz_recorder *recorder = data;
+  write_frame(recorder, &recorder->frames[recorder->head]);
+}
+
+static void handle_frame_written(void *data) {
+  struct wooz_recorder *recorder = data;
+  recorder->head = (recorder->head + 1) % RECORD_QUEUE_SIZE;
+  recorder->count--;
+  if (recorder->count > 0) {
+    worker_submit(recorder->worker, write_head, handle_frame_written,
+                  recorder);
+  }
+}
+
+struct wooz_recorder *recorder_create(struct wooz_event_loop *loop,
+                                      const char *path, int32_t width,
+                                      int32_t height) {
+  width &= ~1;
+  height &= ~1;
+  if (width <= 0 || height <= 0) {
+    return NULL;
+  }
+
+  struct wooz_recorder *recorder = calloc(1, sizeof(struct wooz_recorder));
+  if (recorder == NULL) {
+    return NULL;
+  }
+  recorder->width = width;
+  recorder->height = height;
+  recorder->start = stats_now();
+  recorder->file = fopen(path, "wb");
+  recorder->planes = malloc(plane_size(recorder));
+  bool ok = recorder->file != NULL && recorder->planes != NULL;
+  for (size_t i = 0; ok && i < RECORD_QUEUE_SIZE; i++) {
+    struct wooz_buffer *pixels = &recorder->frames[i].pixels;
+    pixels->width = width;
+    pixels->height = height;
+    pixels->stride = width * RECORD_BPP;
+    pixels->size = (size_t)pixels->stride * height;
+    pixels->fd = -1;
+    pixels->data = malloc(pixels->size);
+    ok = pixels->data != NULL;
+  }
+  // Chroma samples sit between the luma ones, as in JPEG.
+  ok = ok && fprintf(recorder->file,
+                     "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg "
+                     "XCOLORRANGE=LIMITED\n",
+                     width, height, RECORD_FPS) > 0;
+  if (ok) {
+    recorder->worker = worker_create(loop);
+  }
+  if (recorder->worker == NULL) {
+    recorder_destroy(recorder);
+    return NULL;
+  }
+  return recorder;
+}
+
+bool recorder_destroy(struct wooz_recorder *recorder) {
+  if (recorder == NULL) {
+    return true;
+  }
+
+  if (recorder->worker != NULL) {
+    worker_destroy(recorder->worker);
+    // Frames the worker wrote whose completion wasn't handled.
+    size_t left = recorder->queued - recorder->converted;
+    size_t written = recorder->count - left;
+    recorder->head = (recorder->head + written) % RECORD_QUEUE_SIZE;
+    recorder->count -= written;
+    for (; recorder->count > 0; recorder->count--) {
+      write_frame(recorder, &recorder->frames[recorder->head]);
+      recorder->head = (recorder->head + 1) % RECORD_QUEUE_SIZE;
+    }
+    write_planes(recorder, recorder->repeat);
+  }
+
+  bool ok = !recorder->failed;
+  if (recorder->file != NULL && fclose(recorder->file) != 0) {
+    ok = false;
+  }
+  for (size_t i = 0; i < RECORD_QUEUE_SIZE; i++) {
+    free(recorder->frames[i].pixels.data);
+  }
+  free(recorder->planes);
+  free(recorder);
+  return ok;
+}
+
+uint32_t recorder_frames_due(struct wooz_recorder *recorder) {
+  uint64_t elapsed = stats_now() - recorder->start;
+  uint64_t due = elapsed * RECORD_FPS / 1000000000ull;
+  uint32_t n = (uint32_t)(due - recorder->due);
+  recorder->due = due;
+  return n;
+}
+
+bool recorder_add(struct wooz_recorder *recorder,
+                  const struct wooz_buffer *src,
+                  enum wl_output_transform transform,
+                  const struct wooz_boxf *view) {
+  const uint8_t *shifts = shm_format_channel_shifts(src->format);
+  if (recorder->count == RECORD_QUEUE_SIZE || shifts == NULL) {
+    recorder->dropped++;
+    return false;
+  }
+
+  size_t index = (recorder->head + recorder->count) % RECORD_QUEUE_SIZE;
+  struct wooz_record_frame *frame = &recorder->frames[index];
+  frame->pixels.format = src->format;
+  frame->shifts = shifts;
+  scale_nearest(&frame->pixels, src, transform, view);
+  frame->repeat = recorder->repeat;
+  recorder->repeat = 0;
+  recorder->has_frame = true;
+  recorder->count++;
+  recorder->queued++;
+
+  if (!worker_is_busy(recorder->worker)) {
+    worker_submit(recorder->worker, write_head, handle_frame_written,
+                  recorder);
+  }
+  return true;
+}
+
+void recorder_repeat(struct wooz_recorder *recorder, uint32_t n) {
+  if (recorder->has_frame) {
+    recorder->repeat += n;
+  }
+}
@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "sat.h"
+
+// Channels summed per pixel, the table interleaves them.
+#define SAT_CHANNELS 3
+
+// Decode one raw buffer row to one 8 bit value per pixel and channel.
+static void decode_row(enum wl_shm_format format, const uint8_t *src,
+                       int32_t width, uint32_t *channels[SAT_CHANNELS]) {
+  const uint8_t *shifts = shm_format_channel_shifts(format);
+  if (shifts != NULL) {
+    unpack_channels32(src, width, shifts, channels);
+    return;
+  }
+
+  for (int32_t x = 0; x < width; x++) {
+    uint32_t v;
+    uint8_t rgb[SAT_CHANNELS];
+    switch (format) {
+    case WL_SHM_FORMAT_RGB888:
+      rgb[0] = src[3 * x + 2];
+      rgb[1] = src[3 * x + 1];
+      rgb[2] = src[3 * x];
+      break;
+    case WL_SHM_FORMAT_BGR888:
+      rgb[0] = src[3 * x];
+      rgb[1] = src[3 * x + 1];
+      rgb[2] = src[3 * x + 2];
+      break;
+    case WL_SHM_FORMAT_RGB565:
+      v = (uint32_t)src[2 * x] | (uint32_t)src[2 * x + 1] << 8;
+      rgb[0] = (v >> 11 & 0x1f) << 3 | (v >> 13 & 0x7);
+      rgb[1] = (v >> 5 & 0x3f) << 2 | (v >> 9 & 0x3);
+      rgb[2] = (v & 0x1f) << 3 | (v >> 2 & 0x7);
+      break;
+    default:
+      rgb[0] = rgb[1] = rgb[2] = 0;
+      break;
+    }
+    for (int c = 0; c < SAT_CHANNELS; c++) {
+      channels[c][x] = rgb[c];
+    }
+  }
+}
+
+// Raw dimensions of buffer, width and height are swapped for rotated outputs.
+static void raw_size(const struct wooz_buffer *buffer, int32_t *width,
+                     int32_t *height) {
+  *width = buffer->stride / shm_format_bytes_per_pixel(buffer->format);
+  *height = (int32_t)(buffer->size / buffer->stride);
+}
+
+bool update_summed_area_table(struct wooz_buffer *buffer) {
+  if (buffer->sat_valid) {
+    return true;
+  }
+  if (shm_format_bytes_per_pixel(buffer->format) == 0) {
+    return false;
+  }
+
+  int32_t width, height;
+  raw_size(buffer, &width, &height);
+
+  // One leading row and column of zeros spares bound checks on lookups.
+  size_t row_len = (size_t)(width + 1) * SAT_CHANNELS;
+  if (buffer->sat == NULL) {
+    buffer->sat = calloc(row_len * (height + 1), sizeof(uint32_t));
+    if (buffer->sat == NULL) {
+      return false;
+    }
+  }
+
+  uint32_t *decoded = malloc(sizeof(uint32_t) * width * SAT_CHANNELS);
+  if (decoded == NULL) {
+    return false;
+  }
+  uint32_t *channels[SAT_CHANNELS];
+  for (int c = 0; c < SAT_CHANNELS; c++) {
+    channels[c] = decoded + (size_t)c * width;
+  }
+
+  for (int32_t y = 0; y < height; y++) {
+    decode_row(buffer->format,
+               (const uint8_t *)buffer->data + (size_t)y * buffer->stride,
+               width, channels);
+
+    const uint32_t *prev = buffer->sat + (size_t)y * row_len;
+    uint32_t *row = buffer->sat + (size_t)(y + 1) * row_len;
+
+    // Running sums along the row are serial, adding the row above is a
+    // plain element wise loop the compiler vectorizes.
+    uint32_t sum[SAT_CHANNELS] = {0};
+    for (int32_t x = 0; x < width; x++) {
+      for (int c = 0; c < SAT_CHANNELS; c++) {
+        sum[c] += channels[c][x];
+        row[(x + 1) * SAT_CHANNELS + c] = sum[c];
+      }
+    }
+    for (size_t i = SAT_CHANNELS; i < row_len; i++) {
+      row[i] += prev[i];
+    }
+  }
+
+  free(decoded);
+  buffer->sat_valid = true;
+  return true;
+}
+
+bool region_mean(struct wooz_buffer *buffer, const struct wooz_box *box,
+                 struct wooz_rgb *mean) {
+  if (!update_summed_area_table(buffer)) {
+    return false;
+  }
+
+  int32_t width, height;
+  raw_size(buffer, &width, &height);
+
+  int32_t x0 = box->x < 0 ? 0 : box->x;
+  int32_t y0 = box->y < 0 ? 0 : box->y;
+  int32_t x1 = box->x + box->width > width ? width : box->x + box->width;
+  int32_t y1 = box->y + box->height > height ? height : box->y + box->height;
+  if (x1 <= x0 || y1 <= y0) {
+    return false;
+  }
+  if ((int64_t)(x1 - x0) * (y1 - y0) > SAT_MAX_AREA) {
+    return false;
+  }
+
+  size_t row_len = (size_t)(width + 1) * SAT_CHANNELS;
+  const uint32_t *top = buffer->sat + (size_t)y0 * row_len;
+  const uint32_t *bottom = buffer->sat + (size_t)y1 * row_len;
+  uint32_t area = (uint32_t)(x1 - x0) * (y1 - y0);
+
+  uint8_t out[SAT_CHANNELS];
+  for (int c = 0; c < SAT_CHANNELS; c++) {
+    uint32_t sum = bottom[x1 * SAT_CHANNELS + c] -
+                   bottom[x0 * SAT_CHANNELS + c] -
+                   top[x1 * SAT_CHANNELS + c] + top[x0 * SAT_CHANNELS + c];
+    out[c] = (uint8_t)((sum + area / 2) / area);
+  }
+  mean->r = out[0];
+  mean->g = out[1];
+  mean->b = out[2];
+  return true;
+}
@@ -0,0 +1,152 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "scale.h"
+
+#define clamp(v, lo, hi) ((v) < (lo) ? (lo) : ((v) > (hi) ? (hi) : (v)))
+
+// Side of the destination squares rotate_buffer() copies at once. 32x32
+// 4 bytes pixels read from 32 source rows fit in L1 with room to spare.
+#define ROTATE_BLOCK_SIZE 32
+
+void untransform_pixel(enum wl_output_transform transform, int32_t width,
+                       int32_t height, int32_t x, int32_t y, int32_t *bx,
+                       int32_t *by) {
+  switch (transform) {
+  case WL_OUTPUT_TRANSFORM_90:
+    *bx = y;
+    *by = width - 1 - x;
+    break;
+  case WL_OUTPUT_TRANSFORM_180:
+    *bx = width - 1 - x;
+    *by = height - 1 - y;
+    break;
+  case WL_OUTPUT_TRANSFORM_270:
+    *bx = height - 1 - y;
+    *by = x;
+    break;
+  case WL_OUTPUT_TRANSFORM_FLIPPED:
+    *bx = width - 1 - x;
+    *by = y;
+    break;
+  case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+    *bx = y;
+    *by = x;
+    break;
+  case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+    *bx = x;
+    *by = height - 1 - y;
+    break;
+  case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+    *bx = height - 1 - y;
+    *by = width - 1 - x;
+    break;
+  default:
+    *bx = x;
+    *by = y;
+    break;
+  }
+}
+
+void scale_nearest(struct wooz_buffer *dst, const struct wooz_buffer *src,
+                   enum wl_output_transform transform,
+                   const struct wooz_boxf *src_box) {
+  int32_t bpp = shm_format_bytes_per_pixel(src->format);
+  if (bpp == 0 || dst->format != src->format) {
+    return;
+  }
+
+  // Source column of every destination column, computed once per call.
+  int32_t *columns = malloc(sizeof(int32_t) * dst->width);
+  if (columns == NULL) {
+    return;
+  }
+  double step_x = src_box->width / dst->width;
+  double step_y = src_box->height / dst->height;
+  for (int32_t x = 0; x < dst->width; x++) {
+    int32_t sx = (int32_t)(src_box->x + (x + 0.5) * step_x);
+    columns[x] = clamp(sx, 0, src->width - 1);
+  }
+
+  for (int32_t y = 0; y < dst->height; y++) {
+    int32_t sy = (int32_t)(src_box->y + (y + 0.5) * step_y);
+    sy = clamp(sy, 0, src->height - 1);
+    uint8_t *dst_row = (uint8_t *)dst->data + (size_t)y * dst->stride;
+
+    if (transform == WL_OUTPUT_TRANSFORM_NORMAL) {
+      const uint8_t *src_row =
+          (const uint8_t *)src->data + (size_t)sy * src->stride;
+      if (bpp == 4) {
+        gather_pixels32((uint32_t *)dst_row, (const uint32_t *)src_row,
+                        columns, dst->width);
+      } else {
+        for (int32_t x = 0; x < dst->width; x++) {
+          memcpy(dst_row + x * bpp, src_row + columns[x] * bpp, bpp);
+        }
+      }
+      continue;
+    }
+
+    for (int32_t x = 0; x < dst->width; x++) {
+      int32_t bx, by;
+      untransform_pixel(transform, src->width, src->height, columns[x], sy,
+                        &bx, &by);
+      memcpy(dst_row + x * bpp,
+             (const uint8_t *)src->data + (size_t)by * src->stride + bx * bpp,
+             bpp);
+    }
+  }
+
+  free(columns);
+}
+
+void rotate_buffer(struct wooz_buffer *dst, const struct wooz_buffer *src,
+                   enum wl_output_transform transform) {
+  int32_t bpp = shm_format_bytes_per_pixel(src->format);
+  if (bpp == 0 || dst->format != src->format) {
+    return;
+  }
+
+  // Transforms are affine: the source pixel of destination pixel (x, y) sits
+  // at origin + x * step_x + y * step_y bytes.
+  int32_t x0, y0, x1, y1, x2, y2;
+  untransform_pixel(transform, dst->width, dst->height, 0, 0, &x0, &y0);
+  untransform_pixel(transform, dst->width, dst->height, 1, 0, &x1, &y1);
+  untransform_pixel(transform, dst->width, dst->height, 0, 1, &x2, &y2);
+  ptrdiff_t origin = (ptrdiff_t)y0 * src->stride + (ptrdiff_t)x0 * bpp;
+  ptrdiff_t step_x =
+      (ptrdiff_t)(y1 - y0) * src->stride + (ptrdiff_t)(x1 - x0) * bpp;
+  ptrdiff_t step_y =
+      (ptrdiff_t)(y2 - y0) * src->stride + (ptrdiff_t)(x2 - x0) * bpp;
+
+  // Rotations read source columns: walking the destination in blocks keeps
+  // the source rows of a block in cache instead of missing on every pixel.
+  const uint8_t *src_data = src->data;
+  for (int32_t by = 0; by < dst->height; by += ROTATE_BLOCK_SIZE) {
+    int32_t end_y = by + ROTATE_BLOCK_SIZE < dst->height
+                        ? by + ROTATE_BLOCK_SIZE
+                        : dst->height;
+    for (int32_t bx = 0; bx < dst->width; bx += ROTATE_BLOCK_SIZE) {
+      int32_t n = bx + ROTATE_BLOCK_SIZE < dst->width ? ROTATE_BLOCK_SIZE
+                                                       : dst->width - bx;
+      for (int32_t y = by; y < end_y; y++) {
+        uint8_t *d = (uint8_t *)dst->data + (size_t)y * dst->stride +
+                     (size_t)bx * bpp;
+        const uint8_t *s = src_data + origin + y * step_y + bx * step_x;
+        if (bpp == 4) {
+          uint32_t *d32 = (uint32_t *)d;
+          for (int32_t x = 0; x < n; x++) {
+            d32[x] = *(const uint32_t *)(s + x * step_x);
+          }
+        } else {
+          for (int32_t x = 0; x < n; x++) {
+            memcpy(d + x * bpp, s + x * step_x, bpp);
+          }
+        }
+      }
+    }
+  }
+}
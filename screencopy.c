@@ -0,0 +1,144 @@
+#include "screencopy.h"
+#include "wlr-screencopy-unstable-v1-protocol.h"
+
+void shm_offer_add(struct wooz_shm_offer *offer, uint32_t format,
+                   uint32_t width, uint32_t height, uint32_t stride) {
+  size_t size = (size_t)stride * height;
+  int preference = shm_format_preference(format);
+  int current = offer->valid ? shm_format_preference(offer->format) : -1;
+  if (preference > current ||
+      (preference == current &&
+       size < (size_t)offer->stride * offer->height)) {
+    offer->format = format;
+    offer->width = width;
+    offer->height = height;
+    offer->stride = stride;
+    offer->valid = true;
+  }
+}
+
+static void report_event(struct wooz_screencopy *copy) {
+  if (copy->handler->event != NULL) {
+    copy->handler->event(copy->data);
+  }
+}
+
+static void finish(struct wooz_screencopy *copy, bool success) {
+  screencopy_cancel(copy);
+  if (success) {
+    copy->handler->ready(copy->data);
+  } else {
+    copy->handler->failed(copy->data);
+  }
+}
+
+static void copy_frame(struct wooz_screencopy *copy) {
+  struct wooz_buffer *buffer = copy->handler->buffer(copy->data, &copy->offer);
+  if (buffer == NULL) {
+    finish(copy, false);
+    return;
+  }
+
+  uint32_t version = zwlr_screencopy_frame_v1_get_version(copy->frame);
+  if (copy->with_damage &&
+      version >= ZWLR_SCREENCOPY_FRAME_V1_COPY_WITH_DAMAGE_SINCE_VERSION) {
+    zwlr_screencopy_frame_v1_copy_with_damage(copy->frame, buffer->wl_buffer);
+  } else {
+    zwlr_screencopy_frame_v1_copy(copy->frame, buffer->wl_buffer);
+  }
+}
+
+static void frame_handle_buffer(void *data,
+                                struct zwlr_screencopy_frame_v1 *frame,
+                                uint32_t format, uint32_t width,
+                                uint32_t height, uint32_t stride) {
+  struct wooz_screencopy *copy = data;
+  report_event(copy);
+  shm_offer_add(&copy->offer, format, width, height, stride);
+
+  // Before version 3 there is a single buffer event and no buffer_done.
+  if (zwlr_screencopy_frame_v1_get_version(frame) <
+      ZWLR_SCREENCOPY_FRAME_V1_BUFFER_DONE_SINCE_VERSION) {
+    copy_frame(copy);
+  }
+}
+
+static void frame_handle_linux_dmabuf(void *data,
+                                      struct zwlr_screencopy_frame_v1 *frame,
+                                      uint32_t format, uint32_t width,
+                                      uint32_t height) {
+  // Nothing else to do, captures are always copied to wl_shm buffers
+  report_event(data);
+}
+
+static void frame_handle_buffer_done(void *data,
+                                     struct zwlr_screencopy_frame_v1 *frame) {
+  report_event(data);
+  copy_frame(data);
+}
+
+static void frame_handle_damage(void *data,
+                                struct zwlr_screencopy_frame_v1 *frame,
+                                uint32_t x, uint32_t y, uint32_t width,
+                                uint32_t height) {
+  struct wooz_screencopy *copy = data;
+  report_event(copy);
+  if (copy->handler->damage != NULL) {
+    copy->handler->damage(copy->data, x, y, width, height);
+  }
+}
+
+static void frame_handle_flags(void *data,
+                               struct zwlr_screencopy_frame_v1 *frame,
+                               uint32_t flags) {
+  struct wooz_screencopy *copy = data;
+  report_event(copy);
+  if (copy->handler->flags != NULL) {
+    copy->handler->flags(copy->data, flags);
+  }
+}
+
+static void frame_handle_ready(void *data,
+                               struct zwlr_screencopy_frame_v1 *frame,
+                               uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                               uint32_t tv_nsec) {
+  report_event(data);
+  finish(data, true);
+}
+
+static void frame_handle_failed(void *data,
+                                struct zwlr_screencopy_frame_v1 *frame) {
+  report_event(data);
+  finish(data, false);
+}
+
+static const struct zwlr_screencopy_frame_v1_listener frame_listener = {
+    .buffer = frame_handle_buffer,
+    .flags = frame_handle_flags,
+    .ready = frame_handle_ready,
+    .failed = frame_handle_failed,
+    .damage = frame_handle_damage,
+    .linux_dmabuf = frame_handle_linux_dmabuf,
+    .buffer_done = frame_handle_buffer_done,
+};
+
+void screencopy_start(struct wooz_screencopy *copy,
+                      struct zwlr_screencopy_frame_v1 *frame,
+                      bool with_damage,
+                      const struct wooz_screencopy_handler *handler,
+                      void *data) {
+  *copy = (struct wooz_screencopy){
+      .frame = frame,
+      .with_damage = with_damage,
+      .handler = handler,
+      .data = data,
+  };
+  zwlr_screencopy_frame_v1_add_listener(frame, &frame_listener, copy);
+}
+
+void screencopy_cancel(struct wooz_screencopy *copy) {
+  if (copy->frame != NULL) {
+    zwlr_screencopy_frame_v1_destroy(copy->frame);
+    copy->frame = NULL;
+  }
+}
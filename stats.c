@@ -0,0 +1,291 @@
+#include <time.h>
+
+#include "buffer.h"
+#include "event-loop.h"
+#include "history.h"
+#include "kernels.h"
+#include "stats.h"
+#include "wooz.h"
+
+#define NSEC_PER_MSEC 1000000.0
+
+static const char *listener_names[WOOZ_STATS_LISTENER_COUNT] = {
+    [WOOZ_STATS_REGISTRY] = "registry",
+    [WOOZ_STATS_OUTPUT] = "output",
+    [WOOZ_STATS_XDG_OUTPUT] = "xdg_output",
+    [WOOZ_STATS_SCREENCOPY_FRAME] = "screencopy_frame",
+    [WOOZ_STATS_IMAGE_COPY_SESSION] = "image_copy_session",
+    [WOOZ_STATS_IMAGE_COPY_FRAME] = "image_copy_frame",
+    [WOOZ_STATS_XDG_WM_BASE] = "xdg_wm_base",
+    [WOOZ_STATS_XDG_SURFACE] = "xdg_surface",
+    [WOOZ_STATS_XDG_TOPLEVEL] = "xdg_toplevel",
+    [WOOZ_STATS_LAYER_SURFACE] = "layer_surface",
+    [WOOZ_STATS_FRAME_CALLBACK] = "frame_callback",
+    [WOOZ_STATS_SEAT] = "seat",
+    [WOOZ_STATS_POINTER] = "pointer",
+    [WOOZ_STATS_KEYBOARD] = "keyboard",
+    [WOOZ_STATS_PRESENTATION] = "presentation",
+    [WOOZ_STATS_PRESENTATION_FEEDBACK] = "presentation_feedback",
+};
+
+// Buffers held for an output, its captures and its windows.
+struct buffer_usage {
+  size_t capture_buffers, capture_bytes;
+  size_t window_buffers, window_bytes;
+  enum wl_shm_format format;
+};
+
+uint64_t stats_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void capture_stats_begin(struct wooz_capture_stats *stats) {
+  stats->requested = stats_now();
+}
+
+void capture_stats_end(struct wooz_capture_stats *stats, bool success) {
+  if (stats->requested == 0) {
+    return;
+  }
+  uint64_t latency = stats_now() - stats->requested;
+  stats->requested = 0;
+
+  if (!success) {
+    stats->failed++;
+    return;
+  }
+  stats->last = latency;
+  stats->total += latency;
+  if (stats->count == 0 || latency < stats->min) {
+    stats->min = latency;
+  }
+  if (latency > stats->max) {
+    stats->max = latency;
+  }
+  stats->count++;
+}
+
+static void add_buffer(const struct wooz_buffer *buffer, size_t *n,
+                       size_t *bytes) {
+  if (buffer != NULL) {
+    (*n)++;
+    *bytes += buffer->pool_size;
+  }
+}
+
+static struct buffer_usage output_buffer_usage(struct wooz_state *state,
+                                               struct wooz_output *output) {
+  struct buffer_usage usage = {0};
+  if (output->buffer != NULL) {
+    usage.format = output->buffer->format;
+  }
+  add_buffer(output->buffer, &usage.capture_buffers, &usage.capture_bytes);
+  add_buffer(output->back_buffer, &usage.capture_buffers,
+             &usage.capture_bytes);
+  add_buffer(output->raw_buffer, &usage.capture_buffers,
+             &usage.capture_bytes);
+  add_buffer(output->strip, &usage.capture_buffers, &usage.capture_bytes);
+  add_buffer(output->diff_buffer, &usage.capture_buffers,
+             &usage.capture_bytes);
+  for (size_t i = 0; i < sizeof(output->details) / sizeof(void *); i++) {
+    add_buffer(output->details[i], &usage.capture_buffers,
+               &usage.capture_bytes);
+  }
+  for (size_t i = 0; i < sizeof(output->history_buffers) / sizeof(void *);
+       i++) {
+    add_buffer(output->history_buffers[i], &usage.capture_buffers,
+               &usage.capture_bytes);
+  }
+
+  struct wooz_window *win;
+  wl_list_for_each(win, &state->windows, link) {
+    if (win->output != output) {
+      continue;
+    }
+    for (size_t i = 0; i < sizeof(win->buffers) / sizeof(void *); i++) {
+      add_buffer(win->buffers[i], &usage.window_buffers,
+                 &usage.window_bytes);
+    }
+    for (size_t i = 0; i < sizeof(win->grid_buffers) / sizeof(void *); i++) {
+      add_buffer(win->grid_buffers[i], &usage.window_buffers,
+                 &usage.window_bytes);
+    }
+  }
+
+  return usage;
+}
+
+// Smoothed commit to presentation delay of the window on output, measured
+// for --predict. Returns 0 if it is unknown.
+static uint64_t presentation_latency(struct wooz_state *state,
+                                     struct wooz_output *output) {
+  struct wooz_window *win;
+  wl_list_for_each(win, &state->windows, link) {
+    if (win->output == output && win->predictor.latency_samples > 0) {
+      return win->predictor.latency;
+    }
+  }
+  return 0;
+}
+
+// DRM fourcc of a wl_shm format, the two legacy codes are not fourccs.
+static void format_name(enum wl_shm_format format, char name[5]) {
+  if (format == WL_SHM_FORMAT_ARGB8888) {
+    format = 0x34325241; // AR24
+  } else if (format == WL_SHM_FORMAT_XRGB8888) {
+    format = 0x34325258; // XR24
+  }
+  for (int i = 0; i < 4; i++) {
+    char c = (char)((uint32_t)format >> (8 * i));
+    name[i] = c >= ' ' && c <= '~' ? c : '?';
+  }
+  name[4] = '\0';
+}
+
+static void print_json_string(FILE *f, const char *str) {
+  fputc('"', f);
+  for (const char *c = str; c != NULL && *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(f, "\\%c", *c);
+    } else if ((unsigned char)*c < 0x20) {
+      fprintf(f, "\\u%04x", *c);
+    } else {
+      fputc(*c, f);
+    }
+  }
+  fputc('"', f);
+}
+
+static double msec(uint64_t ns) { return ns / NSEC_PER_MSEC; }
+
+static void print_text(FILE *f, struct wooz_state *state) {
+  struct wooz_stats *stats = &state->stats;
+
+  fprintf(f, "wooz stats (uptime %.3f s)\n",
+          msec(stats_now() - stats->start_time) / 1000.0);
+  fprintf(f, "  event loop wakeups: %llu\n",
+          (unsigned long long)event_loop_get_wakeups(state->event_loop));
+  fprintf(f, "  roundtrips: %llu\n", (unsigned long long)stats->roundtrips);
+  fprintf(f, "  surface commits: %llu\n", (unsigned long long)stats->commits);
+  fprintf(f, "  kernels:");
+  for (int i = 0; i < WOOZ_KERNEL_COUNT; i++) {
+    fprintf(f, "%s %s %s", i > 0 ? "," : "", kernel_name(i),
+            isa_name(kernel_isa(i)));
+  }
+  fprintf(f, "\n");
+  fprintf(f, "  events:\n");
+  for (int i = 0; i < WOOZ_STATS_LISTENER_COUNT; i++) {
+    fprintf(f, "    %s: %llu\n", listener_names[i],
+            (unsigned long long)stats->events[i]);
+  }
+
+  struct wooz_output *output;
+  wl_list_for_each(output, &state->outputs, link) {
+    if (output->buffer == NULL) {
+      continue;
+    }
+    struct buffer_usage usage = output_buffer_usage(state, output);
+    struct wooz_capture_stats *capture = &output->capture_stats;
+    char format[5];
+    format_name(usage.format, format);
+
+    fprintf(f, "  output %s:\n", output->name ? output->name : "unknown");
+    fprintf(f, "    capture buffers: %zu, %zu bytes, format %s\n",
+            usage.capture_buffers, usage.capture_bytes, format);
+    fprintf(f, "    window buffers: %zu, %zu bytes\n", usage.window_buffers,
+            usage.window_bytes);
+    if (output->history != NULL) {
+      fprintf(f, "    history: %zu snapshots, %zu tiles, %zu bytes\n",
+              output->history->count, output->history->n_tiles,
+              output->history->tile_data);
+    }
+    fprintf(f, "    captures: %llu, %llu failed\n",
+            (unsigned long long)capture->count,
+            (unsigned long long)capture->failed);
+    if (capture->count > 0) {
+      fprintf(f,
+              "    capture latency: last %.3f ms, avg %.3f ms, min %.3f ms, "
+              "max %.3f ms\n",
+              msec(capture->last), msec(capture->total) / capture->count,
+              msec(capture->min), msec(capture->max));
+    }
+    uint64_t latency = presentation_latency(state, output);
+    if (latency > 0) {
+      fprintf(f, "    presentation latency: %.3f ms\n", msec(latency));
+    }
+  }
+}
+
+static void print_json(FILE *f, struct wooz_state *state) {
+  struct wooz_stats *stats = &state->stats;
+
+  fprintf(f, "{\"uptime_ms\":%.3f", msec(stats_now() - stats->start_time));
+  fprintf(f, ",\"wakeups\":%llu",
+          (unsigned long long)event_loop_get_wakeups(state->event_loop));
+  fprintf(f, ",\"roundtrips\":%llu", (unsigned long long)stats->roundtrips);
+  fprintf(f, ",\"commits\":%llu", (unsigned long long)stats->commits);
+  fprintf(f, ",\"kernels\":{");
+  for (int i = 0; i < WOOZ_KERNEL_COUNT; i++) {
+    fprintf(f, "%s\"%s\":\"%s\"", i > 0 ? "," : "", kernel_name(i),
+            isa_name(kernel_isa(i)));
+  }
+  fprintf(f, "}");
+  fprintf(f, ",\"events\":{");
+  for (int i = 0; i < WOOZ_STATS_LISTENER_COUNT; i++) {
+    fprintf(f, "%s\"%s\":%llu", i > 0 ? "," : "", listener_names[i],
+            (unsigned long long)stats->events[i]);
+  }
+  fprintf(f, "},\"outputs\":[");
+
+  bool first = true;
+  struct wooz_output *output;
+  wl_list_for_each(output, &state->outputs, link) {
+    if (output->buffer == NULL) {
+      continue;
+    }
+    struct buffer_usage usage = output_buffer_usage(state, output);
+    struct wooz_capture_stats *capture = &output->capture_stats;
+    char format[5];
+    format_name(usage.format, format);
+
+    fprintf(f, "%s{\"name\":", first ? "" : ",");
+    print_json_string(f, output->name);
+    fprintf(f, ",\"format\":\"%s\"", format);
+    fprintf(f, ",\"capture_buffers\":%zu,\"capture_bytes\":%zu",
+            usage.capture_buffers, usage.capture_bytes);
+    fprintf(f, ",\"window_buffers\":%zu,\"window_bytes\":%zu",
+            usage.window_buffers, usage.window_bytes);
+    const struct wooz_history *history = output->history;
+    fprintf(f,
+            ",\"history_snapshots\":%zu,\"history_tiles\":%zu,"
+            "\"history_bytes\":%zu",
+            history != NULL ? history->count : 0,
+            history != NULL ? history->n_tiles : 0,
+            history != NULL ? history->tile_data : 0);
+    fprintf(f, ",\"captures\":%llu,\"failed_captures\":%llu",
+            (unsigned long long)capture->count,
+            (unsigned long long)capture->failed);
+    fprintf(f,
+            ",\"latency_ms\":{\"last\":%.3f,\"avg\":%.3f,\"min\":%.3f,"
+            "\"max\":%.3f}",
+            msec(capture->last),
+            capture->count > 0 ? msec(capture->total) / capture->count : 0.0,
+            msec(capture->min), msec(capture->max));
+    fprintf(f, ",\"presentation_latency_ms\":%.3f}",
+            msec(presentation_latency(state, output)));
+    first = false;
+  }
+  fprintf(f, "]}\n");
+}
+
+void print_stats(FILE *f, struct wooz_state *state,
+                 enum wooz_stats_format format) {
+  if (format == WOOZ_STATS_JSON) {
+    print_json(f, state);
+  } else {
+    print_text(f, state);
+  }
+  fflush(f);
+}
@@ -0,0 +1,190 @@
+#define _GNU_SOURCE // splice
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+// Frames worth of bytes read per call, so that a fast producer can't starve
+// the event loop while stale frames are still skipped.
+#define STREAM_READ_FRAMES 2
+#define STREAM_DISCARD_SIZE 16384
+
+static const struct {
+  const char *name;
+  enum wl_shm_format format;
+} shm_formats[] = {
+    {"argb8888", WL_SHM_FORMAT_ARGB8888},
+    {"xrgb8888", WL_SHM_FORMAT_XRGB8888},
+    {"abgr8888", WL_SHM_FORMAT_ABGR8888},
+    {"xbgr8888", WL_SHM_FORMAT_XBGR8888},
+    {"rgba8888", WL_SHM_FORMAT_RGBA8888},
+    {"rgbx8888", WL_SHM_FORMAT_RGBX8888},
+    {"bgra8888", WL_SHM_FORMAT_BGRA8888},
+    {"bgrx8888", WL_SHM_FORMAT_BGRX8888},
+    {"argb2101010", WL_SHM_FORMAT_ARGB2101010},
+    {"xrgb2101010", WL_SHM_FORMAT_XRGB2101010},
+    {"abgr2101010", WL_SHM_FORMAT_ABGR2101010},
+    {"xbgr2101010", WL_SHM_FORMAT_XBGR2101010},
+    {"rgb888", WL_SHM_FORMAT_RGB888},
+    {"bgr888", WL_SHM_FORMAT_BGR888},
+    {"rgb565", WL_SHM_FORMAT_RGB565},
+};
+
+bool parse_shm_format(const char *name, enum wl_shm_format *format) {
+  for (size_t i = 0; i < sizeof(shm_formats) / sizeof(shm_formats[0]); i++) {
+    if (strcasecmp(name, shm_formats[i].name) == 0) {
+      *format = shm_formats[i].format;
+      return true;
+    }
+  }
+  return false;
+}
+
+struct wooz_stream *stream_create(struct wl_shm *shm, int fd,
+                                  enum wl_shm_format format, int32_t width,
+                                  int32_t height) {
+  struct wooz_stream *stream = calloc(1, sizeof(struct wooz_stream));
+  if (stream == NULL) {
+    return NULL;
+  }
+  stream->fd = fd;
+  stream->fd_flags = -1;
+  stream->format = format;
+  stream->width = width;
+  stream->height = height;
+  stream->stride = width * shm_format_bytes_per_pixel(format);
+  stream->frame_size = (size_t)stream->stride * height;
+  struct stat st;
+  stream->is_file = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  // splice() fails with EINVAL if fd isn't a pipe, reads are used then.
+  stream->use_splice = !stream->is_file;
+
+  for (int i = 0; i < STREAM_MAX_BUFFERS; i++) {
+    stream->buffers[i] =
+        create_buffer_with_fd(shm, format, width, height, stream->stride);
+    if (stream->buffers[i] == NULL) {
+      stream_destroy(stream);
+      return NULL;
+    }
+  }
+
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    stream_destroy(stream);
+    return NULL;
+  }
+  stream->fd_flags = flags;
+  return stream;
+}
+
+void stream_destroy(struct wooz_stream *stream) {
+  if (stream == NULL) {
+    return;
+  }
+  if (stream->fd_flags >= 0) {
+    // Leave a terminal or a pipe shared with other processes as it was.
+    fcntl(stream->fd, F_SETFL, stream->fd_flags);
+  }
+  for (int i = 0; i < STREAM_MAX_BUFFERS; i++) {
+    destroy_buffer(stream->buffers[i]);
+  }
+  free(stream);
+}
+
+// Pick the buffer the next frame is read into.
+static struct wooz_buffer *next_buffer(struct wooz_stream *stream) {
+  for (int i = 0; i < STREAM_MAX_BUFFERS; i++) {
+    struct wooz_buffer *buffer = stream->buffers[i];
+    if (!buffer->busy && buffer != stream->ready && buffer != stream->shown) {
+      return buffer;
+    }
+  }
+
+  // The compositor holds every other buffer, overwrite the frame waiting to
+  // be shown.
+  struct wooz_buffer *buffer = stream->ready;
+  if (buffer != NULL) {
+    stream->ready = NULL;
+    stream->dropped++;
+  }
+  return buffer;
+}
+
+static ssize_t read_frame_data(struct wooz_stream *stream, size_t len) {
+  if (stream->filling == NULL) {
+    uint8_t discard[STREAM_DISCARD_SIZE];
+    size_t n = len < sizeof(discard) ? len : sizeof(discard);
+    return read(stream->fd, discard, n);
+  }
+
+  if (stream->use_splice) {
+    loff_t offset = stream->filled;
+    ssize_t n = splice(stream->fd, NULL, stream->filling->fd, &offset, len,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n >= 0 || errno != EINVAL) {
+      return n;
+    }
+    stream->use_splice = false;
+  }
+  return read(stream->fd, (uint8_t *)stream->filling->data + stream->filled,
+              len);
+}
+
+bool stream_read(struct wooz_stream *stream, bool *new_frame) {
+  // Files always have data, their frames are taken one per call.
+  size_t budget =
+      (stream->is_file ? 1 : STREAM_READ_FRAMES) * stream->frame_size;
+  *new_frame = false;
+
+  while (budget > 0) {
+    if (stream->filled == 0) {
+      stream->filling = next_buffer(stream);
+    }
+
+    size_t len = stream->frame_size - stream->filled;
+    ssize_t n = read_frame_data(stream, len < budget ? len : budget);
+    if (n == 0) {
+      return false;
+    } else if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN;
+    }
+    stream->filled += n;
+    budget -= n;
+
+    if (stream->filled < stream->frame_size) {
+      continue;
+    }
+    stream->filled = 0;
+    stream->frames++;
+    if (stream->filling == NULL) {
+      stream->dropped++;
+      continue;
+    }
+    if (stream->ready != NULL) {
+      stream->dropped++;
+    }
+    stream->ready = stream->filling;
+    stream->filling = NULL;
+    *new_frame = true;
+    // The content changed under any cached table.
+    stream->ready->sat_valid = false;
+  }
+  return true;
+}
+
+struct wooz_buffer *stream_take_frame(struct wooz_stream *stream) {
+  struct wooz_buffer *frame = stream->ready;
+  if (frame != NULL) {
+    stream->shown = frame;
+    stream->ready = NULL;
+  }
+  return frame;
+}
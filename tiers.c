@@ -0,0 +1,156 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tiers.h"
+
+#define TIER_BPP 4
+
+bool plan_tiers(int32_t width, int32_t height, size_t budget,
+                struct wooz_tier_plan *plan) {
+  // Half the budget for the downscaled capture, an eighth for the strip
+  // being captured and the rest for two detail regions.
+  size_t full = (size_t)width * height * TIER_BPP;
+  int32_t scale = 2;
+  while (full / ((size_t)scale * scale) > budget / 2) {
+    scale *= 2;
+    if (scale > TIER_MAX_SCALE) {
+      return false;
+    }
+  }
+
+  size_t strip_rows = budget / 8 / ((size_t)width * TIER_BPP);
+  if (strip_rows == 0) {
+    return false;
+  }
+
+  // Detail regions keep the output aspect ratio.
+  double pixels = budget * 3 / 16 / TIER_BPP;
+  double detail_width = sqrt(pixels * width / height);
+  detail_width = detail_width < width ? detail_width : width;
+  double detail_height = pixels / detail_width;
+  detail_height = detail_height < height ? detail_height : height;
+  if (detail_width < 1 || detail_height < 1) {
+    return false;
+  }
+
+  plan->scale = scale;
+  plan->strip_rows =
+      strip_rows < (size_t)height ? (int32_t)strip_rows : height;
+  plan->detail_width = (int32_t)detail_width;
+  plan->detail_height = (int32_t)detail_height;
+  return true;
+}
+
+// Whether every byte of a pixel of format is an 8 bit channel.
+static bool has_byte_channels(enum wl_shm_format format) {
+  switch (format) {
+  case WL_SHM_FORMAT_ARGB8888:
+  case WL_SHM_FORMAT_XRGB8888:
+  case WL_SHM_FORMAT_ABGR8888:
+  case WL_SHM_FORMAT_XBGR8888:
+  case WL_SHM_FORMAT_RGBA8888:
+  case WL_SHM_FORMAT_RGBX8888:
+  case WL_SHM_FORMAT_BGRA8888:
+  case WL_SHM_FORMAT_BGRX8888:
+  case WL_SHM_FORMAT_RGB888:
+  case WL_SHM_FORMAT_BGR888:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool downscaler_init(struct wooz_downscaler *downscaler,
+                     struct wooz_buffer *dst, int32_t scale) {
+  int32_t bpp = shm_format_bytes_per_pixel(dst->format);
+  if (bpp == 0) {
+    return false;
+  }
+  *downscaler = (struct wooz_downscaler){
+      .dst = dst,
+      .scale = scale,
+      .bpp = bpp,
+      .average = has_byte_channels(dst->format),
+  };
+  downscaler->sums = calloc((size_t)dst->width * bpp, sizeof(uint32_t));
+  return downscaler->sums != NULL;
+}
+
+static void flush_row(struct wooz_downscaler *downscaler) {
+  struct wooz_buffer *dst = downscaler->dst;
+  if (downscaler->rows == 0 || downscaler->dst_row >= dst->height) {
+    return;
+  }
+
+  uint8_t *row =
+      (uint8_t *)dst->data + (size_t)downscaler->dst_row * dst->stride;
+  if (downscaler->average) {
+    int32_t bpp = downscaler->bpp;
+    int32_t scale = downscaler->scale;
+    for (int32_t x = 0; x < dst->width; x++) {
+      // The last column may cover fewer source columns.
+      uint32_t *sums = downscaler->sums + (size_t)x * bpp;
+      int32_t cols = downscaler->width - x * scale;
+      cols = cols < scale ? cols : scale;
+      uint32_t n = downscaler->rows * (cols > 0 ? cols : 1);
+      for (int32_t b = 0; b < bpp; b++) {
+        row[x * bpp + b] = (uint8_t)((sums[b] + n / 2) / n);
+        sums[b] = 0;
+      }
+    }
+  }
+  downscaler->rows = 0;
+}
+
+void downscaler_add(struct wooz_downscaler *downscaler,
+                    const struct wooz_buffer *src, int32_t y) {
+  struct wooz_buffer *dst = downscaler->dst;
+  int32_t scale = downscaler->scale;
+  int32_t bpp = downscaler->bpp;
+  int32_t width = src->width < dst->width * scale ? src->width
+                                                  : dst->width * scale;
+  int32_t height = (int32_t)(src->size / src->stride);
+  downscaler->width = width;
+
+  for (int32_t r = 0; r < height; r++, y++) {
+    // Consecutive region captures may overlap by a row with fractional
+    // scales.
+    if (y < downscaler->next_row) {
+      continue;
+    }
+    downscaler->next_row = y + 1;
+
+    if (y / scale != downscaler->dst_row) {
+      flush_row(downscaler);
+      downscaler->dst_row = y / scale;
+    }
+    if (downscaler->dst_row >= dst->height) {
+      return;
+    }
+
+    const uint8_t *line =
+        (const uint8_t *)src->data + (size_t)r * src->stride;
+    if (downscaler->average) {
+      for (int32_t x = 0; x < width; x++) {
+        uint32_t *sums = downscaler->sums + (size_t)(x / scale) * bpp;
+        for (int32_t b = 0; b < bpp; b++) {
+          sums[b] += line[x * bpp + b];
+        }
+      }
+    } else if (downscaler->rows == 0) {
+      uint8_t *row =
+          (uint8_t *)dst->data + (size_t)downscaler->dst_row * dst->stride;
+      for (int32_t x = 0; x * scale < width; x++) {
+        memcpy(row + x * bpp, line + (size_t)x * scale * bpp, bpp);
+      }
+    }
+    downscaler->rows++;
+  }
+}
+
+void downscaler_finish(struct wooz_downscaler *downscaler) {
+  flush_row(downscaler);
+  free(downscaler->sums);
+  downscaler->sums = NULL;
+}
@@ -0,0 +1,148 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "tiles.h"
+
+// Fold the lanes hash_tile_line() fed into one hash.
+static uint64_t finish_hash(const uint32_t *lanes) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (int j = 0; j < KERNEL_HASH_LANES; j++) {
+    hash = (hash ^ lanes[j]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+void tile_layout(const struct wooz_buffer *buffer, int32_t *cols,
+                 int32_t *rows, size_t *tile_bytes) {
+  int32_t bpp = shm_format_bytes_per_pixel(buffer->format);
+  *tile_bytes = (size_t)TILE_SIZE * (bpp > 0 ? bpp : 4);
+  *cols = (int32_t)((buffer->stride + *tile_bytes - 1) / *tile_bytes);
+  int32_t height = (int32_t)(buffer->size / buffer->stride);
+  *rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+bool update_tile_hashes(struct wooz_buffer *buffer) {
+  int32_t cols, rows;
+  size_t tile_bytes;
+  tile_layout(buffer, &cols, &rows, &tile_bytes);
+
+  if (buffer->tile_hashes == NULL) {
+    buffer->tile_hashes = calloc((size_t)cols * rows, sizeof(uint64_t));
+    if (buffer->tile_hashes == NULL) {
+      return false;
+    }
+    buffer->tile_cols = cols;
+    buffer->tile_rows = rows;
+  }
+
+  size_t lanes_size = (size_t)cols * KERNEL_HASH_LANES * sizeof(uint32_t);
+  uint32_t *lanes = malloc(lanes_size);
+  if (lanes == NULL) {
+    return false;
+  }
+
+  // Only pixels are hashed, not the padding bytes compositors leave
+  // undefined. Rotated buffers keep their raw rows, upright sizes swapped.
+  int32_t height = (int32_t)(buffer->size / buffer->stride);
+  int32_t width = buffer->height == height ? buffer->width : buffer->height;
+  int32_t bpp = shm_format_bytes_per_pixel(buffer->format);
+  size_t len = (size_t)buffer->stride;
+  if (bpp > 0 && (size_t)width * bpp < len) {
+    len = (size_t)width * bpp;
+  }
+  bool padding = buffer->format == WL_SHM_FORMAT_XRGB8888 ||
+                 buffer->format == WL_SHM_FORMAT_XBGR8888;
+  for (int32_t row = 0; row < rows; row++) {
+    memset(lanes, 0, lanes_size);
+
+    // Walk the buffer row by row to keep memory accesses sequential.
+    int32_t y_end = row * TILE_SIZE + TILE_SIZE;
+    y_end = y_end < height ? y_end : height;
+    for (int32_t y = row * TILE_SIZE; y < y_end; y++) {
+      const uint8_t *line =
+          (const uint8_t *)buffer->data + (size_t)y * buffer->stride;
+      hash_tile_line(lanes, line, len, tile_bytes, padding);
+    }
+
+    for (int32_t col = 0; col < cols; col++) {
+      buffer->tile_hashes[row * cols + col] =
+          finish_hash(lanes + col * KERNEL_HASH_LANES);
+    }
+  }
+
+  free(lanes);
+  return true;
+}
+
+size_t diff_tile_hashes(const struct wooz_buffer *a,
+                        const struct wooz_buffer *b, bool *changed) {
+  size_t n = (size_t)a->tile_cols * a->tile_rows;
+  size_t n_changed = 0;
+  for (size_t i = 0; i < n; i++) {
+    changed[i] = a->tile_hashes[i] != b->tile_hashes[i];
+    n_changed += changed[i];
+  }
+  return n_changed;
+}
+
+bool can_diff_format(enum wl_shm_format format) {
+  switch (format) {
+  case WL_SHM_FORMAT_ARGB8888:
+  case WL_SHM_FORMAT_XRGB8888:
+  case WL_SHM_FORMAT_ABGR8888:
+  case WL_SHM_FORMAT_XBGR8888:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool diff_buffers(struct wooz_buffer *dst, const struct wooz_buffer *a,
+                  const struct wooz_buffer *b, size_t *n_different) {
+  if (!can_diff_format(a->format) || a->format != b->format ||
+      a->width != b->width || a->height != b->height ||
+      a->stride != b->stride || dst->stride != a->stride ||
+      dst->height != a->height) {
+    return false;
+  }
+
+  bool alpha = a->format == WL_SHM_FORMAT_ARGB8888 ||
+               a->format == WL_SHM_FORMAT_ABGR8888;
+  *n_different = 0;
+  for (int32_t y = 0; y < a->height; y += TILE_SIZE) {
+    int32_t rows = a->height - y < TILE_SIZE ? a->height - y : TILE_SIZE;
+    for (int32_t x = 0; x < a->width; x += TILE_SIZE) {
+      int32_t cols = a->width - x < TILE_SIZE ? a->width - x : TILE_SIZE;
+      size_t offset = (size_t)y * a->stride + (size_t)x * sizeof(uint32_t);
+      *n_different += diff_pixels32(
+          (uint32_t *)((uint8_t *)dst->data + offset),
+          (const uint32_t *)((const uint8_t *)a->data + offset),
+          (const uint32_t *)((const uint8_t *)b->data + offset), cols, rows,
+          a->stride, alpha);
+    }
+  }
+  return true;
+}
+
+void damage_tiles(struct wl_surface *surface, const struct wooz_buffer *buffer,
+                  const bool *changed) {
+  for (int32_t row = 0; row < buffer->tile_rows; row++) {
+    const bool *line = changed + row * buffer->tile_cols;
+    int32_t col = 0;
+    while (col < buffer->tile_cols) {
+      if (!line[col]) {
+        col++;
+        continue;
+      }
+
+      int32_t start = col;
+      while (col < buffer->tile_cols && line[col]) {
+        col++;
+      }
+      wl_surface_damage_buffer(surface, start * TILE_SIZE, row * TILE_SIZE,
+                               (col - start) * TILE_SIZE, TILE_SIZE);
+    }
+  }
+}
@@ -0,0 +1,31 @@
+#include "view.h"
+
+#define min(x, y) (x < y ? x : y)
+#define max(x, y) (x > y ? x : y)
+
+bool view_zoom(struct wooz_boxf *view, double ratio, double window_width,
+               double window_height, double change, double center_x,
+               double center_y) {
+  if (view->width - change * ratio < VIEW_MIN_SIZE ||
+      view->height - change < VIEW_MIN_SIZE) {
+    return false;
+  }
+
+  // The point under the center stays in place.
+  double dx = center_x / window_width;
+  double dy = center_y / window_height;
+
+  view->x += change * ratio * dx;
+  view->width -= change * ratio;
+  view->y += change * dy;
+  view->height -= change;
+  return true;
+}
+
+void view_clamp(struct wooz_boxf *view, double ratio, double width,
+                double height) {
+  view->width = max(min(view->width, width), VIEW_MIN_SIZE * ratio);
+  view->height = max(min(view->height, height), VIEW_MIN_SIZE);
+  view->x = max(min(view->x, width - view->width), 0);
+  view->y = max(min(view->y, height - view->height), 0);
+}
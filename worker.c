@@ -0,0 +1,142 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "worker.h"
+
+struct wooz_worker {
+  struct wooz_event_loop *loop;
+  pthread_t thread;
+  int event_fd; // Signalled by the thread when a job is done
+  struct wooz_event_source *source;
+
+  // Protected by lock.
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  wooz_work_func_t work; // Job to run, NULL once it started
+  void *data;
+  bool finished; // The job ran, its completion callback is pending
+  bool quit;
+
+  // Event loop thread only.
+  bool busy;
+  wooz_work_func_t done;
+  void *done_data;
+};
+
+static void *worker_run(void *data) {
+  struct wooz_worker *worker = data;
+
+  pthread_mutex_lock(&worker->lock);
+  for (;;) {
+    while (worker->work == NULL && !worker->quit) {
+      pthread_cond_wait(&worker->cond, &worker->lock);
+    }
+    if (worker->quit) {
+      break;
+    }
+
+    wooz_work_func_t work = worker->work;
+    void *work_data = worker->data;
+    worker->work = NULL;
+    pthread_mutex_unlock(&worker->lock);
+
+    work(work_data);
+
+    pthread_mutex_lock(&worker->lock);
+    worker->finished = true;
+    uint64_t one = 1;
+    write(worker->event_fd, &one, sizeof(one));
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return NULL;
+}
+
+static void handle_worker_event(int fd, uint32_t events, void *data) {
+  struct wooz_worker *worker = data;
+
+  uint64_t count;
+  read(fd, &count, sizeof(count));
+
+  pthread_mutex_lock(&worker->lock);
+  bool finished = worker->finished;
+  worker->finished = false;
+  pthread_mutex_unlock(&worker->lock);
+  if (!finished) {
+    return;
+  }
+
+  // The callback may submit the next job.
+  worker->busy = false;
+  worker->done(worker->done_data);
+}
+
+struct wooz_worker *worker_create(struct wooz_event_loop *loop) {
+  struct wooz_worker *worker = calloc(1, sizeof(struct wooz_worker));
+  if (worker == NULL) {
+    return NULL;
+  }
+  worker->loop = loop;
+  pthread_mutex_init(&worker->lock, NULL);
+  pthread_cond_init(&worker->cond, NULL);
+
+  worker->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (worker->event_fd >= 0) {
+    worker->source = event_loop_add_fd(loop, worker->event_fd, EPOLLIN,
+                                       handle_worker_event, worker);
+  }
+  if (worker->source == NULL ||
+      pthread_create(&worker->thread, NULL, worker_run, worker) != 0) {
+    event_loop_remove_fd(loop, worker->source);
+    if (worker->event_fd >= 0) {
+      close(worker->event_fd);
+    }
+    pthread_cond_destroy(&worker->cond);
+    pthread_mutex_destroy(&worker->lock);
+    free(worker);
+    return NULL;
+  }
+  return worker;
+}
+
+void worker_destroy(struct wooz_worker *worker) {
+  if (worker == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&worker->lock);
+  worker->quit = true;
+  pthread_cond_signal(&worker->cond);
+  pthread_mutex_unlock(&worker->lock);
+  pthread_join(worker->thread, NULL);
+
+  event_loop_remove_fd(worker->loop, worker->source);
+  close(worker->event_fd);
+  pthread_cond_destroy(&worker->cond);
+  pthread_mutex_destroy(&worker->lock);
+  free(worker);
+}
+
+bool worker_submit(struct wooz_worker *worker, wooz_work_func_t work,
+                   wooz_work_func_t done, void *data) {
+  if (worker->busy) {
+    return false;
+  }
+  worker->busy = true;
+  worker->done = done;
+  worker->done_data = data;
+
+  pthread_mutex_lock(&worker->lock);
+  worker->work = work;
+  worker->data = data;
+  pthread_cond_signal(&worker->cond);
+  pthread_mutex_unlock(&worker->lock);
+  return true;
+}
+
+bool worker_is_busy(const struct wooz_worker *worker) {
+  return worker->busy;
+}